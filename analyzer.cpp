@@ -0,0 +1,1042 @@
+#include <algorithm>
+#include <deque>
+#include <optional>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "analyzer.h"
+#include "budget.h"
+#include "bytecode.h"
+#include "closure.h"
+#include "profiler.h"
+
+namespace {
+
+bool IsFalse(const std::shared_ptr<Object>& value) {
+    return Is<Boolean>(value) && !Cast<Boolean>(value)->GetValue();
+}
+
+std::shared_ptr<Object> EvalNode(const std::shared_ptr<Object>& node,
+                                 const std::shared_ptr<Scope>& scope) {
+    return node ? node->Eval(scope) : nullptr;
+}
+
+// Kept out of Body::Eval, which is on the stack once per nested call.
+[[gnu::noinline]] void BoxSlots(const std::vector<std::size_t>& slots, const Scope& scope) {
+    for (auto slot : slots) {
+        auto& value = scope.GetSlot(slot);
+        value = Allocate<Box>(std::move(value));
+    }
+}
+
+}  // namespace
+
+std::shared_ptr<Object> LocalRef::Eval(std::shared_ptr<Scope> scope) {
+    const auto& value = scope->GetSlot(slot_);
+    return is_boxed_ ? Cast<Box>(value)->Get() : value;
+}
+
+std::shared_ptr<Object> CapturedRef::Eval(std::shared_ptr<Scope> scope) {
+    const auto& value = scope->GetCapture(index_);
+    return is_boxed_ ? Cast<Box>(value)->Get() : value;
+}
+
+std::shared_ptr<Object> SelfRef::Eval(std::shared_ptr<Scope> scope) {
+    return scope->GetClosure()->shared_from_this();
+}
+
+std::shared_ptr<Object> Call::Eval(std::shared_ptr<Scope> scope) {
+    BudgetFrame frame;
+    if (IsFoldValid(*scope)) {
+        return *folded_;
+    }
+    if (IsResolved(*scope)) {
+        SCHEME_PROFILE_CALL(function_.get());
+        if (is_tail_ && ::GetType(function_.get()) == Type::CLOSURE) {
+            return Closure::TailCall(Cast<Closure>(function_), function_, scope, args_);
+        }
+        return ApplyValue(function_, scope, args_);
+    }
+    // A function calling itself by name needs no lookup, nor a reference to itself.
+    if (head_->GetType() == Type::SELF_REF) {
+        auto closure = scope->GetClosure();
+        SCHEME_PROFILE_CALL(closure);
+        if (is_tail_) {
+            return Closure::TailCall(closure, nullptr, scope, args_);
+        }
+        return closure->Apply(scope, args_);
+    }
+    auto function = head_->Eval(scope);
+    if (!function) {
+        throw RuntimeError("Bad function");
+    }
+    SCHEME_PROFILE_CALL(function.get());
+    if (is_tail_ && ::GetType(function.get()) == Type::CLOSURE) {
+        auto closure = Cast<Closure>(function);
+        return Closure::TailCall(closure, std::move(function), scope, args_);
+    }
+    return ApplyValue(function, scope, args_);
+}
+
+std::shared_ptr<Object> Assignment::Eval(std::shared_ptr<Scope> scope) {
+    std::shared_ptr<Object> value;
+    if (value_) {
+        value = value_->Eval(scope);
+    }
+    if (is_definition_) {
+        scope->Define(id_, value);
+    } else {
+        scope->Reset(id_, value);
+    }
+    return nullptr;
+}
+
+std::shared_ptr<Object> LocalAssignment::Eval(std::shared_ptr<Scope> scope) {
+    auto value = EvalNode(value_, scope);
+    if (is_captured_) {
+        Cast<Box>(scope->GetCapture(index_))->Set(std::move(value));
+        return nullptr;
+    }
+    auto& slot = scope->GetSlot(index_);
+    if (is_boxed_) {
+        Cast<Box>(slot)->Set(std::move(value));
+    } else {
+        slot = std::move(value);
+    }
+    return nullptr;
+}
+
+void If::MoveChildren(std::vector<std::shared_ptr<Object>>* children) {
+    for (auto* node : {&condition_, &consequent_, &alternative_}) {
+        if (*node) {
+            children->push_back(std::move(*node));
+        }
+    }
+}
+
+std::shared_ptr<Object> If::Eval(std::shared_ptr<Scope> scope) {
+    const auto& branch = IsFalse(EvalNode(condition_, scope)) ? alternative_ : consequent_;
+    return EvalNode(branch, scope);
+}
+
+std::shared_ptr<Object> Body::Eval(const std::shared_ptr<Scope>& scope) const {
+    if (!boxed_slots.empty()) {
+        BoxSlots(boxed_slots, *scope);
+    }
+    for (std::size_t i = 0; i + 1 < nodes.size(); ++i) {
+        EvalNode(nodes[i], scope);
+    }
+    return EvalNode(nodes.back(), scope);
+}
+
+void Body::MoveChildren(std::vector<std::shared_ptr<Object>>* children) {
+    for (auto& node : nodes) {
+        if (node) {
+            children->push_back(std::move(node));
+        }
+    }
+}
+
+std::shared_ptr<Object> Lambda::Eval(std::shared_ptr<Scope> scope) {
+    Closure::Captures captures;
+    captures.reserve(captures_.size());
+    for (const auto& source : captures_) {
+        switch (source.kind) {
+            case CaptureSource::Kind::SLOT:
+                captures.push_back(scope->GetSlot(source.index));
+                break;
+            case CaptureSource::Kind::CAPTURE:
+                captures.push_back(scope->GetCapture(source.index));
+                break;
+            case CaptureSource::Kind::SELF:
+                captures.push_back(scope->GetClosure()->shared_from_this());
+                break;
+        }
+    }
+    return Allocate<Closure>(shared_from_this(), scope->GetGlobal().shared_from_this(),
+                             std::move(captures));
+}
+
+void Let::MoveChildren(std::vector<std::shared_ptr<Object>>* children) {
+    for (auto& [slot, init] : bindings_) {
+        if (init) {
+            children->push_back(std::move(init));
+        }
+    }
+    body_.MoveChildren(children);
+}
+
+std::shared_ptr<Object> Let::Eval(std::shared_ptr<Scope> scope) {
+    if (!frame_size_) {
+        return Bind(scope);
+    }
+    FrameSlots slots(frame_size_);
+    Scope frame(&scope->GetGlobal(), slots.Get(), nullptr, nullptr);
+    if (program_) {
+        return Execute(*program_, FramePointer(&frame));
+    }
+    return Bind(FramePointer(&frame));
+}
+
+std::shared_ptr<Object> Let::Bind(const std::shared_ptr<Scope>& scope) const {
+    // The slots were reserved before the inits were analyzed, so the lets nested in them use
+    // others and the values can be stored right away.
+    for (const auto& [slot, init] : bindings_) {
+        scope->GetSlot(slot) = EvalNode(init, scope);
+    }
+    return body_.Eval(scope);
+}
+
+namespace {
+
+// Variable of a lambda or let, known by its slot in the frame of the enclosing function.
+struct Variable {
+    Variable(SymbolId id, std::size_t slot) : id(id), slot(slot) {
+    }
+
+    SymbolId id;
+    std::size_t slot;
+    // Defined in a body rather than bound by a lambda or let.
+    bool is_definition = false;
+    bool is_captured = false;
+    bool is_assigned = false;
+    // Defined once by a lambda and never assigned, so the lambda can refer to itself
+    // without capturing the variable.
+    bool can_be_self = false;
+    // Nodes that read or assign the variable.
+    std::vector<Object*> uses;
+
+    // Closures copy what they capture, so a captured variable that may change afterwards
+    // has to be shared through a box: one that is assigned, or a definition, which may be
+    // captured before it runs. Local functions that call each other thus hold each other
+    // through their boxes, which is left to the cycle collector.
+    bool IsBoxed() const {
+        return is_captured && (is_assigned || is_definition);
+    }
+};
+
+struct Capture {
+    CaptureSource source;
+    Variable* variable;
+    // Whether the value is the closure the variable names rather than the variable.
+    bool is_self;
+};
+
+// Lexical environment of a lambda being analyzed, or of the top level.
+struct Context {
+    // Variables in scope, innermost last.
+    std::vector<Variable*> visible;
+    std::size_t used_slots = 0, frame_size = 0;
+    std::vector<Capture> captures;
+    // The variable the lambda is defined as, when it may refer to itself.
+    Variable* self = nullptr;
+};
+
+// Forms are analyzed with an explicit stack of partially built nodes, so deeply nested
+// input does not recurse.
+class Analyzer {
+public:
+    Analyzer(const std::shared_ptr<Scope>& scope, bool is_strict)
+        : scope_(scope), is_strict_(is_strict), contexts_(1) {
+    }
+
+    std::shared_ptr<Object> Analyze(const std::shared_ptr<Object>& expression) {
+        return Run(Start(expression, false));
+    }
+
+    std::shared_ptr<Object> AnalyzeForm(FormKind kind, const std::shared_ptr<Object>& args) {
+        return Run(StartForm(kind, PendingForm{}, args));
+    }
+
+    std::size_t GetDepth() const {
+        return depth_;
+    }
+
+    std::size_t GetFolded() const {
+        return folded_;
+    }
+
+    std::vector<GlobalUse> GetGlobals() {
+        std::sort(used_globals_.begin(), used_globals_.end());
+        used_globals_.erase(std::unique(used_globals_.begin(), used_globals_.end()),
+                            used_globals_.end());
+        std::vector<GlobalUse> globals;
+        globals.reserve(used_globals_.size());
+        for (auto id : used_globals_) {
+            auto is_bound = scope_->IsBound(id);
+            globals.push_back({id, is_bound, is_bound ? *scope_->GetGlobalSlot(id) : nullptr});
+        }
+        return globals;
+    }
+
+private:
+    enum class FormType { CALL, ASSIGNMENT, IF, LAMBDA, LET_INITS, LET_BODY };
+
+    // A form whose arguments, or body, are being analyzed.
+    struct PendingForm {
+        FormType type = FormType::CALL;
+        std::shared_ptr<Object> head, function;
+        std::shared_ptr<Object> rest;
+        std::shared_ptr<Object> args;
+        std::shared_ptr<Cell> last;
+        std::size_t count = 0;
+        // In tail position of a lambda body.
+        bool is_tail = false;
+
+        // Assignments: the name, and the variable or capture it resolved to, if not global.
+        bool is_definition = false;
+        SymbolId id = 0;
+        Variable* variable = nullptr;
+        std::optional<std::size_t> capture;
+
+        // Lambdas and lets: the variables they bind and define.
+        std::vector<Variable*> variables;
+        std::size_t param_count = 0;
+        bool has_rest = false;
+        std::shared_ptr<Object> bindings, body;
+        std::vector<std::size_t> binding_slots;
+        std::vector<std::shared_ptr<Object>> inits;
+        std::size_t saved_visible = 0, saved_slots = 0;
+        bool owns_frame = false;
+    };
+
+    std::shared_ptr<Object> Run(std::optional<std::shared_ptr<Object>> node) {
+        while (true) {
+            if (node) {
+                if (stack_.empty()) {
+                    return std::move(*node);
+                }
+                Append(&stack_.back(), std::move(*node));
+            }
+            auto& form = stack_.back();
+            if (Is<Cell>(form.rest)) {
+                auto cell = As<Cell>(form.rest);
+                form.rest = cell->GetSecond();
+                node = Start(cell->GetFirst(), IsTailChild(form));
+            } else {
+                node = Finish();
+            }
+        }
+    }
+
+    // Whether the next argument of the form, which has been taken from rest already, is in
+    // tail position of a lambda body.
+    static bool IsTailChild(const PendingForm& form) {
+        switch (form.type) {
+            case FormType::LAMBDA:
+                return !Is<Cell>(form.rest);
+            case FormType::LET_BODY:
+                return form.is_tail && !Is<Cell>(form.rest);
+            case FormType::IF:
+                return form.is_tail && form.count > 0;
+            default:
+                return false;
+        }
+    }
+
+    static Variable* FindVisible(const Context& context, SymbolId id) {
+        for (auto it = context.visible.rbegin(); it != context.visible.rend(); ++it) {
+            if ((*it)->id == id) {
+                return *it;
+            }
+        }
+        return nullptr;
+    }
+
+    static bool IsSelf(const Context& context, SymbolId id) {
+        return context.self && context.self->id == id;
+    }
+
+    bool IsInFunction() const {
+        return contexts_.size() > 1;
+    }
+
+    // Index of the capture of the innermost variable with the name in an enclosing function,
+    // captured by every function from there on in, if there is one.
+    std::optional<std::size_t> FindCapture(SymbolId id) {
+        auto current = contexts_.size() - 1;
+        auto level = current;
+        Variable* variable = nullptr;
+        bool is_self = false;
+        while (level-- > 0 && !variable) {
+            if ((variable = FindVisible(contexts_[level], id))) {
+                variable->is_captured = true;
+            } else if (IsSelf(contexts_[level], id)) {
+                variable = contexts_[level].self;
+                is_self = true;
+            }
+        }
+        if (!variable) {
+            return std::nullopt;
+        }
+        ++level;
+        CaptureSource source{is_self ? CaptureSource::Kind::SELF : CaptureSource::Kind::SLOT,
+                             is_self ? 0 : variable->slot};
+        std::size_t index = 0;
+        while (++level <= current) {
+            auto& captures = contexts_[level].captures;
+            auto it = std::find_if(captures.begin(), captures.end(), [&](const Capture& capture) {
+                return capture.variable == variable && capture.is_self == is_self;
+            });
+            index = it - captures.begin();
+            if (it == captures.end()) {
+                captures.push_back({source, variable, is_self});
+            }
+            source = {CaptureSource::Kind::CAPTURE, index};
+        }
+        return index;
+    }
+
+    std::shared_ptr<Object> Resolve(SymbolId id) {
+        auto& context = contexts_.back();
+        if (auto variable = FindVisible(context, id)) {
+            auto node = Allocate<LocalRef>(variable->slot);
+            variable->uses.push_back(node.get());
+            return node;
+        }
+        if (IsSelf(context, id)) {
+            return Allocate<SelfRef>();
+        }
+        if (auto index = FindCapture(id)) {
+            auto node = Allocate<CapturedRef>(*index);
+            const auto& capture = contexts_.back().captures[*index];
+            if (!capture.is_self) {
+                capture.variable->uses.push_back(node.get());
+            }
+            return node;
+        }
+        // Lambda bodies may refer to globals defined after them.
+        if (!IsInFunction() && !scope_->IsBound(id) && !defined_.count(id)) {
+            throw NameError("Unknown symbol");
+        }
+        return Allocate<GlobalRef>(id);
+    }
+
+    // Kind of the special form a name stands for where it is used.
+    FormKind GetFormKind(const std::shared_ptr<Object>& head) {
+        if (!Is<Symbol>(head)) {
+            return FormKind::CALL;
+        }
+        auto id = Cast<Symbol>(head)->GetId();
+        for (const auto& context : contexts_) {
+            if (FindVisible(context, id) || IsSelf(context, id)) {
+                return FormKind::CALL;
+            }
+        }
+        return GetGlobalFormKind(id);
+    }
+
+    FormKind GetGlobalFormKind(SymbolId id) {
+        used_globals_.push_back(id);
+        if (!scope_->IsBound(id)) {
+            return FormKind::CALL;
+        }
+        auto function = As<Function>(*scope_->GetGlobalSlot(id));
+        return function ? function->GetFormKind() : FormKind::CALL;
+    }
+
+    // Returns the node for the expression, or nothing if it opened a form whose arguments
+    // have to be analyzed first.
+    std::optional<std::shared_ptr<Object>> Start(const std::shared_ptr<Object>& expression,
+                                                 bool is_tail) {
+        if (!expression) {
+            return nullptr;
+        }
+        if (Is<Symbol>(expression)) {
+            return Resolve(As<Symbol>(expression)->GetId());
+        }
+        if (!Is<Cell>(expression)) {
+            return Allocate<Constant>(expression);
+        }
+
+        auto form = As<Cell>(expression);
+        PendingForm pending;
+        pending.is_tail = is_tail;
+        // A call of a computed function analyzes the head like the arguments.
+        if (Is<Cell>(form->GetFirst())) {
+            pending.rest = form;
+            Push(std::move(pending));
+            return std::nullopt;
+        }
+        // Other malformed call forms stay as they are, so they fail at run time like before.
+        if (!Is<Symbol>(form->GetFirst())) {
+            return form;
+        }
+        auto id = As<Symbol>(form->GetFirst())->GetId();
+        pending.head = Resolve(id);
+        if (Is<GlobalRef>(pending.head)) {
+            used_globals_.push_back(id);
+            if (scope_->IsBound(id)) {
+                pending.function = *scope_->GetGlobalSlot(id);
+            }
+        }
+        auto kind = FormKind::CALL;
+        if (auto builtin = As<Function>(pending.function)) {
+            kind = builtin->GetFormKind();
+        }
+        return StartForm(kind, std::move(pending), form->GetSecond());
+    }
+
+    std::optional<std::shared_ptr<Object>> StartForm(FormKind kind, PendingForm pending,
+                                                     const std::shared_ptr<Object>& args) {
+        switch (kind) {
+            case FormKind::QUOTE:
+                if (Is<Cell>(args) && !As<Cell>(args)->GetSecond()) {
+                    return Allocate<Constant>(As<Cell>(args)->GetFirst());
+                }
+                break;
+            case FormKind::DEFINE:
+            case FormKind::SET:
+                if (IsAssignment(args)) {
+                    auto name = As<Cell>(args);
+                    StartAssignment(&pending, kind, As<Symbol>(name->GetFirst())->GetId());
+                    pending.rest = name->GetSecond();
+                    Push(std::move(pending));
+                    return std::nullopt;
+                }
+                if (kind == FormKind::DEFINE && IsFunctionDefinition(args)) {
+                    // (define (name . params) body...) defines name as a lambda.
+                    auto signature = As<Cell>(As<Cell>(args)->GetFirst());
+                    StartAssignment(&pending, kind, As<Symbol>(signature->GetFirst())->GetId());
+                    auto self = GetSelfCandidate(pending);
+                    Push(std::move(pending));
+                    return StartLambda(signature->GetSecond(), As<Cell>(args)->GetSecond(), self);
+                }
+                break;
+            case FormKind::IF:
+                if (auto count = GetListSize(args); count == 2 || count == 3) {
+                    pending.type = FormType::IF;
+                    pending.rest = args;
+                    Push(std::move(pending));
+                    return std::nullopt;
+                }
+                return Malformed(&pending, args, "Expected condition and branches");
+            case FormKind::LAMBDA:
+                if (auto lambda = As<Cell>(args);
+                    lambda && IsParams(lambda->GetFirst()) && IsBody(lambda->GetSecond())) {
+                    Variable* self = nullptr;
+                    if (!stack_.empty() && stack_.back().count == 0) {
+                        self = GetSelfCandidate(stack_.back());
+                    }
+                    return StartLambda(lambda->GetFirst(), lambda->GetSecond(), self);
+                }
+                return Malformed(&pending, args, "Expected parameters and body");
+            case FormKind::LET:
+                if (auto let = As<Cell>(args);
+                    let && IsBindings(let->GetFirst()) && IsBody(let->GetSecond())) {
+                    StartLet(&pending, let->GetFirst(), let->GetSecond());
+                    Push(std::move(pending));
+                    return std::nullopt;
+                }
+                return Malformed(&pending, args, "Expected bindings and body");
+            case FormKind::CALL:
+            case FormKind::AND:
+            case FormKind::OR:
+                pending.rest = args;
+                Push(std::move(pending));
+                return std::nullopt;
+        }
+        // Arguments of malformed special forms are not expressions; the form rejects them.
+        return Malformed(&pending, args, "Malformed special form");
+    }
+
+    std::shared_ptr<Object> Malformed(PendingForm* pending, const std::shared_ptr<Object>& args,
+                                      const char* message) {
+        // Only the form itself is checked: nested ones fail when they run, as anywhere else.
+        if (is_strict_ && stack_.empty()) {
+            throw SyntaxError(message);
+        }
+        return Allocate<Call>(std::move(pending->head), std::move(pending->function),
+                              scope_->GetVersion(), args);
+    }
+
+    void StartAssignment(PendingForm* pending, FormKind kind, SymbolId id) {
+        pending->type = FormType::ASSIGNMENT;
+        pending->is_definition = kind == FormKind::DEFINE;
+        pending->id = id;
+        if ((pending->variable = FindVisible(contexts_.back(), id))) {
+            pending->variable->is_assigned |= !pending->is_definition;
+        } else if (pending->is_definition) {
+            // Definitions that are not in a body define globals.
+        } else if ((pending->capture = FindCapture(id))) {
+            contexts_.back().captures[*pending->capture].variable->is_assigned = true;
+        } else {
+            Resolve(id);
+        }
+    }
+
+    // The variable a lambda that is the value of the assignment may refer to itself as.
+    static Variable* GetSelfCandidate(const PendingForm& form) {
+        if (form.type != FormType::ASSIGNMENT || !form.is_definition || !form.variable) {
+            return nullptr;
+        }
+        return form.variable->can_be_self ? form.variable : nullptr;
+    }
+
+    std::optional<std::shared_ptr<Object>> StartLambda(const std::shared_ptr<Object>& params,
+                                                       const std::shared_ptr<Object>& body,
+                                                       Variable* self) {
+        contexts_.emplace_back();
+        contexts_.back().self = self;
+        PendingForm pending;
+        pending.type = FormType::LAMBDA;
+        auto current = params;
+        for (; Is<Cell>(current); current = As<Cell>(current)->GetSecond()) {
+            DeclareParam(As<Symbol>(As<Cell>(current)->GetFirst())->GetId(), &pending);
+            ++pending.param_count;
+        }
+        if (current) {
+            DeclareParam(As<Symbol>(current)->GetId(), &pending);
+            pending.has_rest = true;
+        }
+        DeclareDefinitions(body, &pending);
+        pending.rest = body;
+        Push(std::move(pending));
+        return std::nullopt;
+    }
+
+    void StartLet(PendingForm* pending, const std::shared_ptr<Object>& bindings,
+                  const std::shared_ptr<Object>& body) {
+        auto& context = contexts_.back();
+        pending->type = FormType::LET_INITS;
+        pending->owns_frame = !IsInFunction() && !open_lets_;
+        if (!IsInFunction()) {
+            ++open_lets_;
+        }
+        pending->saved_visible = context.visible.size();
+        pending->saved_slots = context.used_slots;
+        // The variables are not in scope in the inits, but their slots are taken already.
+        std::shared_ptr<Cell> last;
+        std::vector<SymbolId> names;
+        for (auto current = bindings; current; current = As<Cell>(current)->GetSecond()) {
+            auto binding = As<Cell>(As<Cell>(current)->GetFirst());
+            auto id = As<Symbol>(binding->GetFirst())->GetId();
+            if (std::find(names.begin(), names.end(), id) != names.end()) {
+                throw SyntaxError("Duplicate variable");
+            }
+            names.push_back(id);
+            pending->binding_slots.push_back(TakeSlot());
+            pending->variables.push_back(nullptr);
+            auto init = Allocate<Cell>(As<Cell>(binding->GetSecond())->GetFirst());
+            if (last) {
+                last->SetSecond(init);
+            } else {
+                pending->rest = init;
+            }
+            last = std::move(init);
+        }
+        pending->bindings = bindings;
+        pending->body = body;
+    }
+
+    // Brings the variables of a let into scope once its inits are analyzed.
+    void StartLetBody(PendingForm* form) {
+        for (auto current = form->args; current; current = As<Cell>(current)->GetSecond()) {
+            form->inits.push_back(As<Cell>(current)->GetFirst());
+        }
+        form->args = nullptr;
+        form->last = nullptr;
+        form->count = 0;
+        auto& context = contexts_.back();
+        std::size_t i = 0;
+        for (auto current = form->bindings; current;
+             current = As<Cell>(current)->GetSecond(), ++i) {
+            auto name = As<Cell>(As<Cell>(current)->GetFirst())->GetFirst();
+            variables_.emplace_back(As<Symbol>(name)->GetId(), form->binding_slots[i]);
+            form->variables[i] = &variables_.back();
+            context.visible.push_back(&variables_.back());
+        }
+        DeclareDefinitions(form->body, form);
+        form->type = FormType::LET_BODY;
+        form->rest = form->body;
+    }
+
+    std::size_t TakeSlot() {
+        auto& context = contexts_.back();
+        if (context.used_slots == kMaxFrameSize) {
+            throw SyntaxError("Too many variables");
+        }
+        auto slot = context.used_slots++;
+        context.frame_size = std::max(context.frame_size, context.used_slots);
+        return slot;
+    }
+
+    Variable* Declare(SymbolId id, PendingForm* form) {
+        variables_.emplace_back(id, TakeSlot());
+        auto variable = &variables_.back();
+        form->variables.push_back(variable);
+        contexts_.back().visible.push_back(variable);
+        return variable;
+    }
+
+    // Parameters must have distinct names, as only one of them could be referred to. So must
+    // the variables of a let.
+    void DeclareParam(SymbolId id, PendingForm* form) {
+        for (auto variable : form->variables) {
+            if (variable && variable->id == id) {
+                throw SyntaxError("Duplicate variable");
+            }
+        }
+        Declare(id, form);
+    }
+
+    // Definitions in a body are local to it, and in scope in all of it.
+    void DeclareDefinitions(const std::shared_ptr<Object>& body, PendingForm* form) {
+        std::vector<Variable*> definitions;
+        for (auto current = body; current; current = As<Cell>(current)->GetSecond()) {
+            auto definition = As<Cell>(As<Cell>(current)->GetFirst());
+            if (!definition || GetFormKind(definition->GetFirst()) != FormKind::DEFINE) {
+                continue;
+            }
+            auto args = definition->GetSecond();
+            std::shared_ptr<Object> name;
+            if (IsAssignment(args)) {
+                name = As<Cell>(args)->GetFirst();
+            } else if (IsFunctionDefinition(args)) {
+                name = As<Cell>(As<Cell>(args)->GetFirst())->GetFirst();
+            } else {
+                continue;
+            }
+            auto id = As<Symbol>(name)->GetId();
+            auto it = std::find_if(definitions.begin(), definitions.end(),
+                                   [id](Variable* variable) { return variable->id == id; });
+            if (it == definitions.end()) {
+                definitions.push_back(Declare(id, form));
+                definitions.back()->is_definition = true;
+            }
+        }
+        if (definitions.empty()) {
+            return;
+        }
+        auto assignments = CountAssignments(body);
+        for (auto variable : definitions) {
+            variable->can_be_self = assignments[variable->id] == 1;
+        }
+    }
+
+    // Number of define and set! forms for each name anywhere in the tree. Names shadowed
+    // somewhere inside are counted as well, which only makes the result larger.
+    std::unordered_map<SymbolId, std::size_t> CountAssignments(const std::shared_ptr<Object>& tree) {
+        std::unordered_map<SymbolId, std::size_t> counts;
+        std::vector<Cell*> pending;
+        if (Is<Cell>(tree)) {
+            pending.push_back(Cast<Cell>(tree));
+        }
+        while (!pending.empty()) {
+            auto cell = pending.back();
+            pending.pop_back();
+            if (Is<Symbol>(cell->GetFirst()) && Is<Cell>(cell->GetSecond())) {
+                auto kind = GetGlobalFormKind(Cast<Symbol>(cell->GetFirst())->GetId());
+                auto target = Cast<Cell>(cell->GetSecond())->GetFirst();
+                if (Is<Cell>(target) && kind == FormKind::DEFINE) {
+                    target = Cast<Cell>(target)->GetFirst();
+                }
+                if (Is<Symbol>(target) && (kind == FormKind::DEFINE || kind == FormKind::SET)) {
+                    ++counts[Cast<Symbol>(target)->GetId()];
+                }
+            }
+            for (const auto* child : {&cell->GetFirst(), &cell->GetSecond()}) {
+                if (Is<Cell>(*child)) {
+                    pending.push_back(Cast<Cell>(*child));
+                }
+            }
+        }
+        return counts;
+    }
+
+    // Number of elements of a proper list, or -1.
+    static int GetListSize(const std::shared_ptr<Object>& list) {
+        int size = 0;
+        auto current = list;
+        for (; Is<Cell>(current); current = As<Cell>(current)->GetSecond()) {
+            ++size;
+        }
+        return current ? -1 : size;
+    }
+
+    static bool IsAssignment(const std::shared_ptr<Object>& args) {
+        auto name = As<Cell>(args);
+        return name && Is<Symbol>(name->GetFirst()) && Is<Cell>(name->GetSecond()) &&
+               !As<Cell>(name->GetSecond())->GetSecond();
+    }
+
+    static bool IsFunctionDefinition(const std::shared_ptr<Object>& args) {
+        auto signature = Is<Cell>(args) ? As<Cell>(As<Cell>(args)->GetFirst()) : nullptr;
+        return signature && Is<Symbol>(signature->GetFirst()) &&
+               IsParams(signature->GetSecond()) && IsBody(As<Cell>(args)->GetSecond());
+    }
+
+    // A list of names, possibly ending in a name for the rest of the arguments.
+    static bool IsParams(const std::shared_ptr<Object>& params) {
+        auto current = params;
+        for (; Is<Cell>(current); current = As<Cell>(current)->GetSecond()) {
+            if (!Is<Symbol>(As<Cell>(current)->GetFirst())) {
+                return false;
+            }
+        }
+        return !current || Is<Symbol>(current);
+    }
+
+    static bool IsBody(const std::shared_ptr<Object>& body) {
+        return GetListSize(body) > 0;
+    }
+
+    static bool IsBindings(const std::shared_ptr<Object>& bindings) {
+        auto current = bindings;
+        for (; Is<Cell>(current); current = As<Cell>(current)->GetSecond()) {
+            auto binding = As<Cell>(As<Cell>(current)->GetFirst());
+            if (!binding || !Is<Symbol>(binding->GetFirst()) ||
+                GetListSize(binding->GetSecond()) != 1) {
+                return false;
+            }
+        }
+        return !current;
+    }
+
+    void Push(PendingForm pending) {
+        stack_.push_back(std::move(pending));
+        depth_ = std::max(depth_, stack_.size());
+    }
+
+    static void Append(PendingForm* form, std::shared_ptr<Object> node) {
+        auto cell = Allocate<Cell>(std::move(node));
+        if (form->last) {
+            form->last->SetSecond(cell);
+        } else {
+            form->args = cell;
+        }
+        form->last = std::move(cell);
+        ++form->count;
+    }
+
+    // Returns the node for the form on top of the stack, or nothing if it goes on with
+    // another part.
+    std::optional<std::shared_ptr<Object>> Finish() {
+        if (stack_.back().type == FormType::LET_INITS) {
+            StartLetBody(&stack_.back());
+            return std::nullopt;
+        }
+        auto form = std::move(stack_.back());
+        stack_.pop_back();
+        switch (form.type) {
+            case FormType::ASSIGNMENT:
+                return FinishAssignment(&form);
+            case FormType::IF: {
+                auto branches = As<Cell>(form.args);
+                auto consequent = As<Cell>(branches->GetSecond());
+                auto alternative = As<Cell>(consequent->GetSecond());
+                return Allocate<If>(branches->GetFirst(), consequent->GetFirst(),
+                                    alternative ? alternative->GetFirst() : nullptr);
+            }
+            case FormType::LAMBDA:
+                return FinishLambda(&form);
+            case FormType::LET_BODY:
+                return FinishLet(&form);
+            default:
+                return FinishCall(&form);
+        }
+    }
+
+    std::shared_ptr<Object> FinishAssignment(PendingForm* form) {
+        auto value = As<Cell>(form->args)->GetFirst();
+        if (form->is_definition && Is<Lambda>(value)) {
+            Cast<Lambda>(value)->SetName(form->id);
+        }
+        if (form->variable) {
+            auto node = Allocate<LocalAssignment>(form->variable->slot, false, std::move(value));
+            form->variable->uses.push_back(node.get());
+            return node;
+        }
+        if (form->capture) {
+            return Allocate<LocalAssignment>(*form->capture, true, std::move(value));
+        }
+        if (form->is_definition && !IsInFunction()) {
+            defined_.insert(form->id);
+        }
+        return Allocate<Assignment>(form->id, std::move(value), form->is_definition);
+    }
+
+    std::shared_ptr<Object> FinishCall(PendingForm* form) {
+        // An improper tail is kept as is for the builtin to reject.
+        if (form->last) {
+            form->last->SetSecond(std::move(form->rest));
+        } else {
+            form->args = std::move(form->rest);
+        }
+        if (!form->head) {
+            auto call = As<Cell>(form->args);
+            form->head = call->GetFirst();
+            form->args = call->GetSecond();
+        }
+        auto call = Allocate<Call>(std::move(form->head), std::move(form->function),
+                                   scope_->GetVersion(), std::move(form->args), form->is_tail);
+        TryFold(call.get());
+        return call;
+    }
+
+    // The variables of a lambda or let go out of scope: those shared with closures are boxed.
+    static void FinishVariables(const PendingForm& form, Body* body) {
+        for (auto variable : form.variables) {
+            if (!variable->IsBoxed()) {
+                continue;
+            }
+            body->boxed_slots.push_back(variable->slot);
+            for (auto use : variable->uses) {
+                switch (use->GetType()) {
+                    case Type::LOCAL_REF:
+                        static_cast<LocalRef*>(use)->SetBoxed();
+                        break;
+                    case Type::CAPTURED_REF:
+                        static_cast<CapturedRef*>(use)->SetBoxed();
+                        break;
+                    default:
+                        static_cast<LocalAssignment*>(use)->SetBoxed();
+                        break;
+                }
+            }
+        }
+    }
+
+    static Body MakeBody(const PendingForm& form) {
+        Body body;
+        FinishVariables(form, &body);
+        for (auto current = form.args; current; current = As<Cell>(current)->GetSecond()) {
+            body.nodes.push_back(As<Cell>(current)->GetFirst());
+        }
+        return body;
+    }
+
+    std::shared_ptr<Object> FinishLambda(PendingForm* form) {
+        auto body = MakeBody(*form);
+        auto context = std::move(contexts_.back());
+        contexts_.pop_back();
+        std::vector<CaptureSource> captures;
+        for (const auto& capture : context.captures) {
+            captures.push_back(capture.source);
+        }
+        return Allocate<Lambda>(form->param_count, form->has_rest, context.frame_size,
+                                std::move(captures), std::move(body));
+    }
+
+    std::shared_ptr<Object> FinishLet(PendingForm* form) {
+        auto body = MakeBody(*form);
+        auto& context = contexts_.back();
+        context.visible.resize(form->saved_visible);
+        context.used_slots = form->saved_slots;
+        Let::Bindings bindings;
+        for (std::size_t i = 0; i < form->inits.size(); ++i) {
+            bindings.emplace_back(form->binding_slots[i], std::move(form->inits[i]));
+        }
+        std::size_t frame_size = 0;
+        if (form->owns_frame) {
+            frame_size = context.frame_size;
+            context.frame_size = 0;
+        }
+        if (!IsInFunction()) {
+            --open_lets_;
+        }
+        return Allocate<Let>(frame_size, std::move(bindings), std::move(body));
+    }
+
+    // Value of the node if it is known during analysis.
+    static const std::shared_ptr<Object>* GetConstantValue(const std::shared_ptr<Object>& node) {
+        if (Is<Constant>(node)) {
+            return &Cast<Constant>(node)->GetValue();
+        }
+        if (Is<Call>(node) && Cast<Call>(node)->IsFolded()) {
+            return &Cast<Call>(node)->GetFoldedValue();
+        }
+        return nullptr;
+    }
+
+    void TryFold(Call* call) {
+        auto function = As<Function>(call->GetFunction());
+        if (!function || !function->IsPure()) {
+            return;
+        }
+        auto& values = fold_values_;
+        values.clear();
+        Call::Heads heads{{Cast<GlobalRef>(call->GetHead())->GetId(), function.get()}};
+        auto current = call->GetArgs().get();
+        for (; current && GetType(current) == Type::CELL;
+             current = static_cast<Cell*>(current)->GetSecond().get()) {
+            const auto& arg = static_cast<Cell*>(current)->GetFirst();
+            auto value = GetConstantValue(arg);
+            if (!value) {
+                return;
+            }
+            values.push_back(*value);
+            if (Is<Call>(arg)) {
+                AddHeads(Cast<Call>(arg)->GetFoldHeads(), &heads);
+            }
+        }
+        if (current) {
+            return;
+        }
+        try {
+            call->Fold(function->Invoke(values), std::move(heads));
+        } catch (const std::exception&) {
+            // Evaluated at run time instead, where it throws again.
+            return;
+        }
+        ++folded_;
+    }
+
+    // Heads name the same function wherever they appear in one analysis, so each name is
+    // kept once.
+    static void AddHeads(const Call::Heads& from, Call::Heads* to) {
+        for (const auto& head : from) {
+            if (std::find(to->begin(), to->end(), head) == to->end()) {
+                to->push_back(head);
+            }
+        }
+    }
+
+    const std::shared_ptr<Scope>& scope_;
+    // Malformed forms are rejected instead of left to fail at run time.
+    bool is_strict_;
+    std::vector<PendingForm> stack_;
+    std::size_t depth_ = 0;
+    std::size_t folded_ = 0;
+    // Argument values of the call being folded, kept to reuse the storage.
+    std::vector<std::shared_ptr<Object>> fold_values_;
+    // Globals defined earlier in the same expression.
+    std::unordered_set<SymbolId> defined_;
+    // Global names looked up as heads of forms, with repeats.
+    std::vector<SymbolId> used_globals_;
+    // The top level first, then the lambdas being analyzed, innermost last.
+    std::vector<Context> contexts_;
+    // Lets open outside of any function; the outermost one owns the frame.
+    std::size_t open_lets_ = 0;
+    std::deque<Variable> variables_;
+};
+
+}  // namespace
+
+std::shared_ptr<Object> Analyze(const std::shared_ptr<Object>& expression,
+                                const std::shared_ptr<Scope>& scope, AnalysisInfo* info) {
+    Analyzer analyzer(scope, false);
+    auto node = analyzer.Analyze(expression);
+    if (info) {
+        info->depth = analyzer.GetDepth();
+        info->folded = analyzer.GetFolded();
+        info->globals = analyzer.GetGlobals();
+    }
+    return node;
+}
+
+bool IsBoundAsAnalyzed(const std::vector<GlobalUse>& globals, const Scope& scope) {
+    for (const auto& global : globals) {
+        if (global.is_bound ? !scope.IsBoundTo(global.id, global.value.get())
+                            : scope.IsBound(global.id)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+std::shared_ptr<Object> AnalyzeForm(FormKind kind, const std::shared_ptr<Object>& args,
+                                    const std::shared_ptr<Scope>& scope) {
+    return Analyzer(scope, true).AnalyzeForm(kind, args);
+}
@@ -0,0 +1,542 @@
+#pragma once
+
+#include <memory>
+#include <optional>
+
+#include "object.h"
+#include "scheme.h"
+
+// Nodes of the executable tree built by Analyze. Each one evaluates exactly like the part
+// of the parsed tree it replaces, but with every name already resolved.
+
+class Constant : public Object {
+public:
+    static constexpr Type kType = Type::CONSTANT;
+
+    explicit Constant(std::shared_ptr<Object> value) : Object(kType), value_(std::move(value)) {
+    }
+
+    ~Constant() override {
+        DestroyChildren(this);
+    }
+
+    void MoveChildren(std::vector<std::shared_ptr<Object>>* children) override {
+        if (value_) {
+            children->push_back(std::move(value_));
+        }
+    }
+
+    const std::shared_ptr<Object>& GetValue() const {
+        return value_;
+    }
+
+    std::shared_ptr<Object> Eval(std::shared_ptr<Scope> scope) override {
+        return value_;
+    }
+
+private:
+    std::shared_ptr<Object> value_;
+};
+
+class GlobalRef : public Object {
+public:
+    static constexpr Type kType = Type::GLOBAL_REF;
+
+    explicit GlobalRef(SymbolId id) : Object(kType), id_(id) {
+    }
+
+    SymbolId GetId() const {
+        return id_;
+    }
+
+    std::shared_ptr<Object> Eval(std::shared_ptr<Scope> scope) override {
+        return *scope->GetGlobalSlot(id_);
+    }
+
+private:
+    SymbolId id_;
+};
+
+// Variable of the current frame. Variables that closures share with the frame hold a Box.
+class LocalRef : public Object {
+public:
+    static constexpr Type kType = Type::LOCAL_REF;
+
+    explicit LocalRef(std::size_t slot) : Object(kType), slot_(slot) {
+    }
+
+    std::size_t GetSlot() const {
+        return slot_;
+    }
+
+    // Set during analysis, once all uses of the variable are known.
+    void SetBoxed() {
+        is_boxed_ = true;
+    }
+
+    bool IsBoxed() const {
+        return is_boxed_;
+    }
+
+    std::shared_ptr<Object> Eval(std::shared_ptr<Scope> scope) override;
+
+private:
+    std::size_t slot_;
+    bool is_boxed_ = false;
+};
+
+// Free variable of the running closure, read from its captures.
+class CapturedRef : public Object {
+public:
+    static constexpr Type kType = Type::CAPTURED_REF;
+
+    explicit CapturedRef(std::size_t index) : Object(kType), index_(index) {
+    }
+
+    std::size_t GetIndex() const {
+        return index_;
+    }
+
+    void SetBoxed() {
+        is_boxed_ = true;
+    }
+
+    bool IsBoxed() const {
+        return is_boxed_;
+    }
+
+    std::shared_ptr<Object> Eval(std::shared_ptr<Scope> scope) override;
+
+private:
+    std::size_t index_;
+    bool is_boxed_ = false;
+};
+
+// Name of a function defined in a body, used inside that function: always the running
+// closure, which does not capture itself.
+class SelfRef : public Object {
+public:
+    static constexpr Type kType = Type::SELF_REF;
+
+    SelfRef() : Object(kType) {
+    }
+
+    std::shared_ptr<Object> Eval(std::shared_ptr<Scope> scope) override;
+};
+
+// Call site. When the head is a global bound at analysis time, the node points at the
+// bound object directly and uses it as long as the name is still bound to it. A call of a
+// pure builtin on constant arguments is folded: it keeps the value computed during analysis
+// and returns it as long as no global binding has changed since. A call of a closure in tail
+// position of a lambda body is made by the closure running the body, once it has left its
+// frame.
+class Call : public Object {
+public:
+    static constexpr Type kType = Type::CALL;
+
+    // Global names and the functions they were bound to when the call was folded: its own
+    // head and those of the calls folded into its arguments. The functions are kept alive by
+    // the calls themselves.
+    using Heads = std::vector<std::pair<SymbolId, const Object*>>;
+
+    Call(std::shared_ptr<Object> head, std::shared_ptr<Object> function, std::size_t version,
+         std::shared_ptr<Object> args, bool is_tail = false)
+        : Object(kType),
+          head_(std::move(head)),
+          function_(std::move(function)),
+          version_(version),
+          args_(std::move(args)),
+          is_tail_(is_tail) {
+    }
+
+    ~Call() override {
+        DestroyChildren(this);
+    }
+
+    void MoveChildren(std::vector<std::shared_ptr<Object>>* children) override {
+        children->push_back(std::move(head_));
+        if (args_) {
+            children->push_back(std::move(args_));
+        }
+        if (folded_ && *folded_) {
+            children->push_back(std::move(*folded_));
+        }
+    }
+
+    const std::shared_ptr<Object>& GetHead() const {
+        return head_;
+    }
+
+    const std::shared_ptr<Object>& GetFunction() const {
+        return function_;
+    }
+
+    std::size_t GetVersion() const {
+        return version_;
+    }
+
+    const std::shared_ptr<Object>& GetArgs() const {
+        return args_;
+    }
+
+    void Fold(std::shared_ptr<Object> value, Heads heads) {
+        folded_ = std::move(value);
+        fold_heads_ = std::move(heads);
+    }
+
+    bool IsFolded() const {
+        return folded_.has_value();
+    }
+
+    const std::shared_ptr<Object>& GetFoldedValue() const {
+        return *folded_;
+    }
+
+    const Heads& GetFoldHeads() const {
+        return fold_heads_;
+    }
+
+    // Whether the function resolved during analysis is still the one the head names.
+    bool IsResolved(const Scope& scope) const {
+        return function_ && (scope.GetVersion() == version_ ||
+                             scope.IsBoundTo(Cast<GlobalRef>(head_)->GetId(), function_.get()));
+    }
+
+    // Whether the folded value is still the value of the call: other globals may have
+    // changed, but not those its heads name.
+    bool IsFoldValid(const Scope& scope) const {
+        if (!folded_) {
+            return false;
+        }
+        if (scope.GetVersion() == version_) {
+            return true;
+        }
+        for (const auto& [id, function] : fold_heads_) {
+            if (!scope.IsBoundTo(id, function)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool IsTail() const {
+        return is_tail_;
+    }
+
+    std::shared_ptr<Object> Eval(std::shared_ptr<Scope> scope) override;
+
+private:
+    std::shared_ptr<Object> head_, function_;
+    std::size_t version_;
+    std::shared_ptr<Object> args_;
+    std::optional<std::shared_ptr<Object>> folded_;
+    Heads fold_heads_;
+    bool is_tail_;
+};
+
+// define or set! of a resolved name.
+class Assignment : public Object {
+public:
+    static constexpr Type kType = Type::ASSIGNMENT;
+
+    Assignment(SymbolId id, std::shared_ptr<Object> value, bool is_definition)
+        : Object(kType), id_(id), value_(std::move(value)), is_definition_(is_definition) {
+    }
+
+    ~Assignment() override {
+        DestroyChildren(this);
+    }
+
+    void MoveChildren(std::vector<std::shared_ptr<Object>>* children) override {
+        if (value_) {
+            children->push_back(std::move(value_));
+        }
+    }
+
+    SymbolId GetId() const {
+        return id_;
+    }
+
+    const std::shared_ptr<Object>& GetValue() const {
+        return value_;
+    }
+
+    bool IsDefinition() const {
+        return is_definition_;
+    }
+
+    std::shared_ptr<Object> Eval(std::shared_ptr<Scope> scope) override;
+
+private:
+    SymbolId id_;
+    std::shared_ptr<Object> value_;
+    bool is_definition_;
+};
+
+// define or set! of a variable of the current frame, or set! of a captured one.
+class LocalAssignment : public Object {
+public:
+    static constexpr Type kType = Type::LOCAL_ASSIGNMENT;
+
+    LocalAssignment(std::size_t index, bool is_captured, std::shared_ptr<Object> value)
+        : Object(kType), index_(index), is_captured_(is_captured), value_(std::move(value)) {
+    }
+
+    ~LocalAssignment() override {
+        DestroyChildren(this);
+    }
+
+    void MoveChildren(std::vector<std::shared_ptr<Object>>* children) override {
+        if (value_) {
+            children->push_back(std::move(value_));
+        }
+    }
+
+    // Slot of the variable, or index of the capture.
+    std::size_t GetIndex() const {
+        return index_;
+    }
+
+    bool IsCaptured() const {
+        return is_captured_;
+    }
+
+    // Captured variables that are assigned are always boxed.
+    void SetBoxed() {
+        is_boxed_ = true;
+    }
+
+    bool IsBoxed() const {
+        return is_boxed_;
+    }
+
+    const std::shared_ptr<Object>& GetValue() const {
+        return value_;
+    }
+
+    std::shared_ptr<Object> Eval(std::shared_ptr<Scope> scope) override;
+
+private:
+    std::size_t index_;
+    bool is_captured_;
+    bool is_boxed_ = false;
+    std::shared_ptr<Object> value_;
+};
+
+class If : public Object {
+public:
+    static constexpr Type kType = Type::IF;
+
+    If(std::shared_ptr<Object> condition, std::shared_ptr<Object> consequent,
+       std::shared_ptr<Object> alternative)
+        : Object(kType),
+          condition_(std::move(condition)),
+          consequent_(std::move(consequent)),
+          alternative_(std::move(alternative)) {
+    }
+
+    ~If() override {
+        DestroyChildren(this);
+    }
+
+    void MoveChildren(std::vector<std::shared_ptr<Object>>* children) override;
+
+    const std::shared_ptr<Object>& GetCondition() const {
+        return condition_;
+    }
+
+    const std::shared_ptr<Object>& GetConsequent() const {
+        return consequent_;
+    }
+
+    // Null without an alternative: the value is then ().
+    const std::shared_ptr<Object>& GetAlternative() const {
+        return alternative_;
+    }
+
+    std::shared_ptr<Object> Eval(std::shared_ptr<Scope> scope) override;
+
+private:
+    std::shared_ptr<Object> condition_, consequent_, alternative_;
+};
+
+// Slots a frame may have: frames are taken from chunks of this many slots. Functions and lets
+// with more variables are rejected by the analyzer, and by the loader of images.
+constexpr std::size_t kMaxFrameSize = 4096;
+
+// Expressions of a lambda or let body, evaluated in order for the value of the last one.
+struct Body {
+    // Slots of the variables shared with closures. Each one is put in a box holding its
+    // value before the expressions run.
+    std::vector<std::size_t> boxed_slots;
+    std::vector<std::shared_ptr<Object>> nodes;
+
+    std::shared_ptr<Object> Eval(const std::shared_ptr<Scope>& scope) const;
+
+    void MoveChildren(std::vector<std::shared_ptr<Object>>* children);
+};
+
+// Where a closure takes each of its captures from when it is made: a slot of the frame
+// it is made in, a capture of the closure running there, or that closure itself.
+struct CaptureSource {
+    enum class Kind : uint8_t { SLOT, CAPTURE, SELF };
+
+    Kind kind;
+    std::size_t index = 0;
+};
+
+// lambda: makes a closure. Parameters take the first slots of its frame, then the list of
+// the remaining arguments if it takes any, then the locals of the body.
+class Lambda : public Object, public std::enable_shared_from_this<Lambda> {
+public:
+    static constexpr Type kType = Type::LAMBDA;
+
+    Lambda(std::size_t param_count, bool has_rest, std::size_t frame_size,
+           std::vector<CaptureSource> captures, Body body)
+        : Object(kType),
+          param_count_(param_count),
+          has_rest_(has_rest),
+          frame_size_(frame_size),
+          captures_(std::move(captures)),
+          body_(std::move(body)) {
+    }
+
+    ~Lambda() override {
+        DestroyChildren(this);
+    }
+
+    void MoveChildren(std::vector<std::shared_ptr<Object>>* children) override {
+        body_.MoveChildren(children);
+    }
+
+    std::size_t GetParamCount() const {
+        return param_count_;
+    }
+
+    bool HasRest() const {
+        return has_rest_;
+    }
+
+    std::size_t GetFrameSize() const {
+        return frame_size_;
+    }
+
+    const std::vector<CaptureSource>& GetCaptures() const {
+        return captures_;
+    }
+
+    const Body& GetBody() const {
+        return body_;
+    }
+
+    // Name the lambda is the value of a definition of, for the profiler.
+    void SetName(SymbolId name) {
+        name_ = name;
+    }
+
+    const std::optional<SymbolId>& GetName() const {
+        return name_;
+    }
+
+    // Body compiled to bytecode, which calls run in place of the tree once it is set. Set by
+    // Compile before anything runs the tree it is part of.
+    void SetProgram(std::shared_ptr<const Program> program) {
+        program_ = std::move(program);
+    }
+
+    const Program* GetProgram() const {
+        return program_.get();
+    }
+
+    std::shared_ptr<Object> Eval(std::shared_ptr<Scope> scope) override;
+
+private:
+    std::size_t param_count_;
+    bool has_rest_;
+    std::size_t frame_size_;
+    std::vector<CaptureSource> captures_;
+    Body body_;
+    std::optional<SymbolId> name_;
+    std::shared_ptr<const Program> program_;
+};
+
+// let. Its variables take slots of the frame of the enclosing function; a let outside of
+// any function makes a frame for itself and the lets nested in it.
+class Let : public Object {
+public:
+    static constexpr Type kType = Type::LET;
+
+    using Bindings = std::vector<std::pair<std::size_t, std::shared_ptr<Object>>>;
+
+    Let(std::size_t frame_size, Bindings bindings, Body body)
+        : Object(kType),
+          frame_size_(frame_size),
+          bindings_(std::move(bindings)),
+          body_(std::move(body)) {
+    }
+
+    ~Let() override {
+        DestroyChildren(this);
+    }
+
+    void MoveChildren(std::vector<std::shared_ptr<Object>>* children) override;
+
+    std::size_t GetFrameSize() const {
+        return frame_size_;
+    }
+
+    const Bindings& GetBindings() const {
+        return bindings_;
+    }
+
+    const Body& GetBody() const {
+        return body_;
+    }
+
+    // Bindings and body compiled to bytecode, for a let with a frame of its own; see
+    // Lambda::SetProgram.
+    void SetProgram(std::shared_ptr<const Program> program) {
+        program_ = std::move(program);
+    }
+
+    const Program* GetProgram() const {
+        return program_.get();
+    }
+
+    std::shared_ptr<Object> Eval(std::shared_ptr<Scope> scope) override;
+
+private:
+    std::shared_ptr<Object> Bind(const std::shared_ptr<Scope>& scope) const;
+
+    std::size_t frame_size_;
+    Bindings bindings_;
+    Body body_;
+    std::shared_ptr<const Program> program_;
+};
+
+struct AnalysisInfo {
+    // Nesting depth of the forms in the result, including those in lambda and let bodies.
+    std::size_t depth = 0;
+    // Calls replaced by their value.
+    std::size_t folded = 0;
+    // Every name the result was built from, once. Analyzing the expression again gives the
+    // same result while they are bound as recorded, whatever other globals change.
+    std::vector<GlobalUse> globals;
+};
+
+// Whether every name is still bound, or still unbound, as recorded.
+bool IsBoundAsAnalyzed(const std::vector<GlobalUse>& globals, const Scope& scope);
+
+// Builds the executable tree for a parsed expression evaluated in the given scope. Unbound
+// names are reported here, once, instead of on every evaluation, except in lambda bodies,
+// which may call functions defined after them. Calls of pure builtins with constant
+// arguments are computed here as well, unless they fail: those are left to fail at run
+// time with the same error.
+std::shared_ptr<Object> Analyze(const std::shared_ptr<Object>& expression,
+                                const std::shared_ptr<Scope>& scope,
+                                AnalysisInfo* info = nullptr);
+
+// Builds the tree for a special form with the given arguments, for the builtins that
+// evaluate them unanalyzed. Throws SyntaxError if the form is malformed.
+std::shared_ptr<Object> AnalyzeForm(FormKind kind, const std::shared_ptr<Object>& args,
+                                    const std::shared_ptr<Scope>& scope);
@@ -0,0 +1,527 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <new>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "analyzer.h"
+#include "image.h"
+#include "interpreter_pool.h"
+#include "numeric_kernels.h"
+#include "parser.h"
+#include "scheme.h"
+#include "tokenizer.h"
+
+// Microbenchmarks of the interpreter stages. Every result is printed as one JSON object
+// per line, so runs can be stored and compared with standard tools.
+//
+//   scheme_benchmark [--filter substring] [--min-time seconds]
+
+namespace {
+
+// Counted per thread, so work done on pool threads is not included.
+thread_local std::size_t global_allocations = 0;
+
+// Kernel results are stored here so that the computation cannot be optimized away.
+volatile int64_t sink = 0;
+
+constexpr std::size_t kDefaultAlignment = __STDCPP_DEFAULT_NEW_ALIGNMENT__;
+
+// Every replaceable form of the allocation functions goes through CountedNew and Release, so
+// that no allocation goes uncounted and all memory is released the same way. Both are kept
+// out of line so that the compiler does not pair free with operator new at the call sites.
+[[gnu::noinline]] void* CountedNew(std::size_t size, std::size_t alignment) {
+    ++global_allocations;
+    size = size ? size : 1;
+    while (true) {
+        void* ptr;
+        if (alignment <= kDefaultAlignment) {
+            ptr = std::malloc(size);
+        } else {
+            // The size of aligned_alloc must be a multiple of the alignment.
+            ptr = std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+        }
+        if (ptr) {
+            return ptr;
+        }
+        auto handler = std::get_new_handler();
+        if (!handler) {
+            throw std::bad_alloc();
+        }
+        handler();
+    }
+}
+
+void* CountedNewNothrow(std::size_t size, std::size_t alignment) noexcept {
+    try {
+        return CountedNew(size, alignment);
+    } catch (const std::bad_alloc&) {
+        return nullptr;
+    }
+}
+
+[[gnu::noinline]] void Release(void* ptr) noexcept {
+    std::free(ptr);
+}
+
+}  // namespace
+
+void* operator new(std::size_t size) {
+    return CountedNew(size, kDefaultAlignment);
+}
+
+void* operator new[](std::size_t size) {
+    return CountedNew(size, kDefaultAlignment);
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment) {
+    return CountedNew(size, static_cast<std::size_t>(alignment));
+}
+
+void* operator new[](std::size_t size, std::align_val_t alignment) {
+    return CountedNew(size, static_cast<std::size_t>(alignment));
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+    return CountedNewNothrow(size, kDefaultAlignment);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept {
+    return CountedNewNothrow(size, kDefaultAlignment);
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    return CountedNewNothrow(size, static_cast<std::size_t>(alignment));
+}
+
+void* operator new[](std::size_t size, std::align_val_t alignment,
+                     const std::nothrow_t&) noexcept {
+    return CountedNewNothrow(size, static_cast<std::size_t>(alignment));
+}
+
+void operator delete(void* ptr) noexcept {
+    Release(ptr);
+}
+
+void operator delete[](void* ptr) noexcept {
+    Release(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept {
+    Release(ptr);
+}
+
+void operator delete[](void* ptr, std::size_t) noexcept {
+    Release(ptr);
+}
+
+void operator delete(void* ptr, std::align_val_t) noexcept {
+    Release(ptr);
+}
+
+void operator delete[](void* ptr, std::align_val_t) noexcept {
+    Release(ptr);
+}
+
+void operator delete(void* ptr, std::size_t, std::align_val_t) noexcept {
+    Release(ptr);
+}
+
+void operator delete[](void* ptr, std::size_t, std::align_val_t) noexcept {
+    Release(ptr);
+}
+
+void operator delete(void* ptr, const std::nothrow_t&) noexcept {
+    Release(ptr);
+}
+
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept {
+    Release(ptr);
+}
+
+void operator delete(void* ptr, std::align_val_t, const std::nothrow_t&) noexcept {
+    Release(ptr);
+}
+
+void operator delete[](void* ptr, std::align_val_t, const std::nothrow_t&) noexcept {
+    Release(ptr);
+}
+
+namespace {
+
+struct Options {
+    std::string filter;
+    double min_time = 0.2;
+};
+
+struct Benchmark {
+    std::string name;
+    std::size_t size;
+    // Bytes processed per operation, for throughput; zero if not meaningful.
+    std::size_t bytes;
+    std::function<void()> operation;
+};
+
+void Report(const Benchmark& benchmark, std::size_t iterations, double seconds,
+            std::size_t allocations, std::size_t heap_allocations) {
+    auto ns_per_op = seconds * 1e9 / iterations;
+    std::cout << "{\"name\": \"" << benchmark.name << "\", \"size\": " << benchmark.size
+              << ", \"iterations\": " << iterations << ", \"ns_per_op\": " << ns_per_op;
+    if (benchmark.bytes) {
+        std::cout << ", \"mb_per_s\": " << benchmark.bytes * iterations / seconds / 1e6;
+    }
+    std::cout << ", \"allocs_per_op\": " << static_cast<double>(allocations) / iterations
+              << ", \"heap_allocs_per_op\": " << static_cast<double>(heap_allocations) / iterations
+              << "}" << std::endl;
+}
+
+void Run(const Benchmark& benchmark, const Options& options) {
+    using Clock = std::chrono::steady_clock;
+    benchmark.operation();
+
+    std::size_t iterations = 0, batch = 1;
+    auto allocations = global_allocations;
+    auto heap_allocations = Heap::Local().GetStats().allocations;
+    auto start = Clock::now();
+    double seconds = 0;
+    while (seconds < options.min_time) {
+        for (std::size_t i = 0; i < batch; ++i) {
+            benchmark.operation();
+        }
+        iterations += batch;
+        batch *= 2;
+        seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    }
+    Report(benchmark, iterations, seconds, global_allocations - allocations,
+           Heap::Local().GetStats().allocations - heap_allocations);
+}
+
+std::string MakeList(std::size_t size) {
+    std::string source = "(";
+    for (std::size_t i = 0; i < size; ++i) {
+        source += std::to_string(i % 1000);
+        source += i + 1 == size ? ")" : " ";
+    }
+    return source;
+}
+
+// Nested arithmetic and symbols, closer to real programs than a flat list of numbers.
+std::string MakeProgram(std::size_t size) {
+    std::string source = "(list";
+    for (std::size_t i = 0; i < size; ++i) {
+        source += " (+ x (* " + std::to_string(i) + " 2) (max 1 y))";
+    }
+    return source + ")";
+}
+
+std::shared_ptr<Object> ParseString(const std::string& source) {
+    Tokenizer tokenizer{std::string_view(source)};
+    return Read(&tokenizer);
+}
+
+void AddTokenizerBenchmarks(std::size_t size, std::vector<Benchmark>* benchmarks) {
+    auto source = std::make_shared<std::string>(MakeProgram(size));
+    benchmarks->push_back({"tokenizer/buffer", size, source->size(), [source] {
+                               Tokenizer tokenizer{std::string_view(*source)};
+                               while (!tokenizer.IsEnd()) {
+                                   tokenizer.Next();
+                               }
+                           }});
+    benchmarks->push_back({"tokenizer/stream", size, source->size(), [source] {
+                               std::istringstream in(*source);
+                               Tokenizer tokenizer(&in);
+                               while (!tokenizer.IsEnd()) {
+                                   tokenizer.Next();
+                               }
+                           }});
+}
+
+void AddParserBenchmarks(std::size_t size, std::vector<Benchmark>* benchmarks) {
+    auto list = std::make_shared<std::string>(MakeList(size));
+    benchmarks->push_back(
+        {"parser/list", size, list->size(), [list] { ParseString(*list); }});
+    auto program = std::make_shared<std::string>(MakeProgram(size));
+    benchmarks->push_back(
+        {"parser/program", size, program->size(), [program] { ParseString(*program); }});
+}
+
+void AddEvalBenchmarks(std::size_t size, std::vector<Benchmark>* benchmarks) {
+    auto interpreter = std::make_shared<Interpreter>();
+    interpreter->Run("(define lst '" + MakeList(size) + ")");
+    interpreter->Run("(define vec (list->vector lst))");
+    // Operands read from a variable keep the calls below from being folded during analysis.
+    interpreter->Run("(define two 2)");
+    interpreter->Run("(define big " + std::string(size, '7') + ")");
+    interpreter->Run("(define s64 (list->s64vector lst))");
+    interpreter->Run("(define (id x) x)");
+    interpreter->Run("(define (count n) (if (= n 0) 0 (count (- n 1))))");
+
+    auto add = [&](const std::string& name, const std::string& source) {
+        auto expression = interpreter->Analyze(interpreter->Parse(source));
+        benchmarks->push_back(
+            {name, size, 0, [interpreter, expression] { interpreter->Eval(expression); }});
+    };
+    std::string fold = "(+";
+    for (std::size_t i = 0; i < size; ++i) {
+        fold += " (* " + std::to_string(i % 100) + " two)";
+    }
+    add("eval/arithmetic-fold", fold + ")");
+    // The same tree evaluated as parsed, where every call form looks up its function.
+    auto parsed = interpreter->Parse(fold + ")");
+    benchmarks->push_back(
+        {"eval/parsed-tree", size, 0, [interpreter, parsed] { interpreter->Eval(parsed); }});
+    // Builtins dominated by argument type checks.
+    std::string chain = "(<= 0 two";
+    for (std::size_t i = 2; i < size; ++i) {
+        chain += " " + std::to_string(i);
+    }
+    add("eval/comparison-chain", chain + ")");
+    add("eval/bignum-multiply", "(* big big)");
+    add("eval/list-predicate", "(list? lst)");
+    add("eval/list-ref", "(list-ref lst " + std::to_string(size - 1) + ")");
+    add("eval/vector-ref", "(vector-ref vec " + std::to_string(size - 1) + ")");
+    add("eval/list-tail", "(list-tail lst " + std::to_string(size / 2) + ")");
+    add("eval/s64vector-sum", "(s64vector-sum s64)");
+    add("eval/s64vector-dot", "(s64vector-dot s64 s64)");
+    add("eval/s64vector-add", "(s64vector-add s64 s64)");
+    // The same number of calls of a builtin and of a user function, which should cost about
+    // the same, and a loop written as tail recursion.
+    std::string builtin_calls = "(+", closure_calls = "(+";
+    for (std::size_t i = 0; i < size; ++i) {
+        builtin_calls += " (abs two)";
+        closure_calls += " (id two)";
+    }
+    add("eval/builtin-call", builtin_calls + ")");
+    add("eval/closure-call", closure_calls + ")");
+    add("eval/tail-loop", "(count " + std::to_string(size) + ")");
+}
+
+// Every kernel table the CPU supports, so the instruction sets can be compared directly.
+void AddKernelBenchmarks(std::size_t size, std::vector<Benchmark>* benchmarks) {
+    auto data = std::make_shared<std::vector<int64_t>>(size);
+    for (std::size_t i = 0; i < size; ++i) {
+        (*data)[i] = static_cast<int64_t>(i * 2654435761u) - (1 << 30);
+    }
+    auto out = std::make_shared<std::vector<int64_t>>(size);
+    auto bytes = size * sizeof(int64_t);
+    for (auto kernels : GetSupportedS64Kernels()) {
+        std::string suffix = "/";
+        suffix += kernels->name;
+        benchmarks->push_back({"kernels/s64-sum" + suffix, size, bytes, [kernels, data] {
+                                   sink = kernels->sum(data->data(), data->size());
+                               }});
+        benchmarks->push_back({"kernels/s64-max" + suffix, size, bytes, [kernels, data] {
+                                   sink = kernels->max(data->data(), data->size());
+                               }});
+        benchmarks->push_back({"kernels/s64-add" + suffix, size, 2 * bytes, [kernels, data, out] {
+                                   sink = kernels->add(data->data(), data->data(), out->data(),
+                                                       data->size());
+                               }});
+    }
+}
+
+// The same text run again and again, as from a request handler, with and without the cache
+// of analyzed expressions.
+void AddRunBenchmarks(std::size_t size, std::vector<Benchmark>* benchmarks) {
+    auto source = std::make_shared<std::string>("(+");
+    for (std::size_t i = 0; i < size; ++i) {
+        *source += " (* " + std::to_string(i % 100) + " two)";
+    }
+    *source += ")";
+    for (std::size_t capacity : {0, 16}) {
+        auto interpreter = std::make_shared<Interpreter>();
+        interpreter->Run("(define two 2)");
+        interpreter->SetCacheCapacity(capacity);
+        benchmarks->push_back({capacity ? "run/cached" : "run/uncached", size, source->size(),
+                               [interpreter, source] { interpreter->Run(*source); }});
+    }
+    // A global the text does not use is defined before every run, which leaves its cached
+    // analysis valid.
+    auto defining = std::make_shared<Interpreter>();
+    defining->Run("(define two 2)");
+    defining->SetCacheCapacity(16);
+    benchmarks->push_back({"run/cached-after-define", size, source->size(),
+                           [defining, source] {
+                               defining->Run("(define other 0)");
+                               defining->Run(*source);
+                           }});
+    // Limits that are never reached, for the cost of enforcing them.
+    auto interpreter = std::make_shared<Interpreter>();
+    interpreter->Run("(define two 2)");
+    interpreter->SetLimits({.steps = std::size_t(1) << 40,
+                            .bytes = std::size_t(1) << 40,
+                            .depth = 1 << 20,
+                            .time = std::chrono::hours(1)});
+    benchmarks->push_back({"run/limited", size, source->size(),
+                           [interpreter, source] { interpreter->Run(*source); }});
+}
+
+// The same programs on the tree walker and on the VM: top-level arithmetic, and the calls of
+// closures that most programs spend their time in. Texts are cached, so that neither engine
+// pays for parsing, analysis or compilation on every run.
+void AddEngineBenchmarks(std::size_t size, std::vector<Benchmark>* benchmarks) {
+    std::string arithmetic = "(+";
+    for (std::size_t i = 0; i < size; ++i) {
+        arithmetic += " (* " + std::to_string(i % 100) + " two)";
+    }
+    arithmetic += ")";
+    auto n = std::to_string(size);
+    std::vector<std::pair<std::string, std::string>> programs = {
+        {"arithmetic", arithmetic},
+        {"tail-loop", "(count " + n + " 0)"},
+        {"recursion", "(range-sum 1 " + n + ")"},
+        {"closure-calls", "(feed (make-accumulator) " + n + ")"},
+    };
+    for (auto engine : {Engine::TREE, Engine::BYTECODE}) {
+        auto interpreter = std::make_shared<Interpreter>();
+        interpreter->SetEngine(engine);
+        interpreter->SetCacheCapacity(16);
+        interpreter->Run("(define two 2)");
+        interpreter->Run("(define (count n acc) (if (= n 0) acc (count (- n 1) (+ acc n))))");
+        interpreter->Run(
+            "(define (range-sum lo hi) (if (= lo hi) lo (let ((mid (/ (+ lo hi) 2)))"
+            " (+ (range-sum lo mid) (range-sum (+ mid 1) hi)))))");
+        interpreter->Run(
+            "(define (make-accumulator) (let ((total 0)) (lambda (x) (set! total (+ total x))"
+            " total)))");
+        interpreter->Run("(define (feed f n) (f n) (if (= n 0) (f 0) (feed f (- n 1))))");
+        auto suffix = engine == Engine::TREE ? "/tree" : "/bytecode";
+        for (const auto& [name, source] : programs) {
+            auto text = std::make_shared<std::string>(source);
+            benchmarks->push_back({"engine/" + name + suffix, size, 0,
+                                   [interpreter, text] { interpreter->Run(*text); }});
+        }
+    }
+}
+
+// A fresh interpreter set up from a prelude of size definitions, by running its source and by
+// loading an image of the result.
+void AddStartupBenchmarks(std::size_t size, std::vector<Benchmark>* benchmarks) {
+    auto prelude = std::make_shared<std::string>();
+    for (std::size_t i = 0; i < size; ++i) {
+        auto name = "v" + std::to_string(i);
+        *prelude += "(define " + name + " '(" + name + " " + std::to_string(i) + " #t))\n";
+    }
+    benchmarks->push_back({"startup/source", size, prelude->size(), [prelude] {
+                               Interpreter interpreter;
+                               std::ostringstream out;
+                               Tokenizer tokenizer{std::string_view(*prelude)};
+                               interpreter.RunBatch(&tokenizer, &out);
+                           }});
+
+    Interpreter interpreter;
+    std::ostringstream out;
+    Tokenizer tokenizer{std::string_view(*prelude)};
+    interpreter.RunBatch(&tokenizer, &out);
+    std::ostringstream image;
+    WriteImage(*interpreter.GetGlobalScope(), &image);
+    // Stored in words, as images have to be aligned.
+    auto bytes = image.str();
+    auto words = std::make_shared<std::vector<uint64_t>>((bytes.size() + 7) / 8);
+    std::memcpy(words->data(), bytes.data(), bytes.size());
+    benchmarks->push_back({"startup/image", size, bytes.size(), [words, size = bytes.size()] {
+                               Interpreter interpreter;
+                               LoadImage({reinterpret_cast<const char*>(words->data()), size},
+                                         interpreter.GetGlobalScope());
+                           }});
+}
+
+void AddAnalyzerBenchmarks(std::size_t size, std::vector<Benchmark>* benchmarks) {
+    auto interpreter = std::make_shared<Interpreter>();
+    std::string constant = "(+";
+    for (std::size_t i = 0; i < size; ++i) {
+        constant += " (* " + std::to_string(i % 100) + " 2)";
+    }
+    auto expression = interpreter->Parse(constant + ")");
+    benchmarks->push_back({"analyzer/constant-fold", size, 0, [interpreter, expression] {
+                               interpreter->Analyze(expression);
+                           }});
+}
+
+void AddPrinterBenchmarks(std::size_t size, std::vector<Benchmark>* benchmarks) {
+    auto list = ParseString(MakeList(size));
+    auto bytes = static_cast<std::string>(*list).size();
+    benchmarks->push_back({"printer/string", size, bytes, [list] {
+                               auto output = static_cast<std::string>(*list);
+                           }});
+    auto out = std::make_shared<std::ostringstream>();
+    benchmarks->push_back({"printer/stream", size, bytes, [list, out] {
+                               out->str({});
+                               Print(list, out.get());
+                           }});
+}
+
+// Throughput of independent programs for growing numbers of worker threads; with no shared
+// mutable state it should grow linearly up to the number of cores.
+void AddPoolBenchmarks(std::vector<Benchmark>* benchmarks) {
+    constexpr std::size_t kPrograms = 64;
+    auto program = std::string("(define n 2)\n(+");
+    for (std::size_t i = 0; i < 100; ++i) {
+        program += " (* n " + std::to_string(i) + ")";
+    }
+    program += ")";
+    std::size_t max_threads = std::max(1u, std::thread::hardware_concurrency());
+    for (std::size_t threads = 1;; threads = std::min(2 * threads, max_threads)) {
+        // Started on first use: once a process has more than one thread, every reference
+        // count update is atomic, which would slow down the single-threaded benchmarks.
+        auto pool = std::make_shared<std::unique_ptr<InterpreterPool>>();
+        benchmarks->push_back({"pool/independent", threads, kPrograms * program.size(),
+                               [pool, program, threads] {
+                                   if (!*pool) {
+                                       *pool = std::make_unique<InterpreterPool>(threads);
+                                   }
+                                   std::vector<std::future<std::string>> results;
+                                   for (std::size_t i = 0; i < kPrograms; ++i) {
+                                       results.push_back((*pool)->Submit(program));
+                                   }
+                                   for (auto& result : results) {
+                                       result.get();
+                                   }
+                               }});
+        if (threads == max_threads) {
+            break;
+        }
+    }
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    Options options;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (!std::strcmp(argv[i], "--filter")) {
+            options.filter = argv[i + 1];
+        } else if (!std::strcmp(argv[i], "--min-time")) {
+            options.min_time = std::atof(argv[i + 1]);
+        } else {
+            std::cerr << "usage: " << argv[0] << " [--filter substring] [--min-time seconds]\n";
+            return 1;
+        }
+    }
+
+    std::vector<Benchmark> benchmarks;
+    for (std::size_t size : {10, 1000, 100000}) {
+        AddTokenizerBenchmarks(size, &benchmarks);
+        AddParserBenchmarks(size, &benchmarks);
+        AddAnalyzerBenchmarks(size, &benchmarks);
+        AddEvalBenchmarks(size, &benchmarks);
+        AddRunBenchmarks(size, &benchmarks);
+        AddEngineBenchmarks(size, &benchmarks);
+        AddStartupBenchmarks(size, &benchmarks);
+        AddKernelBenchmarks(size, &benchmarks);
+        AddPrinterBenchmarks(size, &benchmarks);
+    }
+    AddPoolBenchmarks(&benchmarks);
+    for (const auto& benchmark : benchmarks) {
+        if (benchmark.name.find(options.filter) != std::string::npos) {
+            Run(benchmark, options);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,377 @@
+#include <algorithm>
+#include <bit>
+#include <span>
+#include <stdexcept>
+
+#include "bigint.h"
+
+namespace {
+
+using Digits = std::vector<uint32_t>;
+
+// Magnitudes are passed as digit ranges, so that Karatsuba can split its operands without
+// copying them. Ranges may have leading zeros unless stated otherwise.
+using View = std::span<const uint32_t>;
+
+constexpr uint64_t kBase = uint64_t(1) << 32;
+
+// Below this many digits in the shorter operand, schoolbook multiplication is faster.
+constexpr std::size_t kKaratsubaThreshold = 40;
+
+View Trimmed(View digits) {
+    auto size = digits.size();
+    while (size && !digits[size - 1]) {
+        --size;
+    }
+    return digits.first(size);
+}
+
+void Trim(Digits* digits) {
+    digits->resize(Trimmed(*digits).size());
+}
+
+int CompareMagnitudes(View lhs, View rhs) {
+    lhs = Trimmed(lhs);
+    rhs = Trimmed(rhs);
+    if (lhs.size() != rhs.size()) {
+        return lhs.size() < rhs.size() ? -1 : 1;
+    }
+    for (auto i = lhs.size(); i-- > 0;) {
+        if (lhs[i] != rhs[i]) {
+            return lhs[i] < rhs[i] ? -1 : 1;
+        }
+    }
+    return 0;
+}
+
+Digits AddMagnitudes(View lhs, View rhs) {
+    if (lhs.size() < rhs.size()) {
+        std::swap(lhs, rhs);
+    }
+    Digits result(lhs.size() + 1);
+    uint64_t carry = 0;
+    for (std::size_t i = 0; i < lhs.size(); ++i) {
+        carry += uint64_t(lhs[i]) + (i < rhs.size() ? rhs[i] : 0);
+        result[i] = static_cast<uint32_t>(carry);
+        carry >>= 32;
+    }
+    result.back() = static_cast<uint32_t>(carry);
+    Trim(&result);
+    return result;
+}
+
+// lhs - rhs; the difference must not be negative.
+Digits SubtractMagnitudes(View lhs, View rhs) {
+    Digits result(lhs.begin(), lhs.end());
+    int64_t borrow = 0;
+    for (std::size_t i = 0; i < result.size() && (i < rhs.size() || borrow); ++i) {
+        int64_t difference = int64_t(result[i]) - (i < rhs.size() ? rhs[i] : 0) - borrow;
+        borrow = difference < 0;
+        result[i] = static_cast<uint32_t>(difference + (borrow ? kBase : 0));
+    }
+    Trim(&result);
+    return result;
+}
+
+// target += digits; the sum must fit in the target.
+void AddInto(std::span<uint32_t> target, View digits) {
+    digits = Trimmed(digits);
+    uint64_t carry = 0;
+    for (std::size_t i = 0; i < target.size() && (i < digits.size() || carry); ++i) {
+        carry += uint64_t(target[i]) + (i < digits.size() ? digits[i] : 0);
+        target[i] = static_cast<uint32_t>(carry);
+        carry >>= 32;
+    }
+}
+
+// target -= digits; the difference must not be negative.
+void SubtractInto(std::span<uint32_t> target, View digits) {
+    digits = Trimmed(digits);
+    int64_t borrow = 0;
+    for (std::size_t i = 0; i < target.size() && (i < digits.size() || borrow); ++i) {
+        int64_t difference = int64_t(target[i]) - (i < digits.size() ? digits[i] : 0) - borrow;
+        borrow = difference < 0;
+        target[i] = static_cast<uint32_t>(difference + (borrow ? kBase : 0));
+    }
+}
+
+void MultiplySchoolbook(View lhs, View rhs, uint32_t* out) {
+    for (std::size_t i = 0; i < lhs.size(); ++i) {
+        if (!lhs[i]) {
+            continue;
+        }
+        uint64_t carry = 0;
+        for (std::size_t j = 0; j < rhs.size(); ++j) {
+            carry += uint64_t(lhs[i]) * rhs[j] + out[i + j];
+            out[i + j] = static_cast<uint32_t>(carry);
+            carry >>= 32;
+        }
+        out[i + rhs.size()] = static_cast<uint32_t>(carry);
+    }
+}
+
+// Adds the product to out, which has lhs.size() + rhs.size() digits and starts zeroed.
+void Multiply(View lhs, View rhs, uint32_t* out) {
+    if (lhs.size() < rhs.size()) {
+        std::swap(lhs, rhs);
+    }
+    if (rhs.size() < kKaratsubaThreshold) {
+        MultiplySchoolbook(lhs, rhs, out);
+        return;
+    }
+    std::span<uint32_t> result(out, lhs.size() + rhs.size());
+    if (2 * rhs.size() <= lhs.size()) {
+        // Unbalanced operands: multiply by chunks of the longer one, each as long as the
+        // shorter one, so that every product is balanced.
+        Digits partial(2 * rhs.size());
+        for (std::size_t offset = 0; offset < lhs.size(); offset += rhs.size()) {
+            auto chunk = lhs.subspan(offset, std::min(rhs.size(), lhs.size() - offset));
+            std::fill(partial.begin(), partial.end(), 0);
+            Multiply(chunk, rhs, partial.data());
+            AddInto(result.subspan(offset), View(partial).first(chunk.size() + rhs.size()));
+        }
+        return;
+    }
+
+    // lhs = a1 B + a0, rhs = b1 B + b0, B = 2^(32 half):
+    // lhs rhs = a1 b1 B^2 + ((a0 + a1)(b0 + b1) - a0 b0 - a1 b1) B + a0 b0.
+    auto half = lhs.size() / 2;
+    auto low = result.first(2 * half), high = result.subspan(2 * half);
+    Multiply(lhs.first(half), rhs.first(half), low.data());
+    Multiply(lhs.subspan(half), rhs.subspan(half), high.data());
+
+    auto lhs_sum = AddMagnitudes(lhs.first(half), lhs.subspan(half));
+    auto rhs_sum = AddMagnitudes(rhs.first(half), rhs.subspan(half));
+    Digits middle(lhs_sum.size() + rhs_sum.size());
+    Multiply(lhs_sum, rhs_sum, middle.data());
+    SubtractInto(middle, low);
+    SubtractInto(middle, high);
+    AddInto(result.subspan(half), middle);
+}
+
+// Quotient of magnitudes rounded down; the divisor must be trimmed and not zero. Uses
+// algorithm D from Knuth, TAOCP vol. 2, 4.3.1.
+Digits DivideMagnitudes(View dividend, View divisor) {
+    dividend = Trimmed(dividend);
+    if (CompareMagnitudes(dividend, divisor) < 0) {
+        return {};
+    }
+    Digits quotient(dividend.size() - divisor.size() + 1);
+    if (divisor.size() == 1) {
+        uint64_t remainder = 0;
+        for (auto i = dividend.size(); i-- > 0;) {
+            auto current = (remainder << 32) | dividend[i];
+            quotient[i] = static_cast<uint32_t>(current / divisor[0]);
+            remainder = current % divisor[0];
+        }
+        Trim(&quotient);
+        return quotient;
+    }
+
+    // Normalize so that the top digit of the divisor has its high bit set; this keeps the
+    // estimate of each quotient digit at most two too large.
+    auto n = divisor.size(), m = dividend.size();
+    auto shift = std::countl_zero(divisor.back());
+    Digits v(n), u(m + 1);
+    for (auto i = n; i-- > 0;) {
+        v[i] = static_cast<uint32_t>((uint64_t(divisor[i]) << shift) |
+                                     (i ? uint64_t(divisor[i - 1]) >> (32 - shift) : 0));
+    }
+    u[m] = static_cast<uint32_t>(uint64_t(dividend[m - 1]) >> (32 - shift));
+    for (auto i = m; i-- > 0;) {
+        u[i] = static_cast<uint32_t>((uint64_t(dividend[i]) << shift) |
+                                     (i ? uint64_t(dividend[i - 1]) >> (32 - shift) : 0));
+    }
+
+    for (auto j = m - n + 1; j-- > 0;) {
+        auto numerator = (uint64_t(u[j + n]) << 32) | u[j + n - 1];
+        auto estimate = numerator / v[n - 1];
+        auto rest = numerator % v[n - 1];
+        while (estimate >= kBase || estimate * v[n - 2] > ((rest << 32) | u[j + n - 2])) {
+            --estimate;
+            rest += v[n - 1];
+            if (rest >= kBase) {
+                break;
+            }
+        }
+
+        int64_t borrow = 0, difference = 0;
+        for (std::size_t i = 0; i < n; ++i) {
+            auto product = estimate * v[i];
+            difference = int64_t(u[i + j]) - borrow - int64_t(product & 0xffffffff);
+            u[i + j] = static_cast<uint32_t>(difference);
+            borrow = int64_t(product >> 32) - (difference >> 32);
+        }
+        difference = int64_t(u[j + n]) - borrow;
+        u[j + n] = static_cast<uint32_t>(difference);
+
+        if (difference < 0) {
+            // The estimate was one too large: add the divisor back.
+            --estimate;
+            uint64_t carry = 0;
+            for (std::size_t i = 0; i < n; ++i) {
+                carry += uint64_t(u[i + j]) + v[i];
+                u[i + j] = static_cast<uint32_t>(carry);
+                carry >>= 32;
+            }
+            u[j + n] += static_cast<uint32_t>(carry);
+        }
+        quotient[j] = static_cast<uint32_t>(estimate);
+    }
+    Trim(&quotient);
+    return quotient;
+}
+
+// digits = digits * factor + addend.
+void MultiplyAdd(Digits* digits, uint32_t factor, uint32_t addend) {
+    uint64_t carry = addend;
+    for (auto& digit : *digits) {
+        carry += uint64_t(digit) * factor;
+        digit = static_cast<uint32_t>(carry);
+        carry >>= 32;
+    }
+    if (carry) {
+        digits->push_back(static_cast<uint32_t>(carry));
+    }
+}
+
+// Divides in place and returns the remainder.
+uint32_t DivideInPlace(Digits* digits, uint32_t divisor) {
+    uint64_t remainder = 0;
+    for (auto i = digits->size(); i-- > 0;) {
+        auto current = (remainder << 32) | (*digits)[i];
+        (*digits)[i] = static_cast<uint32_t>(current / divisor);
+        remainder = current % divisor;
+    }
+    Trim(digits);
+    return static_cast<uint32_t>(remainder);
+}
+
+constexpr uint32_t kDecimalChunk = 1000000000;
+constexpr int kDecimalChunkDigits = 9;
+
+uint64_t GetMagnitude64(const Digits& digits) {
+    uint64_t magnitude = 0;
+    for (auto i = digits.size(); i-- > 0;) {
+        magnitude = (magnitude << 32) | digits[i];
+    }
+    return magnitude;
+}
+
+}  // namespace
+
+BigInt::BigInt(int64_t value) : negative_(value < 0) {
+    auto magnitude = negative_ ? 0 - static_cast<uint64_t>(value) : static_cast<uint64_t>(value);
+    while (magnitude) {
+        digits_.push_back(static_cast<uint32_t>(magnitude));
+        magnitude >>= 32;
+    }
+}
+
+BigInt::BigInt(Digits digits, bool negative) : digits_(std::move(digits)) {
+    Trim(&digits_);
+    negative_ = negative && !digits_.empty();
+}
+
+BigInt BigInt::Parse(std::string_view text) {
+    bool negative = false;
+    if (!text.empty() && (text.front() == '+' || text.front() == '-')) {
+        negative = text.front() == '-';
+        text.remove_prefix(1);
+    }
+    if (text.empty()) {
+        throw std::invalid_argument("Not an integer");
+    }
+    Digits digits;
+    // The first chunk takes the leftover digits, so that the others have exactly nine.
+    auto chunk_size = (text.size() - 1) % kDecimalChunkDigits + 1;
+    for (std::size_t pos = 0; pos < text.size(); pos += chunk_size, chunk_size = 9) {
+        uint32_t chunk = 0, factor = 1;
+        for (auto symbol : text.substr(pos, chunk_size)) {
+            if (symbol < '0' || symbol > '9') {
+                throw std::invalid_argument("Not an integer");
+            }
+            chunk = chunk * 10 + (symbol - '0');
+            factor *= 10;
+        }
+        MultiplyAdd(&digits, factor, chunk);
+    }
+    return BigInt(std::move(digits), negative);
+}
+
+bool BigInt::FitsInt64() const {
+    if (digits_.size() > 2) {
+        return false;
+    }
+    auto magnitude = GetMagnitude64(digits_);
+    auto limit = uint64_t(1) << 63;
+    return negative_ ? magnitude <= limit : magnitude < limit;
+}
+
+int64_t BigInt::ToInt64() const {
+    auto magnitude = GetMagnitude64(digits_);
+    return static_cast<int64_t>(negative_ ? 0 - magnitude : magnitude);
+}
+
+std::string BigInt::ToString() const {
+    if (digits_.empty()) {
+        return "0";
+    }
+    std::vector<uint32_t> chunks;
+    auto rest = digits_;
+    while (!rest.empty()) {
+        chunks.push_back(DivideInPlace(&rest, kDecimalChunk));
+    }
+    std::string result = negative_ ? "-" : "";
+    result += std::to_string(chunks.back());
+    for (auto i = chunks.size() - 1; i-- > 0;) {
+        auto chunk = std::to_string(chunks[i]);
+        result.append(kDecimalChunkDigits - chunk.size(), '0');
+        result += chunk;
+    }
+    return result;
+}
+
+BigInt BigInt::operator-() const {
+    return BigInt(digits_, !negative_);
+}
+
+BigInt BigInt::AddSigned(const BigInt& lhs, const BigInt& rhs, bool rhs_negative) {
+    if (lhs.negative_ == rhs_negative) {
+        return BigInt(AddMagnitudes(lhs.digits_, rhs.digits_), rhs_negative);
+    }
+    auto order = CompareMagnitudes(lhs.digits_, rhs.digits_);
+    if (order >= 0) {
+        return BigInt(SubtractMagnitudes(lhs.digits_, rhs.digits_), lhs.negative_);
+    }
+    return BigInt(SubtractMagnitudes(rhs.digits_, lhs.digits_), rhs_negative);
+}
+
+BigInt operator+(const BigInt& lhs, const BigInt& rhs) {
+    return BigInt::AddSigned(lhs, rhs, rhs.negative_);
+}
+
+BigInt operator-(const BigInt& lhs, const BigInt& rhs) {
+    return BigInt::AddSigned(lhs, rhs, !rhs.negative_ && !rhs.IsZero());
+}
+
+BigInt operator*(const BigInt& lhs, const BigInt& rhs) {
+    if (lhs.IsZero() || rhs.IsZero()) {
+        return {};
+    }
+    BigInt::Digits product(lhs.digits_.size() + rhs.digits_.size());
+    Multiply(lhs.digits_, rhs.digits_, product.data());
+    return BigInt(std::move(product), lhs.negative_ != rhs.negative_);
+}
+
+BigInt operator/(const BigInt& lhs, const BigInt& rhs) {
+    return BigInt(DivideMagnitudes(lhs.digits_, rhs.digits_), lhs.negative_ != rhs.negative_);
+}
+
+std::strong_ordering operator<=>(const BigInt& lhs, const BigInt& rhs) {
+    if (lhs.negative_ != rhs.negative_) {
+        return rhs.negative_ <=> lhs.negative_;
+    }
+    auto order = CompareMagnitudes(lhs.digits_, rhs.digits_);
+    return lhs.negative_ ? 0 <=> order : order <=> 0;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <compare>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Arbitrary-precision signed integer. The magnitude is kept as base 2^32 digits, least
+// significant first and without leading zeros; zero has no digits and is never negative.
+class BigInt {
+public:
+    BigInt() = default;
+
+    BigInt(int64_t value);
+
+    // Parses an optional sign followed by decimal digits.
+    static BigInt Parse(std::string_view text);
+
+    bool IsZero() const {
+        return digits_.empty();
+    }
+
+    bool IsNegative() const {
+        return negative_;
+    }
+
+    bool FitsInt64() const;
+
+    // The value as int64_t; only valid if FitsInt64().
+    int64_t ToInt64() const;
+
+    std::string ToString() const;
+
+    BigInt operator-() const;
+
+    friend BigInt operator+(const BigInt& lhs, const BigInt& rhs);
+
+    friend BigInt operator-(const BigInt& lhs, const BigInt& rhs);
+
+    friend BigInt operator*(const BigInt& lhs, const BigInt& rhs);
+
+    // Rounds towards zero, like int64_t division. The divisor must not be zero.
+    friend BigInt operator/(const BigInt& lhs, const BigInt& rhs);
+
+    friend bool operator==(const BigInt& lhs, const BigInt& rhs) = default;
+
+    friend std::strong_ordering operator<=>(const BigInt& lhs, const BigInt& rhs);
+
+private:
+    using Digits = std::vector<uint32_t>;
+
+    BigInt(Digits digits, bool negative);
+
+    // Sum of the values with the given signs; used for both addition and subtraction.
+    static BigInt AddSigned(const BigInt& lhs, const BigInt& rhs, bool rhs_negative);
+
+    Digits digits_;
+    bool negative_ = false;
+};
@@ -0,0 +1,152 @@
+#include <algorithm>
+#include <limits>
+
+#include "budget.h"
+#include "error.h"
+#include "heap.h"
+
+namespace {
+
+constexpr auto kUnbounded = std::numeric_limits<std::size_t>::max();
+
+}  // namespace
+
+Budget::Budget(const Limits& limits) : limits_(limits), active_(limits.IsSet()) {
+    if (!active_) {
+        return;
+    }
+    previous_ = current;
+    current = this;
+    next_check_ = limits_.steps ? limits_.steps + 1 : kUnbounded;
+    max_depth_ = limits_.depth ? limits_.depth : kUnbounded;
+    if (limits_.time.count()) {
+        deadline_ = Clock::now() + limits_.time;
+        next_check_ = std::min(next_check_, kCheckInterval);
+    }
+    auto& heap = Heap::Local();
+    previous_heap_budget_ = heap.GetBudgetEnd();
+    if (limits_.bytes) {
+        auto allocated = heap.GetStats().allocated_bytes;
+        heap.SetBudgetEnd(allocated + std::min(limits_.bytes, kUnbounded - allocated));
+    }
+}
+
+Budget::Budget(SharedBudget* shared, std::size_t task)
+    : limits_(shared->limits_),
+      active_(true),
+      previous_(current),
+      next_check_(kCheckInterval),
+      max_depth_(shared->max_depth_),
+      deadline_(shared->deadline_),
+      shared_(shared),
+      task_(task) {
+    current = this;
+    auto& heap = Heap::Local();
+    previous_heap_budget_ = heap.GetBudgetEnd();
+    flushed_bytes_ = heap.GetStats().allocated_bytes;
+    if (limits_.bytes) {
+        auto used = std::min(limits_.bytes, shared->base_bytes_ + shared->bytes_.load());
+        heap.SetBudgetEnd(flushed_bytes_ + std::min(limits_.bytes - used,
+                                                    kUnbounded - flushed_bytes_));
+    }
+}
+
+Budget::~Budget() {
+    if (active_) {
+        if (shared_) {
+            Flush();
+        }
+        current = previous_;
+        Heap::Local().SetBudgetEnd(previous_heap_budget_);
+    }
+}
+
+void Budget::CheckDepth(std::size_t depth) const {
+    if (limits_.depth && depth > limits_.depth) {
+        throw ResourceLimitError("Depth limit exceeded");
+    }
+}
+
+void Budget::Check() {
+    if (shared_) {
+        Flush();
+        if (task_ > shared_->first_failure_.load(std::memory_order_relaxed)) {
+            throw ResourceLimitError("Cancelled");
+        }
+        if (limits_.steps && shared_->base_steps_ + shared_->steps_.load() > limits_.steps) {
+            throw ResourceLimitError("Step limit exceeded");
+        }
+        if (limits_.bytes && shared_->base_bytes_ + shared_->bytes_.load() > limits_.bytes) {
+            throw ResourceLimitError("Allocation limit exceeded");
+        }
+        if (deadline_ && Clock::now() > *deadline_) {
+            throw ResourceLimitError("Time limit exceeded");
+        }
+        next_check_ = steps_ + kCheckInterval;
+        return;
+    }
+    if (limits_.steps && steps_ > limits_.steps) {
+        throw ResourceLimitError("Step limit exceeded");
+    }
+    if (deadline_ && Clock::now() > *deadline_) {
+        throw ResourceLimitError("Time limit exceeded");
+    }
+    auto next = limits_.steps ? limits_.steps + 1 : kUnbounded;
+    if (deadline_) {
+        next = std::min(next, steps_ + kCheckInterval);
+    }
+    next_check_ = next;
+}
+
+void Budget::Flush() {
+    shared_->steps_ += steps_ - flushed_steps_;
+    flushed_steps_ = steps_;
+    auto allocated = Heap::Local().GetStats().allocated_bytes;
+    shared_->bytes_ += allocated - flushed_bytes_;
+    if (std::this_thread::get_id() == shared_->owner_) {
+        shared_->owner_bytes_ += allocated - flushed_bytes_;
+    }
+    flushed_bytes_ = allocated;
+}
+
+void Budget::ExceedDepth(std::size_t levels) {
+    depth_ -= levels;
+    throw ResourceLimitError("Depth limit exceeded");
+}
+
+SharedBudget::SharedBudget(Budget* budget)
+    : budget_(budget), owner_(std::this_thread::get_id()), first_failure_(kUnbounded) {
+    max_depth_ = kUnbounded;
+    if (!budget_) {
+        return;
+    }
+    limits_ = budget_->limits_;
+    deadline_ = budget_->deadline_;
+    base_steps_ = budget_->steps_;
+    max_depth_ = budget_->max_depth_ - std::min(budget_->max_depth_, budget_->depth_);
+    if (limits_.bytes) {
+        auto& heap = Heap::Local();
+        auto left = heap.GetBudgetEnd() - std::min(heap.GetBudgetEnd(),
+                                                   heap.GetStats().allocated_bytes);
+        base_bytes_ = limits_.bytes - std::min(limits_.bytes, left);
+    }
+}
+
+SharedBudget::~SharedBudget() {
+    if (!budget_) {
+        return;
+    }
+    // Charged at the next check of the run, which throws if the tasks went past a limit.
+    budget_->steps_ += steps_;
+    if (limits_.bytes) {
+        auto& heap = Heap::Local();
+        auto others = bytes_ - owner_bytes_;
+        heap.SetBudgetEnd(heap.GetBudgetEnd() - std::min(heap.GetBudgetEnd(), others));
+    }
+}
+
+void SharedBudget::Cancel(std::size_t task) {
+    auto failure = first_failure_.load();
+    while (task < failure && !first_failure_.compare_exchange_weak(failure, task)) {
+    }
+}
@@ -0,0 +1,195 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <optional>
+#include <thread>
+
+// Bounds on the work done by one run of an interpreter; zero means no bound.
+struct Limits {
+    // Calls evaluated, plus elements handled by the builtins that walk or build lists.
+    std::size_t steps = 0;
+    // Bytes allocated from the heap, whether freed again or not.
+    std::size_t bytes = 0;
+    // Nesting of expressions being evaluated.
+    std::size_t depth = 0;
+    std::chrono::nanoseconds time{0};
+
+    bool IsSet() const {
+        return steps || bytes || depth || time.count();
+    }
+};
+
+class SharedBudget;
+
+// Enforces the limits on the current thread for the lifetime of the object; unset limits
+// leave it inactive. Exceeding a limit throws ResourceLimitError from the evaluator, and
+// everything evaluated so far is unwound as for any other error.
+class Budget {
+public:
+    explicit Budget(const Limits& limits);
+
+    // Budget of one task of a parallel builtin, on whatever thread runs it: it draws from the
+    // budget shared with the tasks, and throws once a task before it has failed, so that the
+    // job ends without running the tasks whose results are not used.
+    Budget(SharedBudget* shared, std::size_t task);
+
+    Budget(const Budget&) = delete;
+    Budget& operator=(const Budget&) = delete;
+
+    ~Budget();
+
+    // Budget active on this thread, if any.
+    static Budget* Current() {
+        return current;
+    }
+
+    // Checks an expression of the given nesting before it runs.
+    void CheckDepth(std::size_t depth) const;
+
+    void Spend(std::size_t steps) {
+        steps_ += steps;
+        if (steps_ >= next_check_) {
+            Check();
+        }
+    }
+
+    // The VM enters the levels of the calls an instruction is nested in at once, as it does not
+    // evaluate them one inside the other.
+    void Enter(std::size_t levels = 1) {
+        depth_ += levels;
+        if (depth_ > max_depth_) {
+            ExceedDepth(levels);
+        }
+    }
+
+    void Leave(std::size_t levels = 1) {
+        depth_ -= levels;
+    }
+
+    // Throws where entering that many levels would.
+    void CheckEnter(std::size_t levels) {
+        if (levels > max_depth_ - depth_) {
+            ExceedDepth(0);
+        }
+    }
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    // The clock is read once per this many steps.
+    static constexpr std::size_t kCheckInterval = 1024;
+
+    void Check();
+
+    // Adds the steps and bytes spent by a task since the last call to the shared budget.
+    void Flush();
+
+    [[noreturn]] void ExceedDepth(std::size_t levels);
+
+    // Initialized in place, so that reading it needs no call to a TLS wrapper.
+    static inline thread_local constinit Budget* current = nullptr;
+
+    Limits limits_;
+    bool active_;
+    Budget* previous_ = nullptr;
+    std::size_t steps_ = 0, next_check_ = 0;
+    std::size_t depth_ = 0, max_depth_ = 0;
+    std::optional<Clock::time_point> deadline_;
+    std::size_t previous_heap_budget_ = 0;
+
+    // Tasks only.
+    SharedBudget* shared_ = nullptr;
+    std::size_t task_ = 0;
+    std::size_t flushed_steps_ = 0, flushed_bytes_ = 0;
+
+    friend class SharedBudget;
+};
+
+// What is left of the budget of a run, shared with the tasks of a parallel builtin for the
+// lifetime of the object, which has to be created on the thread of the run. Tasks charge it
+// as they go; it charges the budget of the run with their total when it ends. Without a
+// budget, the tasks are bounded by nothing but can still be cancelled.
+class SharedBudget {
+public:
+    explicit SharedBudget(Budget* budget);
+
+    SharedBudget(const SharedBudget&) = delete;
+    SharedBudget& operator=(const SharedBudget&) = delete;
+
+    ~SharedBudget();
+
+    // Makes the tasks after the given one throw at their next check.
+    void Cancel(std::size_t task);
+
+private:
+    Budget* budget_;
+    Limits limits_;
+    std::optional<Budget::Clock::time_point> deadline_;
+    std::size_t base_steps_ = 0, max_depth_ = 0;
+    // Bytes the run allocated before the tasks started.
+    std::size_t base_bytes_ = 0;
+    std::thread::id owner_;
+
+    std::atomic<std::size_t> steps_ = 0, bytes_ = 0;
+    // Bytes allocated by tasks that ran on the thread of the run, which its heap counts
+    // already.
+    std::atomic<std::size_t> owner_bytes_ = 0;
+    std::atomic<std::size_t> first_failure_;
+
+    friend class Budget;
+};
+
+// Charges steps to the current budget, if any.
+inline void SpendSteps(std::size_t steps) {
+    if (auto budget = Budget::Current()) {
+        budget->Spend(steps);
+    }
+}
+
+// Levels of nesting, for the lifetime of the object.
+class DepthFrame {
+public:
+    DepthFrame(Budget* budget, std::size_t levels) : budget_(budget), levels_(levels) {
+        if (budget_) {
+            budget_->Enter(levels_);
+        }
+    }
+
+    DepthFrame(const DepthFrame&) = delete;
+    DepthFrame& operator=(const DepthFrame&) = delete;
+
+    ~DepthFrame() {
+        if (budget_) {
+            budget_->Leave(levels_);
+        }
+    }
+
+private:
+    Budget* budget_;
+    std::size_t levels_;
+};
+
+// One step and one level of nesting, for the lifetime of the object.
+class BudgetFrame {
+public:
+    BudgetFrame() : budget_(Budget::Current()) {
+        if (budget_) {
+            budget_->Spend(1);
+            budget_->Enter();
+        }
+    }
+
+    BudgetFrame(const BudgetFrame&) = delete;
+    BudgetFrame& operator=(const BudgetFrame&) = delete;
+
+    ~BudgetFrame() {
+        if (budget_) {
+            budget_->Leave();
+        }
+    }
+
+private:
+    Budget* budget_;
+};
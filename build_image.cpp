@@ -0,0 +1,40 @@
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+#include "image.h"
+#include "mapped_file.h"
+#include "scheme.h"
+#include "tokenizer.h"
+
+// Runs the given source files in order, as scheme_cli would, and writes the global
+// bindings they leave behind to an image that scheme_cli --image loads.
+//
+//   scheme_image output file...
+int main(int argc, char** argv) {
+    if (argc < 3) {
+        std::cerr << "usage: " << argv[0] << " output file..." << std::endl;
+        return 1;
+    }
+    Interpreter interpreter;
+    try {
+        // Only the bindings are kept; the values of the forms are not needed.
+        std::ostringstream values;
+        for (int i = 2; i < argc; ++i) {
+            MappedFile file(argv[i]);
+            Tokenizer tokenizer(file.GetData());
+            interpreter.RunBatch(&tokenizer, &values);
+            values.str({});
+        }
+        std::ofstream out(argv[1], std::ios::binary);
+        WriteImage(*interpreter.GetGlobalScope(), &out);
+        out.close();
+        if (!out) {
+            throw std::runtime_error(std::string("cannot write ") + argv[1]);
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "error: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,700 @@
+#include <algorithm>
+#include <deque>
+#include <span>
+
+#include "bytecode.h"
+#include "analyzer.h"
+#include "budget.h"
+#include "closure.h"
+#include "functions.h"
+#include "profiler.h"
+#include "scheme.h"
+
+namespace {
+
+// Operation and OpCode list the arithmetic and comparison builtins in the same order.
+OpCode ToOpCode(Operation operation) {
+    return static_cast<OpCode>(static_cast<int>(OpCode::ADD) + static_cast<int>(operation) -
+                               static_cast<int>(Operation::ADD));
+}
+
+Operation ToOperation(OpCode op) {
+    return static_cast<Operation>(static_cast<int>(Operation::ADD) + static_cast<int>(op) -
+                                  static_cast<int>(OpCode::ADD));
+}
+
+bool IsJump(OpCode op) {
+    return op == OpCode::FOLDED || op == OpCode::GUARD || op == OpCode::CHECK_FUNCTION ||
+           op == OpCode::JUMP_IF_FALSE || op == OpCode::JUMP_UNLESS_FALSE || op == OpCode::JUMP;
+}
+
+bool IsFalse(const std::shared_ptr<Object>& value) {
+    return Is<Boolean>(value) && !Cast<Boolean>(value)->GetValue();
+}
+
+class Compiler {
+public:
+    // The lambdas and lets met that need a program of their own are added to frames.
+    Compiler(const std::shared_ptr<Scope>& scope, std::vector<std::shared_ptr<Object>>* frames)
+        : scope_(*scope), frames_(frames) {
+        program_.version = scope->GetVersion();
+    }
+
+    Program Compile(const std::shared_ptr<Object>& node) {
+        Later(node);
+        return Finish();
+    }
+
+    Program CompileBody(const Body& body) {
+        LaterBody(body);
+        return Finish();
+    }
+
+    Program CompileLet(const Let& let) {
+        LaterLet(let);
+        return Finish();
+    }
+
+private:
+    struct Task {
+        std::shared_ptr<Object> node;
+        std::optional<Instruction> instruction;
+        std::optional<std::size_t> label;
+        // Calls the node or instruction is nested in.
+        std::size_t depth = 0;
+    };
+
+    // Nodes are expanded from an explicit task list. Jumps are emitted with a label
+    // number as their target and resolved once all code is in place.
+    Program Finish() {
+        while (!tasks_.empty()) {
+            auto task = std::move(tasks_.back());
+            tasks_.pop_back();
+            depth_ = task.depth;
+            if (task.label) {
+                labels_[*task.label] = program_.code.size();
+            } else if (task.instruction) {
+                program_.code.push_back(*task.instruction);
+                program_.code.back().depth = depth_;
+            } else {
+                CompileNode(task.node);
+            }
+        }
+        Emit(OpCode::RETURN);
+        for (auto& instruction : program_.code) {
+            if (IsJump(instruction.op)) {
+                instruction.b = labels_[instruction.b];
+            }
+        }
+        return std::move(program_);
+    }
+
+    void CompileNode(const std::shared_ptr<Object>& node) {
+        if (!node || Is<Constant>(node)) {
+            Emit(OpCode::CONSTANT, AddConstant(node ? As<Constant>(node)->GetValue() : nullptr));
+        } else if (Is<GlobalRef>(node)) {
+            Emit(OpCode::LOAD_GLOBAL, As<GlobalRef>(node)->GetId());
+        } else if (Is<LocalRef>(node)) {
+            auto ref = Cast<LocalRef>(node);
+            Emit(ref->IsBoxed() ? OpCode::LOAD_BOXED_LOCAL : OpCode::LOAD_LOCAL, ref->GetSlot());
+        } else if (Is<CapturedRef>(node)) {
+            auto ref = Cast<CapturedRef>(node);
+            Emit(ref->IsBoxed() ? OpCode::LOAD_BOXED_CAPTURE : OpCode::LOAD_CAPTURE,
+                 ref->GetIndex());
+        } else if (Is<SelfRef>(node)) {
+            Emit(OpCode::LOAD_SELF);
+        } else if (Is<If>(node)) {
+            CompileIf(As<If>(node));
+        } else if (Is<Assignment>(node)) {
+            auto assignment = As<Assignment>(node);
+            auto op = assignment->IsDefinition() ? OpCode::DEFINE : OpCode::SET;
+            Later(Instruction{op, static_cast<uint32_t>(assignment->GetId())});
+            Later(assignment->GetValue());
+        } else if (Is<LocalAssignment>(node)) {
+            auto assignment = Cast<LocalAssignment>(node);
+            auto op = assignment->IsCaptured() ? OpCode::SET_BOXED_CAPTURE
+                      : assignment->IsBoxed()  ? OpCode::SET_BOXED_LOCAL
+                                               : OpCode::SET_LOCAL;
+            Later(Instruction{op, static_cast<uint32_t>(assignment->GetIndex())});
+            Later(assignment->GetValue());
+        } else if (Is<Lambda>(node)) {
+            // Making the closure is left to the node; its body gets a program of its own.
+            Emit(OpCode::EVAL, AddConstant(node));
+            if (!Cast<Lambda>(node)->GetProgram()) {
+                frames_->push_back(node);
+            }
+        } else if (Is<Let>(node)) {
+            // So is making the frame of a let that needs one.
+            auto let = Cast<Let>(node);
+            if (!let->GetFrameSize()) {
+                LaterLet(*let);
+                return;
+            }
+            Emit(OpCode::EVAL, AddConstant(node));
+            if (!let->GetProgram()) {
+                frames_->push_back(node);
+            }
+        } else if (Is<Call>(node) && Cast<Call>(node)->IsFoldValid(scope_)) {
+            // The call itself follows, for when one of its heads has changed.
+            auto end = labels_.size();
+            labels_.emplace_back();
+            Emit(OpCode::FOLDED, AddConstant(node), end);
+            Later(std::nullopt, end);
+            CompileCallNode(As<Call>(node));
+        } else if (Is<Call>(node)) {
+            CompileCallNode(As<Call>(node));
+        } else {
+            Emit(OpCode::EVAL, AddConstant(node));
+        }
+    }
+
+    void CompileCallNode(const std::shared_ptr<Call>& call) {
+        if (!CompileCall(call) && !CompileApply(call)) {
+            Emit(OpCode::EVAL, AddConstant(call));
+        }
+    }
+
+    // The value of the last node is the value of the body.
+    void LaterBody(const Body& body) {
+        for (auto i = body.nodes.size(); i-- > 0;) {
+            Later(body.nodes[i]);
+            if (i) {
+                Later(Instruction{OpCode::POP});
+            }
+        }
+        for (auto it = body.boxed_slots.rbegin(); it != body.boxed_slots.rend(); ++it) {
+            Later(Instruction{OpCode::BOX, static_cast<uint32_t>(*it)});
+        }
+    }
+
+    void LaterLet(const Let& let) {
+        LaterBody(let.GetBody());
+        const auto& bindings = let.GetBindings();
+        for (auto it = bindings.rbegin(); it != bindings.rend(); ++it) {
+            Later(Instruction{OpCode::BIND, static_cast<uint32_t>(it->first)});
+            Later(it->second);
+        }
+    }
+
+    // The condition stays on the stack when JUMP_IF_FALSE jumps, so the alternative starts
+    // by dropping it.
+    void CompileIf(const std::shared_ptr<If>& node) {
+        auto alternative = labels_.size();
+        auto end = alternative + 1;
+        labels_.resize(end + 1);
+        Later(std::nullopt, end);
+        Later(node->GetAlternative());
+        Later(Instruction{OpCode::POP});
+        Later(std::nullopt, alternative);
+        Later(Instruction{OpCode::JUMP, 0, static_cast<uint32_t>(end)});
+        Later(node->GetConsequent());
+        Later(Instruction{OpCode::JUMP_IF_FALSE, 0, static_cast<uint32_t>(alternative)});
+        Later(node->GetCondition());
+    }
+
+    bool CompileCall(const std::shared_ptr<Call>& call) {
+        auto function = As<Function>(call->GetFunction());
+        if (!function || !call->IsResolved(scope_)) {
+            return false;
+        }
+        auto kind = function->GetFormKind();
+        if (kind != FormKind::CALL && kind != FormKind::AND && kind != FormKind::OR) {
+            return false;
+        }
+        // Argument lists the builtin would reject are left to the tree walker.
+        std::vector<std::shared_ptr<Object>> args;
+        auto current = call->GetArgs();
+        while (Is<Cell>(current)) {
+            auto cell = As<Cell>(current);
+            if (!cell->GetFirst() && kind == FormKind::CALL) {
+                return false;
+            }
+            args.push_back(cell->GetFirst());
+            current = cell->GetSecond();
+        }
+        if (current) {
+            return false;
+        }
+
+        auto guard = program_.guards.size();
+        program_.guards.push_back({As<GlobalRef>(call->GetHead())->GetId(), function, call});
+        auto end = labels_.size();
+        labels_.emplace_back();
+        Emit(OpCode::GUARD, guard, end);
+
+        Later(std::nullopt, end);
+        if (kind == FormKind::CALL) {
+            auto operation = function->GetOperation();
+            if (operation != Operation::NONE) {
+                Later(Instruction{ToOpCode(operation), static_cast<uint32_t>(args.size()),
+                                  static_cast<uint32_t>(guard)});
+                if (LaterBorrowed(args)) {
+                    return true;
+                }
+            } else {
+                Later(Instruction{OpCode::CALL, static_cast<uint32_t>(guard),
+                                  static_cast<uint32_t>(args.size())});
+            }
+            program_.guards[guard].owns_args = true;
+            for (auto it = args.rbegin(); it != args.rend(); ++it) {
+                LaterArg(*it);
+            }
+        } else if (args.empty()) {
+            Emit(OpCode::CONSTANT, AddConstant(Boolean::Make(kind == FormKind::AND)));
+        } else {
+            // (and a b c) leaves the first #f on the stack, (or a b c) the first other value;
+            // either way the last argument's value when no jump is taken.
+            auto jump = kind == FormKind::AND ? OpCode::JUMP_IF_FALSE : OpCode::JUMP_UNLESS_FALSE;
+            LaterArg(args.back());
+            for (auto it = std::next(args.rbegin()); it != args.rend(); ++it) {
+                Later(Instruction{jump, 0, static_cast<uint32_t>(end)});
+                LaterArg(*it);
+            }
+        }
+        return true;
+    }
+
+    // Operands that are variables or constants are only read by the arithmetic opcode, which
+    // makes a new value, so the VM need not take a reference to them as long as nothing runs
+    // between the loads and the opcode that could change the variables.
+    bool LaterBorrowed(const std::vector<std::shared_ptr<Object>>& args) {
+        std::vector<Instruction> loads;
+        for (const auto& arg : args) {
+            if (Is<Constant>(arg)) {
+                auto index = AddConstant(Cast<Constant>(arg)->GetValue());
+                loads.push_back({OpCode::BORROW_CONSTANT, static_cast<uint32_t>(index)});
+            } else if (Is<GlobalRef>(arg)) {
+                loads.push_back(
+                    {OpCode::BORROW_GLOBAL, static_cast<uint32_t>(Cast<GlobalRef>(arg)->GetId())});
+            } else if (Is<LocalRef>(arg) && !Cast<LocalRef>(arg)->IsBoxed()) {
+                loads.push_back(
+                    {OpCode::BORROW_LOCAL, static_cast<uint32_t>(Cast<LocalRef>(arg)->GetSlot())});
+            } else if (Is<CapturedRef>(arg) && !Cast<CapturedRef>(arg)->IsBoxed()) {
+                loads.push_back({OpCode::BORROW_CAPTURE,
+                                 static_cast<uint32_t>(Cast<CapturedRef>(arg)->GetIndex())});
+            } else {
+                return false;
+            }
+        }
+        for (auto it = loads.rbegin(); it != loads.rend(); ++it) {
+            Later(*it);
+        }
+        return true;
+    }
+
+    // Call of whatever the head evaluates to. Functions that take their arguments unevaluated
+    // are only known once the head is, so the call node is kept for them.
+    bool CompileApply(const std::shared_ptr<Call>& call) {
+        std::vector<std::shared_ptr<Object>> args;
+        if (!CollectArgs(call, &args)) {
+            return false;
+        }
+        auto end = labels_.size();
+        labels_.emplace_back();
+        Later(std::nullopt, end);
+        Later(Instruction{call->IsTail() ? OpCode::TAIL_APPLY : OpCode::APPLY,
+                          static_cast<uint32_t>(args.size())});
+        for (auto it = args.rbegin(); it != args.rend(); ++it) {
+            LaterArg(*it);
+        }
+        Later(Instruction{OpCode::CHECK_FUNCTION, static_cast<uint32_t>(AddConstant(call)),
+                          static_cast<uint32_t>(end)});
+        LaterArg(call->GetHead());
+        return true;
+    }
+
+    // Argument lists a function of evaluated arguments would reject are left to the tree
+    // walker.
+    static bool CollectArgs(const std::shared_ptr<Call>& call,
+                            std::vector<std::shared_ptr<Object>>* args) {
+        auto current = call->GetArgs();
+        while (Is<Cell>(current)) {
+            auto cell = As<Cell>(current);
+            if (!cell->GetFirst()) {
+                return false;
+            }
+            args->push_back(cell->GetFirst());
+            current = cell->GetSecond();
+        }
+        return !current;
+    }
+
+    void Later(std::shared_ptr<Object> node) {
+        tasks_.push_back({std::move(node), std::nullopt, std::nullopt, depth_});
+    }
+
+    // Argument of the call being compiled, which the tree walker evaluates inside the call.
+    void LaterArg(std::shared_ptr<Object> node) {
+        tasks_.push_back({std::move(node), std::nullopt, std::nullopt, depth_ + 1});
+    }
+
+    void Later(std::optional<Instruction> instruction, std::optional<std::size_t> label = {}) {
+        tasks_.push_back({nullptr, instruction, label, depth_});
+    }
+
+    void Emit(OpCode op, std::size_t a = 0, std::size_t b = 0) {
+        program_.code.push_back({op, static_cast<uint32_t>(a), static_cast<uint32_t>(b),
+                                 static_cast<uint32_t>(depth_)});
+    }
+
+    std::size_t AddConstant(std::shared_ptr<Object> value) {
+        program_.constants.push_back(std::move(value));
+        return program_.constants.size() - 1;
+    }
+
+    const Scope& scope_;
+    Program program_;
+    // A stack: the task pushed last runs first, so code is pushed in reverse order.
+    std::vector<Task> tasks_;
+    std::vector<std::size_t> labels_;
+    std::vector<std::shared_ptr<Object>>* frames_;
+    std::size_t depth_ = 0;
+};
+
+// Pointer to the value that leaves its reference count alone, as copying it does not need
+// the atomic operations that copying the owning pointer does.
+std::shared_ptr<Object> Borrow(const std::shared_ptr<Object>& value) {
+    return std::shared_ptr<Object>(std::shared_ptr<Object>(), value.get());
+}
+
+// Replaces the variables of the frame of a closure with the arguments of a call of that
+// closure in tail position, as Closure::Run does with a new frame. Argument counts that need
+// checking or a rest list are left to it.
+bool Rebind(const Lambda& lambda, std::span<std::shared_ptr<Object>> args, const Scope* frame) {
+    if (lambda.HasRest() || args.size() != lambda.GetParamCount()) {
+        return false;
+    }
+    if (!lambda.GetFrameSize()) {
+        return true;
+    }
+    auto slots = &frame->GetSlot(0);
+    std::move(args.begin(), args.end(), slots);
+    std::fill(slots + args.size(), slots + lambda.GetFrameSize(), nullptr);
+    return true;
+}
+
+// Value stacks of the programs running on this thread, one per program in progress. The
+// arguments a builtin is called with stay on the stack of its caller, so they do not move when
+// it calls a closure whose body runs another program.
+class ValueStack {
+public:
+    ValueStack() : stack_(Take()) {
+    }
+
+    ValueStack(const ValueStack&) = delete;
+    ValueStack& operator=(const ValueStack&) = delete;
+
+    ~ValueStack() {
+        stack_.clear();
+        --depth;
+    }
+
+    std::vector<std::shared_ptr<Object>>& Get() {
+        return stack_;
+    }
+
+private:
+    static std::vector<std::shared_ptr<Object>>& Take() {
+        // Kept between runs to avoid reallocating them. A deque does not move its elements
+        // as it grows.
+        if (depth == stacks.size()) {
+            stacks.emplace_back();
+        }
+        return stacks[depth++];
+    }
+
+    static inline thread_local std::deque<std::vector<std::shared_ptr<Object>>> stacks;
+    static inline thread_local std::size_t depth = 0;
+
+    std::vector<std::shared_ptr<Object>>& stack_;
+};
+
+// Functions called with the values of their arguments, as opposed to special forms.
+bool TakesValues(const std::shared_ptr<Object>& function) {
+    return function && (GetType(function.get()) == Type::CLOSURE ||
+                        (GetType(function.get()) == Type::FUNCTION &&
+                         Cast<Function>(function)->GetFormKind() == FormKind::CALL));
+}
+
+// Applies such a function to arguments the caller has no further use for.
+std::shared_ptr<Object> ApplyValues(const std::shared_ptr<Object>& function,
+                                    std::span<std::shared_ptr<Object>> args) {
+    if (function->GetType() == Type::CLOSURE) {
+        return Cast<Closure>(function)->Call(args);
+    }
+    return Cast<Function>(function)->Invoke(args);
+}
+
+// Call whose guard failed while its name was bound to another function of evaluated
+// arguments. Its arguments are pushed from the given height of the stack on, and its opcode
+// applies that function to them.
+struct Rebound {
+    uint32_t guard;
+    std::size_t height;
+    std::shared_ptr<Object> function;
+};
+
+// Calls nest, so only the innermost one can be the call of the opcode. No two calls in
+// progress share a guard.
+bool IsRebound(const std::vector<Rebound>& rebound, uint32_t guard, std::size_t height) {
+    return !rebound.empty() && rebound.back().guard == guard && rebound.back().height == height;
+}
+
+void ApplyRebound(std::size_t count, std::size_t depth, Budget* budget,
+                  std::vector<Rebound>* rebound, std::vector<std::shared_ptr<Object>>* stack) {
+    auto function = std::move(rebound->back().function);
+    rebound->pop_back();
+    if (budget) {
+        budget->Spend(1);
+    }
+    DepthFrame frame(budget, depth + 1);
+    SCHEME_PROFILE_CALL(function.get());
+    auto end = stack->data() + stack->size();
+    auto result = ApplyValues(function, {end - count, end});
+    stack->resize(stack->size() - count);
+    stack->push_back(std::move(result));
+}
+
+}  // namespace
+
+Program Compile(const std::shared_ptr<Object>& node, const std::shared_ptr<Scope>& scope) {
+    std::vector<std::shared_ptr<Object>> frames;
+    auto program = Compiler(scope, &frames).Compile(node);
+    // The bodies are compiled one after another rather than nested, so compilation does not
+    // recurse on the nesting of lambdas either.
+    while (!frames.empty()) {
+        auto frame = std::move(frames.back());
+        frames.pop_back();
+        Compiler compiler(scope, &frames);
+        if (auto lambda = As<Lambda>(frame)) {
+            lambda->SetProgram(std::make_shared<Program>(compiler.CompileBody(lambda->GetBody())));
+        } else {
+            auto let = As<Let>(frame);
+            let->SetProgram(std::make_shared<Program>(compiler.CompileLet(*let)));
+        }
+    }
+    return program;
+}
+
+std::shared_ptr<Object> Execute(const Program& program, const std::shared_ptr<Scope>& scope) {
+    ValueStack value_stack;
+    auto& stack = value_stack.Get();
+    std::vector<Rebound> rebound;
+    // Calls count as steps and levels of nesting as on the tree walker: each instruction knows
+    // how many calls it is nested in, so the VM enters those levels only where it runs code
+    // that may nest further, and otherwise just checks that the tree walker would not have
+    // run out of depth there.
+    auto budget = Budget::Current();
+    for (std::size_t pc = 0;; ++pc) {
+        const auto& instruction = program.code[pc];
+        switch (instruction.op) {
+            case OpCode::CONSTANT:
+                stack.push_back(program.constants[instruction.a]);
+                break;
+            case OpCode::LOAD_GLOBAL:
+                stack.push_back(*scope->GetGlobalSlot(instruction.a));
+                break;
+            case OpCode::LOAD_LOCAL:
+                stack.push_back(scope->GetSlot(instruction.a));
+                break;
+            case OpCode::LOAD_BOXED_LOCAL:
+                stack.push_back(Cast<Box>(scope->GetSlot(instruction.a))->Get());
+                break;
+            case OpCode::LOAD_CAPTURE:
+                stack.push_back(scope->GetCapture(instruction.a));
+                break;
+            case OpCode::LOAD_BOXED_CAPTURE:
+                stack.push_back(Cast<Box>(scope->GetCapture(instruction.a))->Get());
+                break;
+            case OpCode::LOAD_SELF:
+                stack.push_back(scope->GetClosure()->shared_from_this());
+                break;
+            case OpCode::BORROW_CONSTANT:
+                stack.push_back(Borrow(program.constants[instruction.a]));
+                break;
+            case OpCode::BORROW_GLOBAL:
+                stack.push_back(Borrow(*scope->GetGlobalSlot(instruction.a)));
+                break;
+            case OpCode::BORROW_LOCAL:
+                stack.push_back(Borrow(scope->GetSlot(instruction.a)));
+                break;
+            case OpCode::BORROW_CAPTURE:
+                stack.push_back(Borrow(scope->GetCapture(instruction.a)));
+                break;
+            case OpCode::FOLDED: {
+                auto call = Cast<Call>(program.constants[instruction.a]);
+                if (scope->GetVersion() == program.version || call->IsFoldValid(*scope)) {
+                    if (budget) {
+                        budget->Spend(1);
+                        budget->CheckEnter(instruction.depth + 1);
+                    }
+                    stack.push_back(call->GetFoldedValue());
+                    pc = instruction.b - 1;
+                }
+                break;
+            }
+            case OpCode::GUARD: {
+                const auto& guard = program.guards[instruction.a];
+                if (scope->GetVersion() != program.version &&
+                    !scope->IsBoundTo(guard.id, guard.function.get())) {
+                    // The arguments then run here as well, however deep they nest.
+                    auto function = *scope->GetGlobalSlot(guard.id);
+                    if (guard.owns_args && TakesValues(function)) {
+                        rebound.push_back({instruction.a, stack.size(), std::move(function)});
+                        if (budget) {
+                            budget->CheckEnter(instruction.depth + 1);
+                        }
+                        break;
+                    }
+                    DepthFrame frame(budget, instruction.depth);
+                    stack.push_back(guard.node->Eval(scope));
+                    pc = instruction.b - 1;
+                } else if (budget) {
+                    budget->CheckEnter(instruction.depth + 1);
+                }
+                break;
+            }
+            case OpCode::CALL: {
+                if (IsRebound(rebound, instruction.a, stack.size() - instruction.b)) {
+                    ApplyRebound(instruction.b, instruction.depth, budget, &rebound, &stack);
+                    break;
+                }
+                auto end = stack.data() + stack.size();
+                const auto& function = program.guards[instruction.a].function;
+                if (budget) {
+                    budget->Spend(1);
+                }
+                DepthFrame frame(budget, instruction.depth + 1);
+                SCHEME_PROFILE_CALL(function.get());
+                auto result = function->Invoke({end - instruction.b, end});
+                stack.resize(stack.size() - instruction.b);
+                stack.push_back(std::move(result));
+                break;
+            }
+            case OpCode::CHECK_FUNCTION: {
+                auto& function = stack.back();
+                if (!function) {
+                    throw RuntimeError("Bad function");
+                }
+                if (TakesValues(function)) {
+                    if (budget) {
+                        budget->CheckEnter(instruction.depth + 1);
+                    }
+                    break;
+                }
+                if (budget) {
+                    budget->Spend(1);
+                }
+                DepthFrame frame(budget, instruction.depth + 1);
+                SCHEME_PROFILE_CALL(function.get());
+                function = ApplyValue(function, scope,
+                                      Cast<Call>(program.constants[instruction.a])->GetArgs());
+                pc = instruction.b - 1;
+                break;
+            }
+            case OpCode::APPLY:
+            case OpCode::TAIL_APPLY: {
+                auto end = stack.data() + stack.size();
+                auto& function = *(end - instruction.a - 1);
+                if (budget) {
+                    budget->Spend(1);
+                }
+                // A tail call of a closure returns before the closure runs, so it enters no
+                // level here.
+                auto is_tail = instruction.op == OpCode::TAIL_APPLY &&
+                               function->GetType() == Type::CLOSURE;
+                DepthFrame frame(budget, is_tail ? 0 : instruction.depth + 1);
+                SCHEME_PROFILE_CALL(function.get());
+                // The arguments are not used again, so closures take them over.
+                std::span<std::shared_ptr<Object>> args(end - instruction.a, end);
+                std::shared_ptr<Object> result;
+                if (!is_tail) {
+                    result = ApplyValues(function, args);
+                } else {
+                    auto closure = Cast<Closure>(function);
+                    // A loop: the program starts over in the same frame without returning.
+                    if (closure == scope->GetClosure() && Rebind(closure->GetLambda(), args,
+                                                                 scope.get())) {
+                        stack.clear();
+                        pc = -1;
+                        break;
+                    }
+                    return Closure::TailCall(closure, std::move(function), args);
+                }
+                stack.resize(stack.size() - instruction.a);
+                stack.back() = std::move(result);
+                break;
+            }
+            case OpCode::JUMP_IF_FALSE:
+            case OpCode::JUMP_UNLESS_FALSE:
+                if (IsFalse(stack.back()) == (instruction.op == OpCode::JUMP_IF_FALSE)) {
+                    pc = instruction.b - 1;
+                } else {
+                    stack.pop_back();
+                }
+                break;
+            case OpCode::JUMP:
+                pc = instruction.b - 1;
+                break;
+            case OpCode::POP:
+                stack.pop_back();
+                break;
+            case OpCode::DEFINE:
+            case OpCode::SET:
+                if (instruction.op == OpCode::DEFINE) {
+                    scope->Define(instruction.a, stack.back());
+                } else {
+                    scope->Reset(instruction.a, stack.back());
+                }
+                stack.back() = nullptr;
+                break;
+            case OpCode::SET_LOCAL:
+                scope->GetSlot(instruction.a) = std::move(stack.back());
+                stack.back() = nullptr;
+                break;
+            case OpCode::SET_BOXED_LOCAL:
+                Cast<Box>(scope->GetSlot(instruction.a))->Set(std::move(stack.back()));
+                stack.back() = nullptr;
+                break;
+            case OpCode::SET_BOXED_CAPTURE:
+                Cast<Box>(scope->GetCapture(instruction.a))->Set(std::move(stack.back()));
+                stack.back() = nullptr;
+                break;
+            case OpCode::BIND:
+                scope->GetSlot(instruction.a) = std::move(stack.back());
+                stack.pop_back();
+                break;
+            case OpCode::BOX: {
+                auto& value = scope->GetSlot(instruction.a);
+                value = Allocate<Box>(std::move(value));
+                break;
+            }
+            case OpCode::EVAL: {
+                DepthFrame frame(budget, instruction.depth);
+                stack.push_back(program.constants[instruction.a]->Eval(scope));
+                break;
+            }
+            case OpCode::RETURN: {
+                auto result = std::move(stack.back());
+                stack.pop_back();
+                return result;
+            }
+            default: {
+                if (IsRebound(rebound, instruction.b, stack.size() - instruction.a)) {
+                    ApplyRebound(instruction.a, instruction.depth, budget, &rebound, &stack);
+                    break;
+                }
+                auto end = stack.data() + stack.size();
+                if (budget) {
+                    budget->Spend(1);
+                    budget->CheckEnter(instruction.depth + 1);
+                }
+                SCHEME_PROFILE_CALL(program.guards[instruction.b].function.get());
+                auto result = ApplyOperation(ToOperation(instruction.op), end - instruction.a, end);
+                stack.resize(stack.size() - instruction.a);
+                stack.push_back(std::move(result));
+                break;
+            }
+        }
+    }
+}
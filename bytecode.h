@@ -0,0 +1,98 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "object.h"
+
+enum class OpCode : uint8_t {
+    CONSTANT,           // push constants[a]
+    LOAD_GLOBAL,        // push the global bound to symbol a
+    LOAD_LOCAL,         // push slot a of the frame
+    LOAD_BOXED_LOCAL,   // push the value in the box in slot a of the frame
+    LOAD_CAPTURE,       // push capture a of the running closure
+    LOAD_BOXED_CAPTURE, // push the value in the box in capture a of the running closure
+    LOAD_SELF,          // push the running closure
+    BORROW_CONSTANT,    // as CONSTANT, LOAD_GLOBAL, LOAD_LOCAL and LOAD_CAPTURE, but push
+    BORROW_GLOBAL,      // a pointer that does not own the value: only for the operands of an
+    BORROW_LOCAL,       // arithmetic opcode that follows them directly
+    BORROW_CAPTURE,
+    FOLDED,             // push the folded value of the call in constants[a] and jump to b
+                        // while its heads are bound as when folded, else go on with the call
+    GUARD,              // unless guards[a] still holds, either go on with the arguments and
+                        // have the opcode of the call apply what the name is bound to now,
+                        // or push its tree evaluation and jump to b
+    ADD,                // arithmetic and comparison opcodes pop a arguments and push the
+                        // result; b is the guard of the call
+    SUBTRACT,
+    MULTIPLY,
+    DIVIDE,
+    EQUAL,
+    LESS,
+    GREATER,
+    LESS_EQUAL,
+    GREATER_EQUAL,
+    MIN,
+    MAX,
+    ABS,
+    CALL,               // pop b arguments, push the result of the builtin of guards[a]
+    CHECK_FUNCTION,     // unless the top is a function of evaluated arguments, replace it
+                        // with its tree application to the arguments of call constants[a]
+                        // and jump to b
+    APPLY,              // pop a arguments and the function below them, push the result
+    TAIL_APPLY,         // as APPLY, but a closure is called by returning to the closure
+                        // running this program, which calls it in place of itself
+    JUMP_IF_FALSE,      // jump to b if the top is #f, pop it otherwise
+    JUMP_UNLESS_FALSE,  // jump to b unless the top is #f, pop it otherwise
+    JUMP,               // jump to b
+    POP,                // pop the top
+    DEFINE,             // pop a value and define symbol a, push ()
+    SET,                // pop a value and set! symbol a, push ()
+    SET_LOCAL,          // pop a value and store it in slot a of the frame, push ()
+    SET_BOXED_LOCAL,    // pop a value and store it in the box in slot a, push ()
+    SET_BOXED_CAPTURE,  // pop a value and store it in the box in capture a, push ()
+    BIND,               // pop a value and store it in slot a of the frame
+    BOX,                // put the value in slot a of the frame in a box
+    EVAL,               // push the tree evaluation of constants[a]
+    RETURN,             // pop the result
+};
+
+struct Instruction {
+    OpCode op;
+    uint32_t a = 0, b = 0;
+    // Calls the instruction is nested in within its program. The VM enters as many levels of
+    // the depth budget as the tree walker would have entered there.
+    uint32_t depth = 0;
+};
+
+// A call compiled to opcodes is only valid while its head is still bound to the builtin
+// it was compiled for. Otherwise, if the VM evaluates its arguments into values of its own
+// and the name is bound to another function of evaluated arguments, the opcode of the call
+// applies that function instead; it evaluates the original call node in all other cases.
+struct Guard {
+    SymbolId id;
+    std::shared_ptr<Function> function;
+    std::shared_ptr<Object> node;
+    bool owns_args = false;
+};
+
+struct Program {
+    std::vector<Instruction> code;
+    std::vector<std::shared_ptr<Object>> constants;
+    std::vector<Guard> guards;
+    std::size_t version = 0;
+};
+
+// Compiles a tree produced by Analyze. Forms without a dedicated opcode are kept as nodes
+// and evaluated by the tree walker, so the result is always the same as Object::Eval.
+// Neither compilation nor execution recurses on the nesting of the expression.
+//
+// The lambdas in the tree, and the lets that make a frame of their own, get a program of
+// their own for their body, which runs whenever a closure made by the lambda is called.
+Program Compile(const std::shared_ptr<Object>& node, const std::shared_ptr<Scope>& scope);
+
+// Runs a program in the given scope: the global one, or the frame of the call or let the
+// program is the body of. Calls of closures run their bodies on the native stack, as the tree
+// walker does, so this is re-entered once per closure call in progress.
+std::shared_ptr<Object> Execute(const Program& program, const std::shared_ptr<Scope>& scope);
@@ -0,0 +1,333 @@
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
+#include <vector>
+
+#include <pthread.h>
+
+#include "analyzer.h"
+#include "bytecode.h"
+#include "closure.h"
+#include "error.h"
+
+namespace {
+
+// Slots are taken from chunks that hold the largest frame, so that a frame never moves once it
+// is taken.
+constexpr std::size_t kChunkSlots = kMaxFrameSize;
+
+// Calls of closures nest on the native stack, along with the expressions of their bodies.
+// Runs stop before the last quarter of the stack of the thread, or its last megabyte on
+// larger stacks, which is left to the builtins and the expressions between calls.
+constexpr std::size_t kStackReserveFraction = 4;
+constexpr std::size_t kMaxStackReserve = 1 << 20;
+
+// Used where the stack of the thread cannot be found: the size std::thread gets by default.
+constexpr std::size_t kDefaultStackSize = 8 << 20;
+
+struct SlotStack {
+    std::vector<std::unique_ptr<std::shared_ptr<Object>[]>> chunks;
+    // Index of the chunk in use and of its first free slot.
+    std::size_t chunk = 0, top = 0;
+};
+
+thread_local SlotStack slot_stack;
+
+// Lowest stack address a call may start at on this thread, found by its first call.
+thread_local std::uintptr_t stack_limit = 0;
+
+[[gnu::noinline]] std::uintptr_t FindStackLimit(std::uintptr_t address) {
+    pthread_attr_t attributes;
+    void* stack = nullptr;
+    std::size_t size = 0;
+    if (!pthread_getattr_np(pthread_self(), &attributes)) {
+        if (pthread_attr_getstack(&attributes, &stack, &size)) {
+            size = 0;
+        }
+        pthread_attr_destroy(&attributes);
+    }
+    auto begin = reinterpret_cast<std::uintptr_t>(stack);
+    if (!size || address < begin || address - begin > size) {
+        begin = address - std::min(address, kDefaultStackSize);
+        size = kDefaultStackSize;
+    }
+    return begin + std::min(size / kStackReserveFraction, kMaxStackReserve);
+}
+
+// Measures the stack left rather than counting calls, as the depth of the bodies in
+// between varies.
+void CheckStack() {
+    char marker;
+    auto address = reinterpret_cast<std::uintptr_t>(&marker);
+    if (!stack_limit) {
+        stack_limit = FindStackLimit(address);
+    }
+    if (address < stack_limit) {
+        throw RuntimeError("Too deep recursion");
+    }
+}
+
+// Arguments of the tail calls being evaluated on this thread, one range after another.
+thread_local std::vector<std::shared_ptr<Object>> tail_args;
+
+// The tail call whose arguments are the last range of tail_args, once they are evaluated.
+struct TailCallInfo {
+    Closure* closure = nullptr;
+    std::shared_ptr<Object> owner;
+    std::size_t begin = 0;
+};
+
+thread_local TailCallInfo pending_tail_call;
+
+// Returned by a body in place of a value when it ends in a tail call. Never escapes Run.
+const std::shared_ptr<Object>& TailCallMarker() {
+    static Box marker;
+    static const std::shared_ptr<Object> pointer(std::shared_ptr<Object>(), &marker);
+    return pointer;
+}
+
+// Drops the arguments from the given index on when it goes out of scope.
+class TailArgsGuard {
+public:
+    explicit TailArgsGuard(std::size_t begin) : begin_(begin) {
+    }
+
+    TailArgsGuard(const TailArgsGuard&) = delete;
+    TailArgsGuard& operator=(const TailArgsGuard&) = delete;
+
+    ~TailArgsGuard() {
+        tail_args.resize(begin_);
+    }
+
+private:
+    std::size_t begin_;
+};
+
+// Stores evaluated arguments in the parameter slots of a frame, the ones beyond the
+// parameters in a list if the lambda takes them. Move iterators move the arguments there.
+template <class It>
+void BindArgs(const Lambda& lambda, It begin, It end, std::shared_ptr<Object>* slots) {
+    auto param_count = lambda.GetParamCount();
+    auto count = static_cast<std::size_t>(end - begin);
+    if (count < param_count) {
+        throw RuntimeError("Not enough arguments");
+    }
+    if (count > param_count && !lambda.HasRest()) {
+        throw RuntimeError("Too many arguments");
+    }
+    std::copy(begin, begin + param_count, slots);
+    if (lambda.HasRest()) {
+        std::shared_ptr<Object> rest;
+        for (auto i = count; i-- > param_count;) {
+            auto cell = Allocate<Cell>(begin[i]);
+            cell->SetSecond(std::move(rest));
+            rest = std::move(cell);
+        }
+        slots[param_count] = std::move(rest);
+    }
+}
+
+// Value of the argument in the cell.
+std::shared_ptr<Object> EvalArg(const Cell* cell, const std::shared_ptr<Scope>& scope) {
+    const auto& arg = cell->GetFirst();
+    if (!arg) {
+        throw RuntimeError("Something wrong with list object : it is empty");
+    }
+    return EvalExpression(arg, scope);
+}
+
+// Cell of the next argument, if any.
+Cell* NextArg(const Cell* cell) {
+    const auto& next = cell->GetSecond();
+    if (next && !Is<Cell>(next)) {
+        throw RuntimeError("Something wrong with list object");
+    }
+    return Cast<Cell>(next);
+}
+
+// List of the values of the arguments from the cell on. Kept out of Closure::Apply, which
+// is on the stack once per nested call.
+[[gnu::noinline]] std::shared_ptr<Object> EvalRest(const Cell* cell,
+                                                   const std::shared_ptr<Scope>& scope) {
+    std::shared_ptr<Object> rest;
+    std::shared_ptr<Cell> last;
+    for (; cell; cell = NextArg(cell)) {
+        auto next = Allocate<Cell>(EvalArg(cell, scope));
+        if (last) {
+            last->SetSecond(next);
+        } else {
+            rest = next;
+        }
+        last = std::move(next);
+    }
+    return rest;
+}
+
+// Takes the frame over for the pending tail call and returns the closure it calls, which
+// the owner keeps alive if it is set. Kept out of Closure::Run for the same reason.
+[[gnu::noinline]] Closure* EnterTailCall(FrameSlots* slots, std::shared_ptr<Object>* owner) {
+    auto call = std::move(pending_tail_call);
+    TailArgsGuard guard(call.begin);
+    if (call.owner) {
+        *owner = std::move(call.owner);
+    }
+    const auto& lambda = call.closure->GetLambda();
+    slots->Reset(lambda.GetFrameSize());
+    auto begin = std::make_move_iterator(tail_args.begin() + call.begin);
+    BindArgs(lambda, begin, std::make_move_iterator(tail_args.end()), slots->Get());
+    return call.closure;
+}
+
+}  // namespace
+
+FrameSlots::FrameSlots(std::size_t count) {
+    Take(count);
+}
+
+FrameSlots::~FrameSlots() {
+    Release();
+}
+
+void FrameSlots::Reset(std::size_t count) {
+    Release();
+    Take(count);
+}
+
+void FrameSlots::Take(std::size_t count) {
+    auto& stack = slot_stack;
+    chunk_ = stack.chunk;
+    top_ = stack.top;
+    if (!count) {
+        return;
+    }
+    if (stack.chunks.empty() || stack.top + count > kChunkSlots) {
+        if (count > kChunkSlots) {
+            throw RuntimeError("Too many local variables");
+        }
+        if (!stack.chunks.empty()) {
+            ++stack.chunk;
+        }
+        if (stack.chunk == stack.chunks.size()) {
+            stack.chunks.push_back(std::make_unique<std::shared_ptr<Object>[]>(kChunkSlots));
+        }
+        stack.top = 0;
+    }
+    // Set only once the slots are taken, as Release clears that many.
+    slots_ = stack.chunks[stack.chunk].get() + stack.top;
+    count_ = count;
+    stack.top += count;
+}
+
+void FrameSlots::Release() {
+    // Cleared right away rather than when the slots are taken again, so that the values do
+    // not outlive the call.
+    std::fill(slots_, slots_ + count_, nullptr);
+    slot_stack.chunk = chunk_;
+    slot_stack.top = top_;
+    slots_ = nullptr;
+    count_ = 0;
+}
+
+Closure::Closure(std::shared_ptr<const Lambda> lambda, std::shared_ptr<Scope> global,
+                 Captures captures)
+    : Function(kType),
+      lambda_(std::move(lambda)),
+      global_(std::move(global)),
+      captures_(std::move(captures)) {
+}
+
+void Closure::MoveChildren(std::vector<std::shared_ptr<Object>>* children) {
+    for (auto& capture : captures_) {
+        if (capture) {
+            children->push_back(std::move(capture));
+        }
+    }
+}
+
+void Closure::GetChildren(std::vector<const std::shared_ptr<Object>*>* children) const {
+    for (const auto& capture : captures_) {
+        if (capture) {
+            children->push_back(&capture);
+        }
+    }
+}
+
+std::shared_ptr<Object> Closure::Apply(const std::shared_ptr<Scope>& scope,
+                                       const std::shared_ptr<Object>& args) {
+    const auto& lambda = *lambda_;
+    auto param_count = lambda.GetParamCount();
+    FrameSlots slots(lambda.GetFrameSize());
+    auto* values = slots.Get();
+    auto cell = Is<Cell>(args) ? Cast<Cell>(args) : nullptr;
+    std::size_t count = 0;
+    for (; cell && count < param_count; cell = NextArg(cell)) {
+        values[count++] = EvalArg(cell, scope);
+    }
+    if (count < param_count) {
+        throw RuntimeError("Not enough arguments");
+    }
+    if (lambda.HasRest()) {
+        values[param_count] = EvalRest(cell, scope);
+    } else if (cell) {
+        throw RuntimeError("Too many arguments");
+    }
+    return Run(&slots);
+}
+
+std::shared_ptr<Object> Closure::Invoke(std::span<const std::shared_ptr<Object>> args) {
+    FrameSlots slots(lambda_->GetFrameSize());
+    BindArgs(*lambda_, args.begin(), args.end(), slots.Get());
+    return Run(&slots);
+}
+
+std::shared_ptr<Object> Closure::Call(std::span<std::shared_ptr<Object>> args) {
+    FrameSlots slots(lambda_->GetFrameSize());
+    BindArgs(*lambda_, std::make_move_iterator(args.begin()), std::make_move_iterator(args.end()),
+             slots.Get());
+    return Run(&slots);
+}
+
+std::shared_ptr<Object> Closure::TailCall(Closure* closure, std::shared_ptr<Object> owner,
+                                          const std::shared_ptr<Scope>& scope,
+                                          const std::shared_ptr<Object>& args) {
+    auto begin = tail_args.size();
+    try {
+        for (auto cell = Is<Cell>(args) ? Cast<Cell>(args) : nullptr; cell; cell = NextArg(cell)) {
+            // Evaluated into a local first: nested tail calls may reallocate the vector.
+            auto value = EvalArg(cell, scope);
+            tail_args.push_back(std::move(value));
+        }
+    } catch (...) {
+        tail_args.resize(begin);
+        throw;
+    }
+    pending_tail_call = {closure, std::move(owner), begin};
+    return TailCallMarker();
+}
+
+std::shared_ptr<Object> Closure::TailCall(Closure* closure, std::shared_ptr<Object> owner,
+                                          std::span<std::shared_ptr<Object>> args) {
+    auto begin = tail_args.size();
+    tail_args.insert(tail_args.end(), std::make_move_iterator(args.begin()),
+                     std::make_move_iterator(args.end()));
+    pending_tail_call = {closure, std::move(owner), begin};
+    return TailCallMarker();
+}
+
+std::shared_ptr<Object> Closure::Run(FrameSlots* slots) {
+    CheckStack();
+    Closure* closure = this;
+    // Keeps the closure running alive once it is one reached by a tail call.
+    std::shared_ptr<Object> owner;
+    while (true) {
+        Scope frame(closure->global_.get(), slots->Get(), closure, closure->captures_.data());
+        const auto& lambda = *closure->lambda_;
+        auto program = lambda.GetProgram();
+        auto result = program ? Execute(*program, FramePointer(&frame))
+                              : lambda.GetBody().Eval(FramePointer(&frame));
+        if (result.get() != TailCallMarker().get()) {
+            return result;
+        }
+        closure = EnterTailCall(slots, &owner);
+    }
+}
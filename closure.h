@@ -0,0 +1,152 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <span>
+#include <vector>
+
+#include "heap.h"
+#include "object.h"
+#include "parallel_task.h"
+#include "scheme.h"
+
+class Lambda;
+
+// Variable shared between a frame and the closures that capture it, for variables assigned
+// after they may have been captured. Lives in slots and captures only; it is never a value.
+class Box : public Object {
+public:
+    static constexpr Type kType = Type::BOX;
+
+    // A box holding a closure that captures it is a cycle.
+    static constexpr bool kMayFormCycles = true;
+
+    explicit Box(std::shared_ptr<Object> value = nullptr)
+        : Object(kType), value_(std::move(value)) {
+    }
+
+    ~Box() override {
+        DestroyChildren(this);
+    }
+
+    void MoveChildren(std::vector<std::shared_ptr<Object>>* children) override {
+        if (value_) {
+            children->push_back(std::move(value_));
+        }
+    }
+
+    void GetChildren(std::vector<const std::shared_ptr<Object>*>* children) const override {
+        if (value_) {
+            children->push_back(&value_);
+        }
+    }
+
+    const std::shared_ptr<Object>& Get() const {
+        return value_;
+    }
+
+    void Set(std::shared_ptr<Object> value) {
+        ParallelTask::CheckChange(owner_);
+        value_ = std::move(value);
+    }
+
+    std::shared_ptr<Object> Eval(std::shared_ptr<Scope> scope) override {
+        throw RuntimeError("Cannot eval box");
+    }
+
+private:
+    std::shared_ptr<Object> value_;
+    uint64_t owner_ = ParallelTask::Current();
+};
+
+// Slots of one activation frame. Frames end in the reverse order they start, and closures
+// copy what they capture instead of referring to the frame, so the slots come from a stack
+// kept per thread and are reused by the next call as soon as this one returns.
+class FrameSlots {
+public:
+    explicit FrameSlots(std::size_t count);
+
+    FrameSlots(const FrameSlots&) = delete;
+    FrameSlots& operator=(const FrameSlots&) = delete;
+
+    ~FrameSlots();
+
+    std::shared_ptr<Object>* Get() const {
+        return slots_;
+    }
+
+    // Clears the slots and takes count new ones in their place. Only valid while no frame
+    // started after this one is still running.
+    void Reset(std::size_t count);
+
+private:
+    void Take(std::size_t count);
+
+    void Release();
+
+    std::shared_ptr<Object>* slots_ = nullptr;
+    std::size_t count_ = 0;
+    std::size_t chunk_, top_;
+};
+
+// Function made by evaluating a lambda. The values of its free variables are copied into a
+// flat array when it is made; every call runs the body in a new frame of the size the
+// analyzer computed. Calls in tail position of the body reuse the frame instead of nesting,
+// so loops written as recursion run in constant space.
+class Closure : public Function, public std::enable_shared_from_this<Closure> {
+public:
+    static constexpr Type kType = Type::CLOSURE;
+
+    using Captures = std::vector<std::shared_ptr<Object>, HeapAllocator<std::shared_ptr<Object>>>;
+
+    Closure(std::shared_ptr<const Lambda> lambda, std::shared_ptr<Scope> global,
+            Captures captures);
+
+    ~Closure() override {
+        DestroyChildren(this);
+    }
+
+    void MoveChildren(std::vector<std::shared_ptr<Object>>* children) override;
+
+    void GetChildren(std::vector<const std::shared_ptr<Object>*>* children) const override;
+
+    std::shared_ptr<Object> Apply(const std::shared_ptr<Scope>& scope,
+                                  const std::shared_ptr<Object>& args) override;
+
+    std::shared_ptr<Object> Invoke(std::span<const std::shared_ptr<Object>> args) override;
+
+    // Invoke for arguments the caller has no further use for: they are moved into the frame.
+    std::shared_ptr<Object> Call(std::span<std::shared_ptr<Object>> args);
+
+    const Lambda& GetLambda() const {
+        return *lambda_;
+    }
+
+    const Captures& GetCaptures() const {
+        return captures_;
+    }
+
+    // Call in tail position of a body: evaluates the arguments, then returns a marker that
+    // makes the closure running on this thread call the given one in place of the current
+    // frame. The owner keeps the closure alive; it may be null for the running closure.
+    static std::shared_ptr<Object> TailCall(Closure* closure, std::shared_ptr<Object> owner,
+                                            const std::shared_ptr<Scope>& scope,
+                                            const std::shared_ptr<Object>& args);
+
+    // Same, for arguments evaluated already, which are moved from.
+    static std::shared_ptr<Object> TailCall(Closure* closure, std::shared_ptr<Object> owner,
+                                            std::span<std::shared_ptr<Object>> args);
+
+private:
+    std::shared_ptr<Object> Run(FrameSlots* slots);
+
+    std::shared_ptr<const Lambda> lambda_;
+    std::shared_ptr<Scope> global_;
+    Captures captures_;
+};
+
+// Frames live on the stack of the call they belong to; nodes take scopes by shared pointer, so
+// they get one that does not own the frame.
+inline std::shared_ptr<Scope> FramePointer(Scope* frame) {
+    return std::shared_ptr<Scope>(std::shared_ptr<Scope>(), frame);
+}
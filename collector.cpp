@@ -0,0 +1,224 @@
+#include <algorithm>
+#include <unordered_map>
+
+#include "collector.h"
+#include "object.h"
+
+namespace {
+
+// Fewer tracked objects than this are never worth a collection.
+constexpr std::size_t kMinThreshold = 4096;
+
+// A collection examining n objects is followed by at least n / kExaminedPerObject tracked
+// objects before the next one.
+constexpr std::size_t kExaminedPerObject = 4;
+
+// Objects that hold references to objects that may hold references in turn. Everything
+// else is a leaf to the collector, which makes it keep more, never less.
+bool MayHoldReferences(const Object* object) {
+    switch (GetType(object)) {
+        case Type::CELL:
+        case Type::VECTOR:
+        case Type::BOX:
+        case Type::CLOSURE:
+            return true;
+        default:
+            return false;
+    }
+}
+
+class Collector {
+public:
+    Collector() {
+        PrepareDestroyChildren();
+    }
+
+    ~Collector() {
+        // What is left is garbage of the thread once it exits.
+        if (!paused) {
+            Collect();
+        }
+    }
+
+    void Track(std::weak_ptr<Object> object) {
+        tracked_.push_back(std::move(object));
+        if (tracked_.size() >= threshold_ && !paused) {
+            Prune();
+            if (tracked_.size() >= threshold_) {
+                Collect();
+            }
+            threshold_ = std::max({kMinThreshold, 2 * tracked_.size(),
+                                   last_examined_ / kExaminedPerObject});
+        }
+    }
+
+    // Trial deletion: an object referenced more often than by the other objects examined
+    // is referenced from outside of them, by a variable, a frame or the stack of the
+    // evaluator, and is kept along with everything it reaches. The rest is garbage.
+    void Collect();
+
+    const CollectorStats& GetStats() const {
+        return stats_;
+    }
+
+    // Collections wait while this is not zero.
+    std::size_t paused = 0;
+
+private:
+    struct Node {
+        // A reference to the object, which tells how many there are.
+        const std::shared_ptr<Object>* reference;
+        bool is_tracked;
+        bool is_reachable;
+        std::size_t internal_references;
+    };
+
+    void Prune() {
+        std::erase_if(tracked_, [](const auto& object) { return object.expired(); });
+    }
+
+    std::vector<std::weak_ptr<Object>> tracked_;
+    std::size_t threshold_ = kMinThreshold;
+    std::size_t last_examined_ = 0;
+    CollectorStats stats_;
+};
+
+void Collector::Collect() {
+    std::vector<std::shared_ptr<Object>> roots;
+    for (const auto& object : tracked_) {
+        if (auto root = object.lock()) {
+            roots.push_back(std::move(root));
+        }
+    }
+
+    // Counts the references between the objects reachable from the tracked ones. Nothing
+    // may copy a reference until the counts are read.
+    std::unordered_map<Object*, Node> nodes;
+    std::vector<Object*> stack;
+    for (const auto& root : roots) {
+        if (nodes.try_emplace(root.get(), Node{&root, true, false, 0}).second) {
+            stack.push_back(root.get());
+        }
+    }
+    std::vector<const std::shared_ptr<Object>*> children;
+    while (!stack.empty()) {
+        auto object = stack.back();
+        stack.pop_back();
+        children.clear();
+        object->GetChildren(&children);
+        for (auto child : children) {
+            if (!MayHoldReferences(child->get())) {
+                continue;
+            }
+            auto [it, inserted] = nodes.try_emplace(child->get(), Node{child, false, false, 0});
+            ++it->second.internal_references;
+            if (inserted) {
+                stack.push_back(child->get());
+            }
+        }
+    }
+
+    for (auto& [object, node] : nodes) {
+        if (node.is_reachable) {
+            continue;
+        }
+        // Tracked objects are also referenced from roots.
+        auto count = static_cast<std::size_t>(node.reference->use_count()) - node.is_tracked;
+        if (count == node.internal_references) {
+            continue;
+        }
+        node.is_reachable = true;
+        stack.push_back(object);
+        while (!stack.empty()) {
+            auto reachable = stack.back();
+            stack.pop_back();
+            children.clear();
+            reachable->GetChildren(&children);
+            for (auto child : children) {
+                auto it = nodes.find(child->get());
+                if (it != nodes.end() && !it->second.is_reachable) {
+                    it->second.is_reachable = true;
+                    stack.push_back(child->get());
+                }
+            }
+        }
+    }
+
+    std::vector<std::shared_ptr<Object>> garbage;
+    for (const auto& [object, node] : nodes) {
+        if (!node.is_reachable) {
+            garbage.push_back(*node.reference);
+        }
+    }
+    ++stats_.collections;
+    stats_.examined += nodes.size();
+    last_examined_ = nodes.size();
+    stats_.collected += garbage.size();
+    nodes.clear();
+    roots.clear();
+
+    // Holding every garbage object while their references are moved out keeps them from
+    // being destroyed while others still point at them.
+    std::vector<std::shared_ptr<Object>> released;
+    for (const auto& object : garbage) {
+        object->MoveChildren(&released);
+    }
+    released.clear();
+    garbage.clear();
+    Prune();
+    stats_.tracked = tracked_.size();
+}
+
+thread_local Collector collector;
+
+// Region the objects tracked on this thread go to, if any.
+thread_local CollectorRegion* target_region = nullptr;
+
+}  // namespace
+
+void TrackForCollection(const std::shared_ptr<Object>& object) {
+    if (auto region = target_region) {
+        std::lock_guard lock(region->mutex_);
+        region->tracked_.push_back(object);
+    } else {
+        collector.Track(object);
+    }
+}
+
+void CollectCycles() {
+    if (!collector.paused) {
+        collector.Collect();
+    }
+}
+
+const CollectorStats& GetCollectorStats() {
+    return collector.GetStats();
+}
+
+CollectorRegion::CollectorRegion() {
+    ++collector.paused;
+}
+
+CollectorRegion::~CollectorRegion() {
+    --collector.paused;
+    for (auto& object : tracked_) {
+        if (!object.expired()) {
+            if (auto region = target_region) {
+                std::lock_guard lock(region->mutex_);
+                region->tracked_.push_back(std::move(object));
+            } else {
+                collector.Track(std::move(object));
+            }
+        }
+    }
+}
+
+CollectorTask::CollectorTask(CollectorRegion* region) : previous_(target_region) {
+    target_region = region;
+    ++collector.paused;
+}
+
+CollectorTask::~CollectorTask() {
+    --collector.paused;
+    target_region = previous_;
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+class Object;
+
+// Objects are owned by shared_ptr and freed by reference counting, which frees everything
+// but cycles. Every copy of a reference updates an atomic count, except for immediates and
+// booleans, which own nothing.
+//
+// There is deliberately no tracing collector. Marking needs every object a C++ frame holds
+// across an allocation registered as a root: the locals of the tree walker, the stack of
+// the VM, the arguments of every builtin, the parser, the analyzer and the image loader,
+// and a way to stop the threads of parallel builtins that share objects. Embedders also
+// keep shared_ptr values returned by Interpreter. Reference counting needs none of that,
+// and this collector only has to find cycles.
+//
+// Cycles can only be made through the objects that may be changed after they are made,
+// which are tracked by the thread that makes them: vectors, and boxes. Pairs cannot be
+// changed, and closures copy what they capture when they are made, so a closure that
+// refers to itself does so through a box. Globals are not objects; a closure held by a
+// global refers to the global scope, and that cycle is broken when the interpreter clears
+// its scope on destruction.
+//
+// Every so often, the thread looks for the tracked objects, and the objects reachable from
+// them, that are only referenced from each other, and breaks their references, which
+// frees them. Collections run when the number of tracked objects still alive has doubled
+// since the last one, and when the thread exits. As a collection looks at everything
+// reachable from the tracked objects, the next one also waits until the number of tracked
+// objects reaches a fraction of what it looked at.
+struct CollectorStats {
+    std::size_t collections = 0;
+    // Objects looked at by the collections, and those of them found to be garbage.
+    std::size_t examined = 0;
+    std::size_t collected = 0;
+    // Tracked objects still alive after the last collection.
+    std::size_t tracked = 0;
+};
+
+// Collects the garbage among the objects tracked by this thread right away, unless this
+// thread runs a task of a parallel builtin or waits for one. For embedders that just
+// destroyed an interpreter whose globals held cycles.
+void CollectCycles();
+
+const CollectorStats& GetCollectorStats();
+
+// Objects made by the tasks of a parallel builtin, which are handed to the thread that
+// started it when the builtin ends. Until then it does not collect, as the objects it
+// tracks may be used on other threads.
+class CollectorRegion {
+public:
+    CollectorRegion();
+
+    CollectorRegion(const CollectorRegion&) = delete;
+    CollectorRegion& operator=(const CollectorRegion&) = delete;
+
+    ~CollectorRegion();
+
+private:
+    std::mutex mutex_;
+    std::vector<std::weak_ptr<Object>> tracked_;
+
+    friend class CollectorTask;
+    friend void TrackForCollection(const std::shared_ptr<Object>& object);
+};
+
+// Makes the objects tracked on this thread for the lifetime of the object go to the region.
+class CollectorTask {
+public:
+    explicit CollectorTask(CollectorRegion* region);
+
+    CollectorTask(const CollectorTask&) = delete;
+    CollectorTask& operator=(const CollectorTask&) = delete;
+
+    ~CollectorTask();
+
+private:
+    CollectorRegion* previous_;
+};
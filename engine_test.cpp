@@ -0,0 +1,119 @@
+#include <exception>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "scheme.h"
+
+// Programs whose arguments have side effects and fail type checks, run on both engines.
+// Each expression of a program runs on its own, so the ones after an error still show what
+// the failed call changed. The engines must agree with each other and with the expected
+// output. Exits with a non-zero status if any case fails.
+//
+//   scheme_engine_test
+
+namespace {
+
+struct Case {
+    std::string name;
+    std::vector<std::string> expressions;
+    // Output of each expression, or its error.
+    std::vector<std::string> expected;
+};
+
+const std::string kBadType = "error: Get unexpected type";
+const std::string kBadArgument = "error: Expected other as an argument";
+
+std::vector<Case> MakeCases() {
+    std::vector<Case> cases = {
+        {"vector-set! after a boolean",
+         {"(define v (make-vector 1 0))", "(+ #t (vector-set! v 0 1))", "v"},
+         {"()", kBadType, "#(1)"}},
+        {"set! after a boolean in a comparison",
+         {"(define x 0)", "(< #t (set! x 5))", "x"},
+         {"()", kBadType, "5"}},
+        {"call after a symbol",
+         {"(define x 0)", "(define (f) (set! x 9) 1)", "(* 'a (f))", "x"},
+         {"()", "()", kBadType, "9"}},
+        {"error in a later argument comes first",
+         {"(+ #t (car 5))"},
+         {kBadArgument}},
+        {"division by zero before a bad type",
+         {"(define x 0)", "(/ 1 0 (set! x 1) #t)", "x"},
+         {"()", "error: Division by zero", "1"}},
+        {"every argument runs before the check",
+         {"(define x 0)", "(- (set! x (+ x 1)) #f (set! x (+ x 10)))", "x"},
+         {"()", kBadType, "11"}},
+    };
+    // Every folding builtin, with a bad first argument and a side effect after it.
+    for (std::string name : {"+", "-", "*", "/", "=", "<", ">", "<=", ">=", "min", "max"}) {
+        for (std::string bad : {"#t", "'a", "'()", "(list 1)"}) {
+            cases.push_back({"(" + name + " " + bad + " ...)",
+                             {"(define x 0)", "(" + name + " " + bad + " (set! x 1) 2)", "x"},
+                             {"()", "", "1"}});
+        }
+    }
+    return cases;
+}
+
+std::vector<std::string> RunProgram(const Case& test, Engine engine) {
+    Interpreter interpreter;
+    interpreter.SetEngine(engine);
+    std::vector<std::string> output;
+    for (const auto& expression : test.expressions) {
+        try {
+            output.push_back(interpreter.Run(expression));
+        } catch (const std::exception& e) {
+            output.push_back(std::string("error: ") + e.what());
+        }
+    }
+    return output;
+}
+
+// An empty expected line only requires the engines to agree on an error.
+bool Matches(const std::vector<std::string>& output, const std::vector<std::string>& expected) {
+    if (output.size() != expected.size()) {
+        return false;
+    }
+    for (std::size_t i = 0; i < output.size(); ++i) {
+        if (expected[i].empty() ? !output[i].starts_with("error: ") : output[i] != expected[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+std::string Join(const std::vector<std::string>& lines) {
+    std::string result;
+    for (const auto& line : lines) {
+        result += (result.empty() ? "" : " | ") + line;
+    }
+    return result;
+}
+
+bool RunCase(const Case& test) {
+    auto tree = RunProgram(test, Engine::TREE);
+    auto bytecode = RunProgram(test, Engine::BYTECODE);
+    if (tree != bytecode) {
+        std::cerr << "FAIL " << test.name << ": tree gave " << Join(tree) << ", bytecode gave "
+                  << Join(bytecode) << std::endl;
+        return false;
+    }
+    if (!Matches(tree, test.expected)) {
+        std::cerr << "FAIL " << test.name << ": got " << Join(tree) << ", expected "
+                  << Join(test.expected) << std::endl;
+        return false;
+    }
+    std::cout << "ok   " << test.name << std::endl;
+    return true;
+}
+
+}  // namespace
+
+int main() {
+    auto failures = 0;
+    for (const auto& test : MakeCases()) {
+        failures += !RunCase(test);
+    }
+    return failures ? 1 : 0;
+}
@@ -12,4 +12,9 @@ struct RuntimeError : public std::runtime_error {
 
 struct NameError : public std::runtime_error {
     using std::runtime_error::runtime_error;
+};
+
+// Thrown when a run exceeds one of the limits given to Interpreter::SetLimits.
+struct ResourceLimitError : public std::runtime_error {
+    using std::runtime_error::runtime_error;
 };
\ No newline at end of file
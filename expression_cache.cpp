@@ -0,0 +1,37 @@
+#include "expression_cache.h"
+
+void ExpressionCache::SetCapacity(std::size_t capacity) {
+    capacity_ = capacity;
+    Trim();
+}
+
+CachedExpression* ExpressionCache::Find(std::string_view source) {
+    auto it = index_.find(source);
+    if (it == index_.end()) {
+        ++misses_;
+        return nullptr;
+    }
+    ++hits_;
+    entries_.splice(entries_.begin(), entries_, it->second);
+    return &it->second->second;
+}
+
+CachedExpression* ExpressionCache::Insert(std::string source, std::shared_ptr<Object> parsed) {
+    if (auto it = index_.find(source); it != index_.end()) {
+        entries_.splice(entries_.begin(), entries_, it->second);
+        it->second->second = CachedExpression(std::move(parsed));
+        return &it->second->second;
+    }
+    entries_.emplace_front(std::move(source), CachedExpression(std::move(parsed)));
+    index_.emplace(entries_.front().first, entries_.begin());
+    // Makes room after adding, so that the new entry is never the one evicted.
+    Trim();
+    return &entries_.front().second;
+}
+
+void ExpressionCache::Trim() {
+    while (index_.size() > capacity_) {
+        index_.erase(entries_.back().first);
+        entries_.pop_back();
+    }
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstddef>
+#include <list>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "bytecode.h"
+#include "object.h"
+
+// A global name analysis looked up as the head of a form, and what it was bound to then.
+struct GlobalUse {
+    SymbolId id;
+    bool is_bound;
+    std::shared_ptr<Object> value;
+};
+
+// What is known about one source text passed to Interpreter::Run. Nothing here is modified
+// by evaluation, so the trees can be run again any number of times.
+struct CachedExpression {
+    explicit CachedExpression(std::shared_ptr<Object> parsed) : parsed(std::move(parsed)) {
+    }
+
+    std::shared_ptr<Object> parsed;
+    // Set once analysis against the interpreter's global scope has succeeded. Both this
+    // tree and the compiled program check the heads of their calls before using anything
+    // resolved during analysis.
+    std::optional<std::shared_ptr<Object>> analyzed;
+    std::size_t depth = 0;
+    // The names the analyzed tree was built from, as bound at the time of analysis.
+    std::vector<GlobalUse> globals;
+    // Global version when the globals were last found bound as recorded.
+    std::size_t version = 0;
+    // Set once the expression has run on the VM.
+    std::optional<Program> compiled;
+};
+
+// Bounded cache of expressions keyed by their full source text, evicting the least recently
+// used one when full.
+class ExpressionCache {
+public:
+    // Zero disables the cache and drops every entry.
+    void SetCapacity(std::size_t capacity);
+
+    std::size_t GetCapacity() const {
+        return capacity_;
+    }
+
+    std::size_t GetSize() const {
+        return index_.size();
+    }
+
+    std::size_t GetHits() const {
+        return hits_;
+    }
+
+    std::size_t GetMisses() const {
+        return misses_;
+    }
+
+    // Entry for the source, if any; counts a hit or a miss. The pointer stays valid until
+    // the next Insert or SetCapacity.
+    CachedExpression* Find(std::string_view source);
+
+    // Only valid with a nonzero capacity.
+    CachedExpression* Insert(std::string source, std::shared_ptr<Object> parsed);
+
+private:
+    using Entry = std::pair<const std::string, CachedExpression>;
+
+    void Trim();
+
+    std::size_t capacity_ = 0;
+    // Most recently used first.
+    std::list<Entry> entries_;
+    // Keys are views of the sources stored in the entries.
+    std::unordered_map<std::string_view, std::list<Entry>::iterator> index_;
+    std::size_t hits_ = 0, misses_ = 0;
+};
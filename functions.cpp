@@ -1,41 +1,114 @@
+#include <algorithm>
+#include <array>
+#include <exception>
+#include <iterator>
+#include <new>
+#include <optional>
+#include <span>
 #include <vector>
 
+#include "analyzer.h"
+#include "budget.h"
+#include "collector.h"
 #include "functions.h"
+#include "numeric_kernels.h"
 #include "object.h"
+#include "parallel_task.h"
 #include "scheme.h"
+#include "task_scheduler.h"
 
 std::vector<std::shared_ptr<Object>> GetArgsList(const std::shared_ptr<Object>& obj) {
     if (!obj) {
         return {};
     }
 
-    auto current_obj = As<Cell>(obj);
     std::vector<std::shared_ptr<Object>> list;
-    while (current_obj) {
+    for (auto current_obj = Is<Cell>(obj) ? Cast<Cell>(obj) : nullptr; current_obj;) {
         list.push_back(current_obj->GetFirst());
-        auto next_obj = current_obj->GetSecond();
+        const auto& next_obj = current_obj->GetSecond();
 
         if (next_obj && !Is<Cell>(next_obj)) {
             throw RuntimeError("Something wrong with list object");
         }
-        current_obj = As<Cell>(next_obj);
+        current_obj = Cast<Cell>(next_obj);
     }
+    SpendSteps(list.size());
     return list;
 }
 
-std::vector<std::shared_ptr<Object>> EvalArgsList(const std::shared_ptr<Scope>& scope,
-                                                  std::shared_ptr<Object>& obj) {
-    auto args = GetArgsList(obj);
-    std::vector<std::shared_ptr<Object>> eval;
-    for (auto& arg : args) {
+// Evaluates the arguments of a call in order, passing each value to the callback as soon as
+// it is computed.
+template <typename Callback>
+void ForEachEvaluatedArg(const std::shared_ptr<Scope>& scope, const std::shared_ptr<Object>& obj,
+                         Callback callback) {
+    if (!Is<Cell>(obj)) {
+        return;
+    }
+    for (auto cell = Cast<Cell>(obj); cell;) {
+        const auto& arg = cell->GetFirst();
         if (!arg) {
             throw RuntimeError("Something wrong with list object : it is empty");
         }
-        eval.push_back(arg->Eval(scope));
+        callback(EvalExpression(arg, scope));
+        const auto& next = cell->GetSecond();
+        if (next && !Is<Cell>(next)) {
+            throw RuntimeError("Something wrong with list object");
+        }
+        cell = Cast<Cell>(next);
     }
-    return eval;
 }
 
+// Evaluated arguments of one call. Calls with a handful of arguments, which are nearly all
+// of them, keep the values inline on the caller's stack.
+class ArgumentBuffer {
+public:
+    ArgumentBuffer() = default;
+
+    ArgumentBuffer(const ArgumentBuffer&) = delete;
+    ArgumentBuffer& operator=(const ArgumentBuffer&) = delete;
+
+    void PushBack(std::shared_ptr<Object> value) {
+        if (size_ < kInlineSize) {
+            inline_[size_++] = std::move(value);
+            return;
+        }
+        if (spilled_.empty()) {
+            spilled_.reserve(2 * kInlineSize);
+            std::move(inline_.begin(), inline_.end(), std::back_inserter(spilled_));
+        }
+        spilled_.push_back(std::move(value));
+        ++size_;
+    }
+
+    std::span<const std::shared_ptr<Object>> GetArgs() const {
+        if (size_ <= kInlineSize) {
+            return {inline_.data(), size_};
+        }
+        return spilled_;
+    }
+
+private:
+    static constexpr std::size_t kInlineSize = 8;
+
+    std::array<std::shared_ptr<Object>, kInlineSize> inline_;
+    std::vector<std::shared_ptr<Object>> spilled_;
+    std::size_t size_ = 0;
+};
+
+// Function that evaluates all of its arguments before running. The tree walker goes
+// through Apply; the VM calls Invoke directly on its stack slots.
+class Procedure : public Function {
+public:
+    std::shared_ptr<Object> Apply(const std::shared_ptr<Scope>& scope,
+                                  const std::shared_ptr<Object>& obj) override {
+        ArgumentBuffer args;
+        ForEachEvaluatedArg(scope, obj, [&args](std::shared_ptr<Object> value) {
+            args.PushBack(std::move(value));
+        });
+        return Invoke(args.GetArgs());
+    }
+};
+
 template <typename ExpectedType, std::size_t ExpectedCount = 0, typename It>
 void ValidateArgs(It begin, It end) {
     std::size_t count = end - begin;
@@ -51,15 +124,17 @@ void ValidateArgs(It begin, It end) {
 }
 
 template <typename ExpectedType>
-class IsExpectedType : public Function {
+class IsExpectedType : public Procedure {
 public:
-    std::shared_ptr<Object> Apply(std::shared_ptr<Scope> scope,
-                                  std::shared_ptr<Object> obj) override {
-        auto list = EvalArgsList(scope, obj);
+    bool IsPure() const override {
+        return true;
+    }
+
+    std::shared_ptr<Object> Invoke(std::span<const std::shared_ptr<Object>> list) override {
         if (list.size() != 1) {
             throw RuntimeError("Expected one argument");
         }
-        return std::make_shared<Boolean>(Is<ExpectedType>(list.front()));
+        return Boolean::Make(Is<ExpectedType>(list.front()));
     }
 };
 
@@ -68,153 +143,451 @@ using IsBoolean = IsExpectedType<Boolean>;
 using IsPair = IsExpectedType<Cell>;
 using IsSymbol = IsExpectedType<Symbol>;
 
-class IsNull : public Function {
+class IsNull : public Procedure {
 public:
-    std::shared_ptr<Object> Apply(std::shared_ptr<Scope> scope,
-                                  std::shared_ptr<Object> obj) override {
-        auto list = EvalArgsList(scope, obj);
+    bool IsPure() const override {
+        return true;
+    }
+
+    std::shared_ptr<Object> Invoke(std::span<const std::shared_ptr<Object>> list) override {
         if (list.size() != 1) {
             throw RuntimeError("Expected one argument");
         }
-        return std::make_shared<Boolean>(!list.front());
+        return Boolean::Make(!list.front());
     }
 };
 
-bool IsListImpl(std::shared_ptr<Object> head) {
-    while (Is<Cell>(head)) {
-        head = As<Cell>(head)->GetSecond();
+bool IsListImpl(const std::shared_ptr<Object>& head) {
+    auto current = head.get();
+    std::size_t cells = 0;
+    while (current && GetType(current) == Type::CELL) {
+        current = static_cast<Cell*>(current)->GetSecond().get();
+        ++cells;
     }
-    return !head;
+    SpendSteps(cells);
+    return !current;
 }
 
-class IsList : public Function {
+class IsList : public Procedure {
 public:
-    std::shared_ptr<Object> Apply(std::shared_ptr<Scope> scope,
-                                  std::shared_ptr<Object> obj) override {
-        auto list = EvalArgsList(scope, obj);
+    bool IsPure() const override {
+        return true;
+    }
+
+    std::shared_ptr<Object> Invoke(std::span<const std::shared_ptr<Object>> list) override {
         if (list.size() != 1) {
             throw RuntimeError("Expected one argument");
         }
-        return std::make_shared<Boolean>(IsListImpl(list.front()));
+        return Boolean::Make(IsListImpl(list.front()));
+    }
+};
+
+NumberValue GetNumber(const std::shared_ptr<Object>& value) {
+    if (!Is<Number>(value)) {
+        throw RuntimeError("Get unexpected type");
+    }
+    return NumberValue(value);
+}
+
+// Arithmetic kernels. Small computes on int64_t and fails on overflow; Big gives the exact
+// result once an operand or the running result does not fit in int64_t.
+
+struct Plus {
+    static bool Small(int64_t a, int64_t b, int64_t* result) {
+        return !__builtin_add_overflow(a, b, result);
+    }
+
+    static BigInt Big(const BigInt& a, const BigInt& b) {
+        return a + b;
+    }
+};
+
+struct Minus {
+    static bool Small(int64_t a, int64_t b, int64_t* result) {
+        return !__builtin_sub_overflow(a, b, result);
+    }
+
+    static BigInt Big(const BigInt& a, const BigInt& b) {
+        return a - b;
+    }
+};
+
+struct Times {
+    static bool Small(int64_t a, int64_t b, int64_t* result) {
+        return !__builtin_mul_overflow(a, b, result);
+    }
+
+    static BigInt Big(const BigInt& a, const BigInt& b) {
+        return a * b;
+    }
+};
+
+struct Quotient {
+    static bool Small(int64_t a, int64_t b, int64_t* result) {
+        if (b == 0) {
+            throw RuntimeError("Division by zero");
+        }
+        if (a == INT64_MIN && b == -1) {
+            return false;
+        }
+        *result = a / b;
+        return true;
+    }
+
+    static BigInt Big(const BigInt& a, const BigInt& b) {
+        if (b.IsZero()) {
+            throw RuntimeError("Division by zero");
+        }
+        return a / b;
+    }
+};
+
+struct Minimum {
+    static bool Small(int64_t a, int64_t b, int64_t* result) {
+        *result = std::min(a, b);
+        return true;
+    }
+
+    static BigInt Big(const BigInt& a, const BigInt& b) {
+        return std::min(a, b);
+    }
+};
+
+struct Maximum {
+    static bool Small(int64_t a, int64_t b, int64_t* result) {
+        *result = std::max(a, b);
+        return true;
+    }
+
+    static BigInt Big(const BigInt& a, const BigInt& b) {
+        return std::max(a, b);
+    }
+};
+
+// Running result of a fold. It stays an int64_t until an operation overflows.
+class Accumulator {
+public:
+    explicit Accumulator(int64_t value) : small_(value) {
+    }
+
+    explicit Accumulator(const NumberValue& number) : small_(number.GetValue()) {
+        if (number.IsBig()) {
+            big_ = number.GetBig();
+        }
     }
+
+    template <typename Kernel>
+    void Apply(const NumberValue& operand) {
+        if (!big_ && !operand.IsBig()) [[likely]] {
+            int64_t result;
+            if (Kernel::Small(small_, operand.GetValue(), &result)) [[likely]] {
+                small_ = result;
+                return;
+            }
+        }
+        auto lhs = big_ ? std::move(*big_) : BigInt(small_);
+        big_ = operand.IsBig() ? Kernel::Big(lhs, operand.GetBig())
+                               : Kernel::Big(lhs, BigInt(operand.GetValue()));
+    }
+
+    std::shared_ptr<Object> GetResult() {
+        return big_ ? Number::Make(std::move(*big_)) : Number::Make(small_);
+    }
+
+private:
+    int64_t small_;
+    std::optional<BigInt> big_;
 };
 
-template <typename T, typename It, typename BinaryFunction>
-int64_t Fold(It begin, It end, int64_t in, BinaryFunction f) {
+// Checks the type of each argument just before folding it.
+template <typename Kernel, typename It>
+std::shared_ptr<Object> Fold(It begin, It end, Accumulator in) {
     while (begin != end) {
-        auto value = As<T>(*begin)->GetValue();
-        in = f(in, value);
+        in.Apply<Kernel>(GetNumber(*begin));
         ++begin;
     }
-    return in;
+    return in.GetResult();
 }
 
-template <typename ObjectType, typename BinaryFunc, int64_t default_num>
-class ArithmeticFolder : public Function {
+// The tree walker folds as it evaluates the arguments, while the VM evaluates all of them
+// before Compute folds. After a step of the fold fails, the tree walker still evaluates
+// the remaining arguments and only then throws, so both engines have the same side effects
+// and report the same error.
+class DeferredError {
 public:
-    std::shared_ptr<Object> Apply(std::shared_ptr<Scope> scope,
-                                  std::shared_ptr<Object> obj) override {
-        auto list = EvalArgsList(scope, obj);
-        ValidateArgs<ObjectType>(list.begin(), list.end());
-        return std::make_shared<Number>(
-            Fold<ObjectType>(list.begin(), list.end(), default_num, BinaryFunc()));
+    template <typename Step>
+    void Run(Step step) {
+        if (error_) {
+            return;
+        }
+        try {
+            step();
+        } catch (...) {
+            error_ = std::current_exception();
+        }
+    }
+
+    void Rethrow() const {
+        if (error_) {
+            std::rethrow_exception(error_);
+        }
     }
+
+private:
+    std::exception_ptr error_;
 };
 
-using Add = ArithmeticFolder<Number, std::plus<>, 0>;
-using Multiply = ArithmeticFolder<Number, std::multiplies<>, 1>;
+// Builtins below also serve as kernels for the bytecode VM: Compute works on arguments
+// that are already evaluated.
 
-template <typename ObjectType, typename BinaryFunc>
-class NotEmptyFolder : public Function {
+template <typename Kernel, int64_t default_num, Operation operation>
+class ArithmeticFolder : public Procedure {
 public:
-    std::shared_ptr<Object> Apply(std::shared_ptr<Scope> scope,
-                                  std::shared_ptr<Object> obj) override {
-        auto list = EvalArgsList(scope, obj);
-        ValidateArgs<ObjectType>(list.begin(), list.end());
-        if (list.empty()) {
+    bool IsPure() const override {
+        return true;
+    }
+
+    Operation GetOperation() const override {
+        return operation;
+    }
+
+    template <typename It>
+    static std::shared_ptr<Object> Compute(It begin, It end) {
+        return Fold<Kernel>(begin, end, Accumulator(default_num));
+    }
+
+    // Folds while walking the argument list, without collecting the values.
+    std::shared_ptr<Object> Apply(const std::shared_ptr<Scope>& scope,
+                                  const std::shared_ptr<Object>& obj) override {
+        Accumulator result(default_num);
+        DeferredError error;
+        ForEachEvaluatedArg(scope, obj, [&](const std::shared_ptr<Object>& value) {
+            error.Run([&] { result.Apply<Kernel>(GetNumber(value)); });
+        });
+        error.Rethrow();
+        return result.GetResult();
+    }
+
+    std::shared_ptr<Object> Invoke(std::span<const std::shared_ptr<Object>> args) override {
+        return Compute(args.begin(), args.end());
+    }
+};
+
+using Add = ArithmeticFolder<Plus, 0, Operation::ADD>;
+using Multiply = ArithmeticFolder<Times, 1, Operation::MULTIPLY>;
+
+template <typename Kernel, Operation operation>
+class NotEmptyFolder : public Procedure {
+public:
+    bool IsPure() const override {
+        return true;
+    }
+
+    Operation GetOperation() const override {
+        return operation;
+    }
+
+    template <typename It>
+    static std::shared_ptr<Object> Compute(It begin, It end) {
+        if (begin == end) {
             throw RuntimeError("Not enough arguments");
         }
-        return std::make_shared<Number>(Fold<ObjectType>(
-            ++list.begin(), list.end(), As<ObjectType>(list.front())->GetValue(), BinaryFunc()));
+        Accumulator first(GetNumber(*begin));
+        return Fold<Kernel>(++begin, end, std::move(first));
     }
-};
 
-using Subtract = NotEmptyFolder<Number, std::minus<int64_t>>;
-using Divide = NotEmptyFolder<Number, std::divides<int64_t>>;
+    std::shared_ptr<Object> Apply(const std::shared_ptr<Scope>& scope,
+                                  const std::shared_ptr<Object>& obj) override {
+        std::optional<Accumulator> result;
+        bool empty = true;
+        DeferredError error;
+        ForEachEvaluatedArg(scope, obj, [&](const std::shared_ptr<Object>& value) {
+            empty = false;
+            error.Run([&] {
+                auto number = GetNumber(value);
+                if (result) {
+                    result->Apply<Kernel>(number);
+                } else {
+                    result.emplace(number);
+                }
+            });
+        });
+        if (empty) {
+            throw RuntimeError("Not enough arguments");
+        }
+        error.Rethrow();
+        return result->GetResult();
+    }
 
-constexpr auto MinFunction = [](int64_t a, int64_t b) { return std::min(a, b); };
-using Min = NotEmptyFolder<Number, decltype(MinFunction)>;
+    std::shared_ptr<Object> Invoke(std::span<const std::shared_ptr<Object>> args) override {
+        return Compute(args.begin(), args.end());
+    }
+};
 
-constexpr auto MaxFunction = [](int64_t a, int64_t b) { return std::max(a, b); };
-using Max = NotEmptyFolder<Number, decltype(MaxFunction)>;
+using Subtract = NotEmptyFolder<Minus, Operation::SUBTRACT>;
+using Divide = NotEmptyFolder<Quotient, Operation::DIVIDE>;
+using Min = NotEmptyFolder<Minimum, Operation::MIN>;
+using Max = NotEmptyFolder<Maximum, Operation::MAX>;
 
+// Applies the predicate to the order of two numbers: -1, 0 or 1 compared with 0.
 template <typename BinaryFunc>
-class Comparison : public Function {
-public:
-    std::shared_ptr<Object> Apply(std::shared_ptr<Scope> scope,
-                                  std::shared_ptr<Object> obj) override {
-        auto list = EvalArgsList(scope, obj);
-        ValidateArgs<Number>(list.begin(), list.end());
-        if (list.size() < 2) {
-            return std::make_shared<Boolean>(true);
-        }
-        auto begin = ++list.begin(), end = list.end();
-        for (auto it = begin; it != end; ++it) {
-            if (!BinaryFunc()(As<Number>(*std::prev(it))->GetValue(),
-                              As<Number>(*it)->GetValue())) {
-                return std::make_shared<Boolean>(false);
+bool Holds(const NumberValue& lhs, const NumberValue& rhs) {
+    if (!lhs.IsBig() && !rhs.IsBig()) [[likely]] {
+        return BinaryFunc()(lhs.GetValue(), rhs.GetValue());
+    }
+    auto order = lhs.ToBigInt() <=> rhs.ToBigInt();
+    return BinaryFunc()(order < 0 ? -1 : order > 0 ? 1 : 0, 0);
+}
+
+template <typename BinaryFunc, Operation operation>
+class Comparison : public Procedure {
+public:
+    bool IsPure() const override {
+        return true;
+    }
+
+    Operation GetOperation() const override {
+        return operation;
+    }
+
+    template <typename It>
+    static std::shared_ptr<Object> Compute(It begin, It end) {
+        ValidateArgs<Number>(begin, end);
+        if (end - begin < 2) {
+            return Boolean::Make(true);
+        }
+        for (auto it = std::next(begin); it != end; ++it) {
+            if (!Holds<BinaryFunc>(NumberValue(*std::prev(it)), NumberValue(*it))) {
+                return Boolean::Make(false);
             }
         }
-        return std::make_shared<Boolean>(true);
+        return Boolean::Make(true);
+    }
+
+    std::shared_ptr<Object> Apply(const std::shared_ptr<Scope>& scope,
+                                  const std::shared_ptr<Object>& obj) override {
+        // Only the types can be wrong, and Compute checks all of them before comparing.
+        std::shared_ptr<Object> previous;
+        bool holds = true, numbers = true;
+        ForEachEvaluatedArg(scope, obj, [&](std::shared_ptr<Object> value) {
+            if (!numbers || !Is<Number>(value)) {
+                numbers = false;
+                return;
+            }
+            holds = holds && (!previous || Holds<BinaryFunc>(NumberValue(previous),
+                                                             NumberValue(value)));
+            previous = std::move(value);
+        });
+        if (!numbers) {
+            throw RuntimeError("Get unexpected type");
+        }
+        return Boolean::Make(holds);
+    }
+
+    std::shared_ptr<Object> Invoke(std::span<const std::shared_ptr<Object>> args) override {
+        return Compute(args.begin(), args.end());
     }
 };
 
-using Equal = Comparison<std::equal_to<int64_t>>;
-using Less = Comparison<std::less<int64_t>>;
-using Greater = Comparison<std::greater<int64_t>>;
-using LessEqual = Comparison<std::less_equal<int64_t>>;
-using GreaterEqual = Comparison<std::greater_equal<int64_t>>;
+using Equal = Comparison<std::equal_to<int64_t>, Operation::EQUAL>;
+using Less = Comparison<std::less<int64_t>, Operation::LESS>;
+using Greater = Comparison<std::greater<int64_t>, Operation::GREATER>;
+using LessEqual = Comparison<std::less_equal<int64_t>, Operation::LESS_EQUAL>;
+using GreaterEqual = Comparison<std::greater_equal<int64_t>, Operation::GREATER_EQUAL>;
 
-class Abs : public Function {
+class Abs : public Procedure {
 public:
-    std::shared_ptr<Object> Apply(std::shared_ptr<Scope> scope,
-                                  std::shared_ptr<Object> obj) override {
-        auto list = EvalArgsList(scope, obj);
-        ValidateArgs<Number, 1>(list.begin(), list.end());
-        return std::make_shared<Number>(std::llabs(As<Number>(list.front())->GetValue()));
+    bool IsPure() const override {
+        return true;
+    }
+
+    Operation GetOperation() const override {
+        return Operation::ABS;
+    }
+
+    template <typename It>
+    static std::shared_ptr<Object> Compute(It begin, It end) {
+        ValidateArgs<Number, 1>(begin, end);
+        NumberValue number(*begin);
+        if (!number.IsBig() && number.GetValue() != INT64_MIN) [[likely]] {
+            return Number::Make(std::llabs(number.GetValue()));
+        }
+        auto value = number.ToBigInt();
+        return Number::Make(value.IsNegative() ? -value : std::move(value));
+    }
+
+    std::shared_ptr<Object> Invoke(std::span<const std::shared_ptr<Object>> args) override {
+        return Compute(args.begin(), args.end());
     }
 };
 
-class Not : public Function {
+std::shared_ptr<Object> ApplyOperation(Operation operation, const std::shared_ptr<Object>* begin,
+                                       const std::shared_ptr<Object>* end) {
+    switch (operation) {
+        case Operation::ADD:
+            return Add::Compute(begin, end);
+        case Operation::SUBTRACT:
+            return Subtract::Compute(begin, end);
+        case Operation::MULTIPLY:
+            return Multiply::Compute(begin, end);
+        case Operation::DIVIDE:
+            return Divide::Compute(begin, end);
+        case Operation::EQUAL:
+            return Equal::Compute(begin, end);
+        case Operation::LESS:
+            return Less::Compute(begin, end);
+        case Operation::GREATER:
+            return Greater::Compute(begin, end);
+        case Operation::LESS_EQUAL:
+            return LessEqual::Compute(begin, end);
+        case Operation::GREATER_EQUAL:
+            return GreaterEqual::Compute(begin, end);
+        case Operation::MIN:
+            return Min::Compute(begin, end);
+        case Operation::MAX:
+            return Max::Compute(begin, end);
+        case Operation::ABS:
+            return Abs::Compute(begin, end);
+        default:
+            throw RuntimeError("Unknown operation");
+    }
+}
+
+class Not : public Procedure {
 public:
-    std::shared_ptr<Object> Apply(std::shared_ptr<Scope> scope,
-                                  std::shared_ptr<Object> obj) override {
-        auto list = EvalArgsList(scope, obj);
+    bool IsPure() const override {
+        return true;
+    }
+
+    std::shared_ptr<Object> Invoke(std::span<const std::shared_ptr<Object>> list) override {
         if (list.size() != 1) {
             throw RuntimeError("Expected one argument");
         }
-        return std::make_shared<Boolean>(Is<Boolean>(list.front()) &&
-                                         !As<Boolean>(list.front())->GetValue());
+        return Boolean::Make(Is<Boolean>(list.front()) && !Cast<Boolean>(list.front())->GetValue());
     }
 };
 
 class And : public Function {
 public:
-    std::shared_ptr<Object> Apply(std::shared_ptr<Scope> scope,
-                                  std::shared_ptr<Object> obj) override {
+    FormKind GetFormKind() const override {
+        return FormKind::AND;
+    }
+
+    std::shared_ptr<Object> Apply(const std::shared_ptr<Scope>& scope,
+                                  const std::shared_ptr<Object>& obj) override {
         auto unevaluated_list = GetArgsList(obj);
         if (unevaluated_list.empty()) {
-            return std::make_shared<Boolean>(true);
+            return Boolean::Make(true);
         }
         std::shared_ptr<Object> result;
         for (const auto& unevaluated_arg : unevaluated_list) {
             if (unevaluated_arg) {
-                result = unevaluated_arg->Eval(scope);
+                result = EvalExpression(unevaluated_arg, scope);
             } else {
                 result = nullptr;
             }
-            if (Is<Boolean>(result) && !As<Boolean>(result)->GetValue()) {
-                return std::make_shared<Boolean>(false);
+            if (Is<Boolean>(result) && !Cast<Boolean>(result)->GetValue()) {
+                return Boolean::Make(false);
             }
         }
         return result;
@@ -223,20 +596,24 @@ public:
 
 class Or : public Function {
 public:
-    std::shared_ptr<Object> Apply(std::shared_ptr<Scope> scope,
-                                  std::shared_ptr<Object> obj) override {
+    FormKind GetFormKind() const override {
+        return FormKind::OR;
+    }
+
+    std::shared_ptr<Object> Apply(const std::shared_ptr<Scope>& scope,
+                                  const std::shared_ptr<Object>& obj) override {
         auto list = GetArgsList(obj);
         if (list.empty()) {
-            return std::make_shared<Boolean>(false);
+            return Boolean::Make(false);
         }
         std::shared_ptr<Object> result;
         for (const auto& unevaluated_arg : list) {
             if (unevaluated_arg) {
-                result = unevaluated_arg->Eval(scope);
+                result = EvalExpression(unevaluated_arg, scope);
             } else {
                 result = nullptr;
             }
-            if (!Is<Boolean>(result) || As<Boolean>(result)->GetValue()) {
+            if (!Is<Boolean>(result) || Cast<Boolean>(result)->GetValue()) {
                 return result;
             }
         }
@@ -246,60 +623,110 @@ public:
 
 class Quote : public Function {
 public:
-    std::shared_ptr<Object> Apply(std::shared_ptr<Scope> scope,
-                                  std::shared_ptr<Object> obj) override {
+    FormKind GetFormKind() const override {
+        return FormKind::QUOTE;
+    }
+
+    std::shared_ptr<Object> Apply(const std::shared_ptr<Scope>& scope,
+                                  const std::shared_ptr<Object>& obj) override {
         auto cell = As<Cell>(obj);
-        if (cell->GetSecond()) {
+        if (!cell || cell->GetSecond()) {
             throw RuntimeError("Expected one argument");
         }
         return cell->GetFirst();
     }
 };
 
-class Cons : public Function {
+template <bool IsDefinition>
+class Binder : public Function {
+public:
+    FormKind GetFormKind() const override {
+        return IsDefinition ? FormKind::DEFINE : FormKind::SET;
+    }
+
+    std::shared_ptr<Object> Apply(const std::shared_ptr<Scope>& scope,
+                                  const std::shared_ptr<Object>& obj) override {
+        auto list = GetArgsList(obj);
+        if (IsDefinition && !list.empty() && Is<Cell>(list.front())) {
+            return AnalyzeForm(FormKind::DEFINE, obj, scope)->Eval(scope);
+        }
+        if (list.size() != 2 || !Is<Symbol>(list.front())) {
+            throw SyntaxError("Expected name and value");
+        }
+        auto id = As<Symbol>(list.front())->GetId();
+        std::shared_ptr<Object> value;
+        if (list.back()) {
+            value = EvalExpression(list.back(), scope);
+        }
+        if (IsDefinition) {
+            scope->Define(id, value);
+        } else {
+            scope->Reset(id, value);
+        }
+        return nullptr;
+    }
+};
+
+using Define = Binder<true>;
+using Set = Binder<false>;
+
+// Forms the analyzer builds nodes for. The builtins only run for trees that were not
+// analyzed, which get the same nodes built on every call.
+template <FormKind Kind>
+class AnalyzedForm : public Function {
+public:
+    FormKind GetFormKind() const override {
+        return Kind;
+    }
+
+    std::shared_ptr<Object> Apply(const std::shared_ptr<Scope>& scope,
+                                  const std::shared_ptr<Object>& obj) override {
+        return AnalyzeForm(Kind, obj, scope)->Eval(scope);
+    }
+};
+
+class Cons : public Procedure {
 public:
-    std::shared_ptr<Object> Apply(std::shared_ptr<Scope> scope,
-                                  std::shared_ptr<Object> obj) override {
-        auto list = EvalArgsList(scope, obj);
+    bool IsPure() const override {
+        return true;
+    }
+
+    std::shared_ptr<Object> Invoke(std::span<const std::shared_ptr<Object>> list) override {
         if (list.size() != 2) {
             throw RuntimeError("Expected two arguments");
         }
-        auto cell = std::make_shared<Cell>(Cell(list.front()));
-        cell->SetIsHead(true);
+        auto cell = Allocate<Cell>(list.front());
         cell->SetSecond(list.back());
         return cell;
     }
 };
 
-class Car : public Function {
+class Car : public Procedure {
 public:
-    std::shared_ptr<Object> Apply(std::shared_ptr<Scope> scope,
-                                  std::shared_ptr<Object> obj) override {
-        auto list = EvalArgsList(scope, obj);
+    bool IsPure() const override {
+        return true;
+    }
+
+    std::shared_ptr<Object> Invoke(std::span<const std::shared_ptr<Object>> list) override {
         if (list.size() != 1 || !Is<Cell>(list.front())) {
             throw RuntimeError("Expected other as an argument");
         }
-        return As<Cell>(list.front())->GetFirst();
+        return Cast<Cell>(list.front())->GetFirst();
     }
 };
 
-class Cdr : public Function {
+class Cdr : public Procedure {
 public:
-    std::shared_ptr<Object> Apply(std::shared_ptr<Scope> scope,
-                                  std::shared_ptr<Object> obj) override {
-        auto list = EvalArgsList(scope, obj);
+    bool IsPure() const override {
+        return true;
+    }
+
+    std::shared_ptr<Object> Invoke(std::span<const std::shared_ptr<Object>> list) override {
         if (list.size() != 1 || !Is<Cell>(list.front())) {
             throw RuntimeError("Expected other as an argument");
         }
-        auto second = As<Cell>(list.front())->GetSecond();
-        if (!second) {
-            return nullptr;
-        }
-        auto tail = second;
-        if (Is<Cell>(tail)) {
-            As<Cell>(tail)->SetIsHead(true);
-        }
-        return tail;
+        // The tail is shared with the argument; list cells are never modified.
+        return Cast<Cell>(list.front())->GetSecond();
     }
 };
 
@@ -308,59 +735,549 @@ std::shared_ptr<Object> MakeAllListsImpl(It begin, It end) {
     if (begin == end) {
         return nullptr;
     }
+    SpendSteps(end - begin);
     std::shared_ptr<Cell> head, cell;
-    head = std::make_shared<Cell>(Cell(*begin));
-    head->SetIsHead(true);
+    head = Allocate<Cell>(*begin);
     cell = head;
     auto loop_begin = ++begin, loop_end = end;
     for (auto it = loop_begin; it != loop_end; ++it) {
-        auto tmp_cell = std::make_shared<Cell>(*it);
+        auto tmp_cell = Allocate<Cell>(*it);
         cell->SetSecond(tmp_cell);
         cell = tmp_cell;
     }
     return head;
 }
 
-class MakeList : public Function {
+class MakeList : public Procedure {
 public:
-    std::shared_ptr<Object> Apply(std::shared_ptr<Scope> scope,
-                                  std::shared_ptr<Object> obj) override {
-        auto list = EvalArgsList(scope, obj);
+    bool IsPure() const override {
+        return true;
+    }
+
+    std::shared_ptr<Object> Invoke(std::span<const std::shared_ptr<Object>> list) override {
         return MakeAllListsImpl(list.begin(), list.end());
     }
 };
 
-class MakeListRef : public Function {
+// The part of a proper list after its first n cells. Walks the cells in place instead of
+// copying the list.
+const std::shared_ptr<Object>& SkipCells(const std::shared_ptr<Object>& list, int64_t n) {
+    if (n < 0) {
+        throw RuntimeError("Out of range");
+    }
+    SpendSteps(n);
+    auto current = &list;
+    for (; n > 0; --n) {
+        if (!*current) {
+            throw RuntimeError("Out of range");
+        }
+        current = &Cast<Cell>(*current)->GetSecond();
+    }
+    return *current;
+}
+
+// list-ref and list-tail accept vectors as well as lists.
+void ValidateSequenceArgs(std::span<const std::shared_ptr<Object>> list) {
+    if (list.size() != 2 || !(Is<Vector>(list.front()) || IsListImpl(list.front())) ||
+        !Is<Number>(list.back())) {
+        throw RuntimeError("Expected other as argument");
+    }
+}
+
+class MakeListRef : public Procedure {
+public:
+    bool IsPure() const override {
+        return true;
+    }
+
+    std::shared_ptr<Object> Invoke(std::span<const std::shared_ptr<Object>> list) override {
+        ValidateSequenceArgs(list);
+        int64_t n = NumberValue(list.back()).GetValue();
+        if (Is<Vector>(list.front())) {
+            auto vector = Cast<Vector>(list.front());
+            if (n < 0 || n >= static_cast<int64_t>(vector->GetSize())) {
+                throw RuntimeError("Out of range");
+            }
+            return vector->Get(n);
+        }
+        const auto& tail = SkipCells(list.front(), n);
+        if (!tail) {
+            throw RuntimeError("Out of range");
+        }
+        return Cast<Cell>(tail)->GetFirst();
+    }
+};
+
+class MakeListTail : public Procedure {
+public:
+    bool IsPure() const override {
+        return true;
+    }
+
+    std::shared_ptr<Object> Invoke(std::span<const std::shared_ptr<Object>> list) override {
+        ValidateSequenceArgs(list);
+        int64_t n = NumberValue(list.back()).GetValue();
+        if (Is<Vector>(list.front())) {
+            const auto& elements = Cast<Vector>(list.front())->GetElements();
+            if (n < 0 || n > static_cast<int64_t>(elements.size())) {
+                throw RuntimeError("Out of range");
+            }
+            return MakeAllListsImpl(elements.begin() + n, elements.end());
+        }
+        // The tail is shared with the argument, as nothing can modify list cells.
+        return SkipCells(list.front(), n);
+    }
+};
+
+// Elements of a list or vector, in order.
+std::vector<std::shared_ptr<Object>> GetSequenceElements(const std::shared_ptr<Object>& sequence) {
+    if (Is<Vector>(sequence)) {
+        const auto& elements = Cast<Vector>(sequence)->GetElements();
+        return {elements.begin(), elements.end()};
+    }
+    if (!IsListImpl(sequence)) {
+        throw RuntimeError("Expected other as argument");
+    }
+    return GetArgsList(sequence);
+}
+
+Function* GetInvocable(const std::shared_ptr<Object>& function) {
+    if (!Is<Function>(function) || Cast<Function>(function)->GetFormKind() != FormKind::CALL) {
+        throw RuntimeError("Expected a function");
+    }
+    return Cast<Function>(function);
+}
+
+// The parallel builtins split their input into chunks of this many elements. The split does
+// not depend on the number of cores, so neither do the results.
+constexpr std::size_t kParallelChunkSize = 256;
+
+// Calls callback(begin, end) for every chunk of [0, size), on the shared scheduler if there
+// is more than one chunk.
+template <typename Callback>
+void ForEachChunk(std::size_t size, Callback callback) {
+    auto chunks = (size + kParallelChunkSize - 1) / kParallelChunkSize;
+    auto run = [&](std::size_t chunk) {
+        auto begin = chunk * kParallelChunkSize;
+        callback(begin, std::min(size, begin + kParallelChunkSize));
+    };
+    // Inputs of one chunk are not worth a thread handoff, and they do not start the workers.
+    // They still run as a task, so that f may change the same state whatever the input.
+    if (chunks < 2) {
+        for (std::size_t chunk = 0; chunk < chunks; ++chunk) {
+            ParallelTask task;
+            run(chunk);
+        }
+        return;
+    }
+    // Every chunk runs under the budget of the run, on whatever thread takes it. Once one
+    // fails, the chunks after it stop: their results are not used.
+    SharedBudget shared(Budget::Current());
+    CollectorRegion region;
+    TaskScheduler::Instance().ParallelFor(chunks, [&](std::size_t chunk) {
+        Budget budget(&shared, chunk);
+        CollectorTask task(&region);
+        ParallelTask parallel_task;
+        try {
+            run(chunk);
+        } catch (...) {
+            shared.Cancel(chunk);
+            throw;
+        }
+    });
+}
+
+// (par-map f sequence): f applied to every element of a list or vector, giving a sequence of
+// the same kind. The calls may run on several threads at once, so f must not modify state
+// shared with other calls; see ParallelTask.
+class ParallelMap : public Procedure {
+public:
+    std::shared_ptr<Object> Invoke(std::span<const std::shared_ptr<Object>> list) override {
+        if (list.size() != 2) {
+            throw RuntimeError("Expected two arguments");
+        }
+        auto function = GetInvocable(list[0]);
+        auto elements = GetSequenceElements(list[1]);
+        SpendSteps(elements.size());
+        std::vector<std::shared_ptr<Object>> results(elements.size());
+        ForEachChunk(elements.size(), [&](std::size_t begin, std::size_t end) {
+            for (auto i = begin; i < end; ++i) {
+                results[i] = function->Invoke({&elements[i], 1});
+            }
+        });
+        if (Is<Vector>(list[1])) {
+            return Allocate<Vector>(Vector::Elements(results.begin(), results.end()));
+        }
+        return MakeAllListsImpl(results.begin(), results.end());
+    }
+};
+
+// (par-reduce f init sequence): every chunk is folded with f from the left, then init and
+// the chunk results are, in order. This equals the sequential fold when f is associative.
+class ParallelReduce : public Procedure {
+public:
+    std::shared_ptr<Object> Invoke(std::span<const std::shared_ptr<Object>> list) override {
+        if (list.size() != 3) {
+            throw RuntimeError("Expected three arguments");
+        }
+        auto function = GetInvocable(list[0]);
+        auto elements = GetSequenceElements(list[2]);
+        auto fold = [function](std::array<std::shared_ptr<Object>, 2>* args,
+                               const std::shared_ptr<Object>& value) {
+            (*args)[1] = value;
+            (*args)[0] = function->Invoke(*args);
+        };
+
+        SpendSteps(elements.size());
+        std::vector<std::shared_ptr<Object>> partials(
+            (elements.size() + kParallelChunkSize - 1) / kParallelChunkSize);
+        ForEachChunk(elements.size(), [&](std::size_t begin, std::size_t end) {
+            std::array<std::shared_ptr<Object>, 2> args{elements[begin]};
+            for (auto i = begin + 1; i < end; ++i) {
+                fold(&args, elements[i]);
+            }
+            partials[begin / kParallelChunkSize] = std::move(args[0]);
+        });
+        std::array<std::shared_ptr<Object>, 2> args{list[1]};
+        for (const auto& partial : partials) {
+            fold(&args, partial);
+        }
+        return args[0];
+    }
+};
+
+using IsVector = IsExpectedType<Vector>;
+
+// Sizes that memory cannot hold are errors of the call, as any other bad argument, rather
+// than std::bad_alloc.
+template <typename Elements, typename Fill>
+Elements MakeElements(int64_t size, const Fill& fill) {
+    if (static_cast<uint64_t>(size) > Elements().max_size()) {
+        throw RuntimeError("Out of memory");
+    }
+    try {
+        return Elements(size, fill);
+    } catch (const std::bad_alloc&) {
+        throw RuntimeError("Out of memory");
+    }
+}
+
+class MakeVector : public Procedure {
+public:
+    std::shared_ptr<Object> Invoke(std::span<const std::shared_ptr<Object>> list) override {
+        if (list.empty() || list.size() > 2 || !Is<Number>(list.front())) {
+            throw RuntimeError("Expected other as argument");
+        }
+        int64_t size = NumberValue(list.front()).GetValue();
+        if (size < 0) {
+            throw RuntimeError("Out of range");
+        }
+        SpendSteps(size);
+        // Without a fill value the elements are zeros.
+        auto fill = list.size() == 2 ? list.back() : Number::Make(0);
+        return Allocate<Vector>(MakeElements<Vector::Elements>(size, fill));
+    }
+};
+
+class VectorFromValues : public Procedure {
+public:
+    std::shared_ptr<Object> Invoke(std::span<const std::shared_ptr<Object>> list) override {
+        return Allocate<Vector>(Vector::Elements(list.begin(), list.end()));
+    }
+};
+
+// Checks the vector and index arguments of vector-ref and vector-set!.
+std::pair<Vector*, std::size_t> GetVectorSlot(std::span<const std::shared_ptr<Object>> list,
+                                              std::size_t count) {
+    if (list.size() != count || !Is<Vector>(list[0]) || !Is<Number>(list[1])) {
+        throw RuntimeError("Expected other as argument");
+    }
+    auto vector = Cast<Vector>(list[0]);
+    int64_t index = NumberValue(list[1]).GetValue();
+    if (index < 0 || index >= static_cast<int64_t>(vector->GetSize())) {
+        throw RuntimeError("Out of range");
+    }
+    return {vector, index};
+}
+
+class VectorRef : public Procedure {
+public:
+    std::shared_ptr<Object> Invoke(std::span<const std::shared_ptr<Object>> list) override {
+        auto [vector, index] = GetVectorSlot(list, 2);
+        return vector->Get(index);
+    }
+};
+
+class VectorSet : public Procedure {
+public:
+    std::shared_ptr<Object> Invoke(std::span<const std::shared_ptr<Object>> list) override {
+        auto [vector, index] = GetVectorSlot(list, 3);
+        vector->Set(index, list[2]);
+        return nullptr;
+    }
+};
+
+class VectorLength : public Procedure {
+public:
+    std::shared_ptr<Object> Invoke(std::span<const std::shared_ptr<Object>> list) override {
+        if (list.size() != 1 || !Is<Vector>(list.front())) {
+            throw RuntimeError("Expected other as argument");
+        }
+        return Number::Make(Cast<Vector>(list.front())->GetSize());
+    }
+};
+
+class ListToVector : public Procedure {
+public:
+    std::shared_ptr<Object> Invoke(std::span<const std::shared_ptr<Object>> list) override {
+        if (list.size() != 1 || !IsListImpl(list.front())) {
+            throw RuntimeError("Expected other as argument");
+        }
+        Vector::Elements elements;
+        for (auto cell = Cast<Cell>(list.front()); cell; cell = Cast<Cell>(cell->GetSecond())) {
+            elements.push_back(cell->GetFirst());
+        }
+        return Allocate<Vector>(std::move(elements));
+    }
+};
+
+class VectorToList : public Procedure {
+public:
+    std::shared_ptr<Object> Invoke(std::span<const std::shared_ptr<Object>> list) override {
+        if (list.size() != 1 || !Is<Vector>(list.front())) {
+            throw RuntimeError("Expected other as argument");
+        }
+        const auto& elements = Cast<Vector>(list.front())->GetElements();
+        return MakeAllListsImpl(elements.begin(), elements.end());
+    }
+};
+
+// Element of an s64vector; big numbers do not fit.
+int64_t ToS64(const std::shared_ptr<Object>& value) {
+    if (!Is<Number>(value)) {
+        throw RuntimeError("Get unexpected type");
+    }
+    NumberValue number(value);
+    if (number.IsBig()) {
+        throw RuntimeError("Out of range");
+    }
+    return number.GetValue();
+}
+
+std::shared_ptr<Object> MakeNumber(__int128 value) {
+    if (value >= INT64_MIN && value <= INT64_MAX) {
+        return Number::Make(static_cast<int64_t>(value));
+    }
+    // value = high 2^64 + middle 2^32 + low, with the two lower parts unsigned 32-bit.
+    const BigInt base(int64_t{1} << 32);
+    BigInt high(static_cast<int64_t>(value >> 64));
+    BigInt middle(static_cast<int64_t>((value >> 32) & 0xffffffff));
+    BigInt low(static_cast<int64_t>(value & 0xffffffff));
+    return Number::Make((high * base + middle) * base + low);
+}
+
+const S64Vector& GetS64Vector(std::span<const std::shared_ptr<Object>> list, std::size_t count) {
+    if (list.size() != count || !Is<S64Vector>(list.front())) {
+        throw RuntimeError("Expected other as argument");
+    }
+    return *Cast<S64Vector>(list.front());
+}
+
+// Both arguments of an elementwise builtin.
+std::pair<const S64Vector*, const S64Vector*> GetS64Operands(
+    std::span<const std::shared_ptr<Object>> list) {
+    if (list.size() != 2 || !Is<S64Vector>(list[0]) || !Is<S64Vector>(list[1])) {
+        throw RuntimeError("Expected other as argument");
+    }
+    auto lhs = Cast<S64Vector>(list[0]), rhs = Cast<S64Vector>(list[1]);
+    if (lhs->GetSize() != rhs->GetSize()) {
+        throw RuntimeError("Vectors differ in length");
+    }
+    return {lhs, rhs};
+}
+
+using IsS64Vector = IsExpectedType<S64Vector>;
+
+class MakeS64Vector : public Procedure {
 public:
-    std::shared_ptr<Object> Apply(std::shared_ptr<Scope> scope,
-                                  std::shared_ptr<Object> obj) override {
-        auto list = EvalArgsList(scope, obj);
-        if (list.size() != 2 || !IsListImpl(list.front()) || !Is<Number>(list.back())) {
+    std::shared_ptr<Object> Invoke(std::span<const std::shared_ptr<Object>> list) override {
+        if (list.empty() || list.size() > 2 || !Is<Number>(list.front())) {
             throw RuntimeError("Expected other as argument");
         }
-        auto values = GetArgsList(list.front());
-        int64_t n = As<Number>(list.back())->GetValue();
-        if (n < 0 || n >= static_cast<int64_t>(values.size())) {
+        int64_t size = NumberValue(list.front()).GetValue();
+        if (size < 0) {
             throw RuntimeError("Out of range");
         }
-        return values[n];
+        SpendSteps(size);
+        int64_t fill = list.size() == 2 ? ToS64(list.back()) : 0;
+        return Allocate<S64Vector>(MakeElements<S64Vector::Elements>(size, fill));
+    }
+};
+
+template <typename It>
+std::shared_ptr<Object> MakeS64VectorImpl(It begin, It end) {
+    S64Vector::Elements elements;
+    elements.reserve(end - begin);
+    for (; begin != end; ++begin) {
+        elements.push_back(ToS64(*begin));
+    }
+    return Allocate<S64Vector>(std::move(elements));
+}
+
+class S64VectorFromValues : public Procedure {
+public:
+    std::shared_ptr<Object> Invoke(std::span<const std::shared_ptr<Object>> list) override {
+        return MakeS64VectorImpl(list.begin(), list.end());
+    }
+};
+
+// Checks the vector and index arguments of s64vector-ref and s64vector-set!.
+std::pair<S64Vector*, std::size_t> GetS64VectorSlot(std::span<const std::shared_ptr<Object>> list,
+                                                    std::size_t count) {
+    if (list.size() != count || !Is<S64Vector>(list[0]) || !Is<Number>(list[1])) {
+        throw RuntimeError("Expected other as argument");
+    }
+    auto vector = Cast<S64Vector>(list[0]);
+    int64_t index = NumberValue(list[1]).GetValue();
+    if (index < 0 || index >= static_cast<int64_t>(vector->GetSize())) {
+        throw RuntimeError("Out of range");
+    }
+    return {vector, index};
+}
+
+class S64VectorRef : public Procedure {
+public:
+    std::shared_ptr<Object> Invoke(std::span<const std::shared_ptr<Object>> list) override {
+        auto [vector, index] = GetS64VectorSlot(list, 2);
+        return Number::Make(vector->Get(index));
+    }
+};
+
+class S64VectorSet : public Procedure {
+public:
+    std::shared_ptr<Object> Invoke(std::span<const std::shared_ptr<Object>> list) override {
+        auto [vector, index] = GetS64VectorSlot(list, 3);
+        vector->Set(index, ToS64(list[2]));
+        return nullptr;
     }
 };
 
-class MakeListTail : public Function {
+class S64VectorLength : public Procedure {
 public:
-    std::shared_ptr<Object> Apply(std::shared_ptr<Scope> scope,
-                                  std::shared_ptr<Object> obj) override {
-        auto list = EvalArgsList(scope, obj);
-        if (list.size() != 2 || !IsListImpl(list.front()) || !Is<Number>(list.back())) {
+    std::shared_ptr<Object> Invoke(std::span<const std::shared_ptr<Object>> list) override {
+        return Number::Make(GetS64Vector(list, 1).GetSize());
+    }
+};
+
+class ListToS64Vector : public Procedure {
+public:
+    std::shared_ptr<Object> Invoke(std::span<const std::shared_ptr<Object>> list) override {
+        if (list.size() != 1 || !IsListImpl(list.front())) {
             throw RuntimeError("Expected other as argument");
         }
-        auto values = GetArgsList(list.front());
-        int64_t n = As<Number>(list.back())->GetValue();
-        if (n < 0 || n > static_cast<int64_t>(values.size())) {
+        S64Vector::Elements elements;
+        for (auto cell = Cast<Cell>(list.front()); cell; cell = Cast<Cell>(cell->GetSecond())) {
+            elements.push_back(ToS64(cell->GetFirst()));
+        }
+        return Allocate<S64Vector>(std::move(elements));
+    }
+};
+
+class S64VectorToList : public Procedure {
+public:
+    std::shared_ptr<Object> Invoke(std::span<const std::shared_ptr<Object>> list) override {
+        const auto& vector = GetS64Vector(list, 1);
+        std::vector<std::shared_ptr<Object>> values;
+        values.reserve(vector.GetSize());
+        for (std::size_t i = 0; i < vector.GetSize(); ++i) {
+            values.push_back(Number::Make(vector.Get(i)));
+        }
+        return MakeAllListsImpl(values.begin(), values.end());
+    }
+};
+
+class S64VectorSum : public Procedure {
+public:
+    std::shared_ptr<Object> Invoke(std::span<const std::shared_ptr<Object>> list) override {
+        const auto& vector = GetS64Vector(list, 1);
+        return MakeNumber(GetS64Kernels().sum(vector.GetData(), vector.GetSize()));
+    }
+};
+
+template <bool IsMin>
+class S64VectorExtremum : public Procedure {
+public:
+    std::shared_ptr<Object> Invoke(std::span<const std::shared_ptr<Object>> list) override {
+        const auto& vector = GetS64Vector(list, 1);
+        if (!vector.GetSize()) {
+            throw RuntimeError("Out of range");
+        }
+        const auto& kernels = GetS64Kernels();
+        auto kernel = IsMin ? kernels.min : kernels.max;
+        return Number::Make(kernel(vector.GetData(), vector.GetSize()));
+    }
+};
+
+using S64VectorMin = S64VectorExtremum<true>;
+using S64VectorMax = S64VectorExtremum<false>;
+
+class S64VectorDot : public Procedure {
+public:
+    std::shared_ptr<Object> Invoke(std::span<const std::shared_ptr<Object>> list) override {
+        auto [lhs, rhs] = GetS64Operands(list);
+        __int128 result;
+        if (DotS64(lhs->GetData(), rhs->GetData(), lhs->GetSize(), &result)) {
+            return MakeNumber(result);
+        }
+        // Products close to the int64_t limits can push the sum past 128 bits.
+        BigInt sum;
+        for (std::size_t i = 0; i < lhs->GetSize(); ++i) {
+            sum = sum + BigInt(lhs->Get(i)) * BigInt(rhs->Get(i));
+        }
+        return Number::Make(std::move(sum));
+    }
+};
+
+// Elementwise arithmetic; results that do not fit in int64_t are errors, as the result is
+// an s64vector too.
+template <bool (*Kernel)(const int64_t*, const int64_t*, int64_t*, std::size_t)>
+class S64VectorArithmetic : public Procedure {
+public:
+    std::shared_ptr<Object> Invoke(std::span<const std::shared_ptr<Object>> list) override {
+        auto [lhs, rhs] = GetS64Operands(list);
+        S64Vector::Elements elements(lhs->GetSize());
+        if (!Kernel(lhs->GetData(), rhs->GetData(), elements.data(), elements.size())) {
             throw RuntimeError("Out of range");
         }
-        return MakeAllListsImpl(values.begin() + n, values.end());
+        return Allocate<S64Vector>(std::move(elements));
+    }
+};
+
+bool AddS64(const int64_t* lhs, const int64_t* rhs, int64_t* out, std::size_t size) {
+    return GetS64Kernels().add(lhs, rhs, out, size);
+}
+
+using S64VectorAdd = S64VectorArithmetic<AddS64>;
+using S64VectorMultiply = S64VectorArithmetic<MultiplyS64>;
+
+// Elementwise comparison, giving an s64vector of 1 where it holds and 0 elsewhere.
+enum class MaskKind { LESS, EQUAL, GREATER };
+
+template <MaskKind Kind>
+class S64VectorMask : public Procedure {
+public:
+    std::shared_ptr<Object> Invoke(std::span<const std::shared_ptr<Object>> list) override {
+        auto [lhs, rhs] = GetS64Operands(list);
+        S64Vector::Elements elements(lhs->GetSize());
+        const auto& kernels = GetS64Kernels();
+        if (Kind == MaskKind::EQUAL) {
+            kernels.equal(lhs->GetData(), rhs->GetData(), elements.data(), elements.size());
+        } else if (Kind == MaskKind::LESS) {
+            kernels.less(lhs->GetData(), rhs->GetData(), elements.data(), elements.size());
+        } else {
+            kernels.less(rhs->GetData(), lhs->GetData(), elements.data(), elements.size());
+        }
+        return Allocate<S64Vector>(std::move(elements));
     }
 };
 
@@ -387,10 +1304,42 @@ std::unordered_map<std::string, std::shared_ptr<Object>> Interpreter::GetBuiltIn
             {"and", std::make_shared<And>()},
             {"or", std::make_shared<Or>()},
             {"quote", std::make_shared<Quote>()},
+            {"define", std::make_shared<Define>()},
+            {"set!", std::make_shared<Set>()},
+            {"if", std::make_shared<AnalyzedForm<FormKind::IF>>()},
+            {"lambda", std::make_shared<AnalyzedForm<FormKind::LAMBDA>>()},
+            {"let", std::make_shared<AnalyzedForm<FormKind::LET>>()},
             {"cons", std::make_shared<Cons>()},
             {"car", std::make_shared<Car>()},
             {"cdr", std::make_shared<Cdr>()},
             {"list", std::make_shared<MakeList>()},
             {"list-ref", std::make_shared<MakeListRef>()},
-            {"list-tail", std::make_shared<MakeListTail>()}};
+            {"list-tail", std::make_shared<MakeListTail>()},
+            {"par-map", std::make_shared<ParallelMap>()},
+            {"par-reduce", std::make_shared<ParallelReduce>()},
+            {"vector?", std::make_shared<IsVector>()},
+            {"make-vector", std::make_shared<MakeVector>()},
+            {"vector", std::make_shared<VectorFromValues>()},
+            {"vector-ref", std::make_shared<VectorRef>()},
+            {"vector-set!", std::make_shared<VectorSet>()},
+            {"vector-length", std::make_shared<VectorLength>()},
+            {"list->vector", std::make_shared<ListToVector>()},
+            {"vector->list", std::make_shared<VectorToList>()},
+            {"s64vector?", std::make_shared<IsS64Vector>()},
+            {"make-s64vector", std::make_shared<MakeS64Vector>()},
+            {"s64vector", std::make_shared<S64VectorFromValues>()},
+            {"s64vector-ref", std::make_shared<S64VectorRef>()},
+            {"s64vector-set!", std::make_shared<S64VectorSet>()},
+            {"s64vector-length", std::make_shared<S64VectorLength>()},
+            {"list->s64vector", std::make_shared<ListToS64Vector>()},
+            {"s64vector->list", std::make_shared<S64VectorToList>()},
+            {"s64vector-sum", std::make_shared<S64VectorSum>()},
+            {"s64vector-min", std::make_shared<S64VectorMin>()},
+            {"s64vector-max", std::make_shared<S64VectorMax>()},
+            {"s64vector-dot", std::make_shared<S64VectorDot>()},
+            {"s64vector-add", std::make_shared<S64VectorAdd>()},
+            {"s64vector-mul", std::make_shared<S64VectorMultiply>()},
+            {"s64vector<", std::make_shared<S64VectorMask<MaskKind::LESS>>()},
+            {"s64vector=", std::make_shared<S64VectorMask<MaskKind::EQUAL>>()},
+            {"s64vector>", std::make_shared<S64VectorMask<MaskKind::GREATER>>()}};
 }
\ No newline at end of file
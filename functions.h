@@ -7,4 +7,8 @@
 
 class Object;
 
-std::unordered_map<std::string, std::shared_ptr<Object>> GetBuiltInFunctions();
\ No newline at end of file
+std::unordered_map<std::string, std::shared_ptr<Object>> GetBuiltInFunctions();
+
+// Runs the builtin implementing the operation on already evaluated arguments.
+std::shared_ptr<Object> ApplyOperation(Operation operation, const std::shared_ptr<Object>* begin,
+                                       const std::shared_ptr<Object>* end);
@@ -0,0 +1,145 @@
+#include <cstdint>
+#include <mutex>
+#include <new>
+
+#include "error.h"
+#include "heap.h"
+
+namespace {
+
+// A block may outlive the thread that allocated it, so heaps are never destroyed. When
+// a thread exits its heap is parked here and adopted by the next thread that needs one.
+// Neither is the list, so that the heaps stay reachable after static destructors ran.
+std::mutex idle_heaps_mutex;
+std::vector<Heap*>& idle_heaps = *new std::vector<Heap*>;
+
+thread_local Heap* local_heap = nullptr;
+
+struct HeapReleaser {
+    ~HeapReleaser() {
+        std::lock_guard lock(idle_heaps_mutex);
+        idle_heaps.push_back(local_heap);
+        local_heap = nullptr;
+    }
+};
+
+thread_local HeapReleaser releaser;
+
+}  // namespace
+
+Heap& Heap::Local() {
+    if (!local_heap) {
+        std::lock_guard lock(idle_heaps_mutex);
+        if (idle_heaps.empty()) {
+            local_heap = new Heap;
+        } else {
+            local_heap = idle_heaps.back();
+            idle_heaps.pop_back();
+        }
+        (void)&releaser;
+    }
+    return *local_heap;
+}
+
+void* Heap::Allocate(std::size_t size) {
+    if (limit_ && GetLiveBytes() + size > limit_) {
+        throw RuntimeError("Heap limit exceeded");
+    }
+    if (stats_.allocated_bytes + size > budget_end_) {
+        throw ResourceLimitError("Allocation limit exceeded");
+    }
+    ++stats_.allocations;
+    stats_.allocated_bytes += size;
+    if (size > kMaxSmallSize) {
+        auto block = static_cast<char*>(::operator new(sizeof(BlockHeader) + size));
+        new (block) BlockHeader{this};
+        return block + sizeof(BlockHeader);
+    }
+
+    auto size_class = (size - 1) / kGranularity;
+    auto block = free_lists_[size_class];
+    if (!block && remote_free_lists_[size_class].load(std::memory_order_relaxed)) {
+        block = remote_free_lists_[size_class].exchange(nullptr, std::memory_order_acquire);
+    }
+    if (block) {
+        free_lists_[size_class] = block->next;
+        return block;
+    }
+    auto rounded = (size_class + 1) * kGranularity;
+    if (bump_end_ - bump_ < static_cast<std::ptrdiff_t>(rounded)) {
+        auto page = static_cast<char*>(::operator new(kPageSize, std::align_val_t(kPageSize)));
+        pages_.emplace_back(page);
+        new (page) BlockHeader{this};
+        bump_ = page + sizeof(BlockHeader);
+        bump_end_ = page + kPageSize;
+        ++stats_.pages;
+    }
+    void* result = bump_;
+    bump_ += rounded;
+    return result;
+}
+
+void Heap::Deallocate(void* ptr, std::size_t size) {
+    auto owner = GetOwner(ptr, size);
+    if (owner == local_heap) {
+        owner->Free(ptr, size);
+    } else {
+        owner->FreeRemote(ptr, size);
+    }
+}
+
+HeapStats Heap::GetStats() const {
+    auto stats = stats_;
+    stats.deallocations += remote_deallocations_.load(std::memory_order_relaxed);
+    stats.freed_bytes += remote_freed_bytes_.load(std::memory_order_relaxed);
+    return stats;
+}
+
+void Heap::PageDeleter::operator()(char* page) const {
+    ::operator delete(page, std::align_val_t(kPageSize));
+}
+
+Heap* Heap::GetOwner(void* ptr, std::size_t size) {
+    auto address = reinterpret_cast<std::uintptr_t>(ptr);
+    if (size > kMaxSmallSize) {
+        address -= sizeof(BlockHeader);
+    } else {
+        address &= ~(kPageSize - 1);
+    }
+    return reinterpret_cast<BlockHeader*>(address)->owner;
+}
+
+void Heap::Free(void* ptr, std::size_t size) {
+    ++stats_.deallocations;
+    stats_.freed_bytes += size;
+    if (size > kMaxSmallSize) {
+        ::operator delete(static_cast<char*>(ptr) - sizeof(BlockHeader));
+        return;
+    }
+    auto size_class = (size - 1) / kGranularity;
+    auto block = static_cast<FreeBlock*>(ptr);
+    block->next = free_lists_[size_class];
+    free_lists_[size_class] = block;
+}
+
+void Heap::FreeRemote(void* ptr, std::size_t size) {
+    remote_deallocations_.fetch_add(1, std::memory_order_relaxed);
+    remote_freed_bytes_.fetch_add(size, std::memory_order_relaxed);
+    if (size > kMaxSmallSize) {
+        ::operator delete(static_cast<char*>(ptr) - sizeof(BlockHeader));
+        return;
+    }
+    // Other threads only push, and the owner takes the whole list at once, so a block
+    // cannot leave and come back while a push is pending.
+    auto& list = remote_free_lists_[(size - 1) / kGranularity];
+    auto block = static_cast<FreeBlock*>(ptr);
+    block->next = list.load(std::memory_order_relaxed);
+    while (!list.compare_exchange_weak(block->next, block, std::memory_order_release,
+                                       std::memory_order_relaxed)) {
+    }
+}
+
+std::size_t Heap::GetLiveBytes() const {
+    return stats_.allocated_bytes - stats_.freed_bytes -
+           remote_freed_bytes_.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,143 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <limits>
+#include <memory>
+#include <utility>
+#include <vector>
+
+struct HeapStats {
+    std::size_t allocations = 0;
+    std::size_t deallocations = 0;
+    std::size_t allocated_bytes = 0;
+    std::size_t freed_bytes = 0;
+    std::size_t pages = 0;
+
+    std::size_t GetLiveBytes() const {
+        return allocated_bytes - freed_bytes;
+    }
+};
+
+// Per-thread pool for interpreter objects. Small blocks are carved from 64 KiB pages by
+// bumping a pointer and recycled through one free list per 16-byte size class; larger
+// ones go to the global allocator. Every block goes back to the heap it came from, also
+// when another thread frees it: that thread pushes it on a list of the heap that its owner
+// takes over once its own free list of the size class runs out.
+class Heap {
+public:
+    static Heap& Local();
+
+    void* Allocate(std::size_t size);
+
+    // Returns the block to the heap that allocated it, from any thread.
+    static void Deallocate(void* ptr, std::size_t size);
+
+    // Allocations taking the live bytes of this heap beyond the limit throw RuntimeError;
+    // zero means no limit. Blocks of the heap count until they are freed, by whichever
+    // thread.
+    void SetLimit(std::size_t bytes) {
+        limit_ = bytes;
+    }
+
+    std::size_t GetLimit() const {
+        return limit_;
+    }
+
+    // Allocations taking allocated_bytes past the end throw ResourceLimitError; unlike the
+    // limit, bytes freed again still count. Used by Budget.
+    void SetBudgetEnd(std::size_t allocated_bytes) {
+        budget_end_ = allocated_bytes;
+    }
+
+    std::size_t GetBudgetEnd() const {
+        return budget_end_;
+    }
+
+    HeapStats GetStats() const;
+
+private:
+    static constexpr std::size_t kPageSize = 64 * 1024;
+    static constexpr std::size_t kGranularity = 16;
+    static constexpr std::size_t kMaxSmallSize = 512;
+    static constexpr std::size_t kSizeClasses = kMaxSmallSize / kGranularity;
+
+    struct FreeBlock {
+        FreeBlock* next;
+    };
+
+    // Pages are aligned to their size and start with this, and so do large blocks, so that
+    // the owner of a block is found from its address.
+    struct alignas(kGranularity) BlockHeader {
+        Heap* owner;
+    };
+
+    struct PageDeleter {
+        void operator()(char* page) const;
+    };
+
+    Heap() = default;
+
+    static Heap* GetOwner(void* ptr, std::size_t size);
+
+    void Free(void* ptr, std::size_t size);
+
+    void FreeRemote(void* ptr, std::size_t size);
+
+    std::size_t GetLiveBytes() const;
+
+    std::array<FreeBlock*, kSizeClasses> free_lists_{};
+    char* bump_ = nullptr;
+    char* bump_end_ = nullptr;
+    std::vector<std::unique_ptr<char[], PageDeleter>> pages_;
+
+    std::size_t limit_ = 0;
+    std::size_t budget_end_ = std::numeric_limits<std::size_t>::max();
+    HeapStats stats_;
+
+    // Blocks freed by other threads, and what they are counted as.
+    std::array<std::atomic<FreeBlock*>, kSizeClasses> remote_free_lists_{};
+    std::atomic<std::size_t> remote_deallocations_ = 0, remote_freed_bytes_ = 0;
+};
+
+template <class T>
+class HeapAllocator {
+public:
+    using value_type = T;
+
+    HeapAllocator() = default;
+
+    template <class U>
+    HeapAllocator(const HeapAllocator<U>&) {
+    }
+
+    T* allocate(std::size_t n) {
+        return static_cast<T*>(Heap::Local().Allocate(n * sizeof(T)));
+    }
+
+    void deallocate(T* ptr, std::size_t n) {
+        Heap::Deallocate(ptr, n * sizeof(T));
+    }
+
+    template <class U>
+    bool operator==(const HeapAllocator<U>&) const {
+        return true;
+    }
+};
+
+class Object;
+
+// Registers an object with the cycle collector of this thread; see collector.h.
+void TrackForCollection(const std::shared_ptr<Object>& object);
+
+// Object and control block share one block from the local heap. Types that set
+// kMayFormCycles are tracked by the cycle collector.
+template <class T, class... Args>
+std::shared_ptr<T> Allocate(Args&&... args) {
+    auto object = std::allocate_shared<T>(HeapAllocator<T>(), std::forward<Args>(args)...);
+    if constexpr (requires { requires T::kMayFormCycles; }) {
+        TrackForCollection(object);
+    }
+    return object;
+}
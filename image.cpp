@@ -0,0 +1,1087 @@
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <ostream>
+#include <span>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "analyzer.h"
+#include "closure.h"
+#include "image.h"
+#include "mapped_file.h"
+#include "scheme.h"
+
+namespace {
+
+constexpr char kMagic[8] = {'S', 'C', 'M', 'I', 'M', 'G', '\r', '\n'};
+constexpr uint32_t kVersion = 2;
+
+// Object index standing for '().
+constexpr uint32_t kNil = UINT32_MAX;
+
+// Every section starts at a multiple of this many bytes, so records can be read in place.
+constexpr std::size_t kAlignment = 8;
+
+// The image starts with the header, followed by these sections in order:
+//
+//   Record records[object_count];
+//   Binding bindings[binding_count];
+//   uint64_t words[word_count];          elements of vectors and s64vectors, fields of nodes
+//   uint32_t string_ends[string_count];  end offset of every string in the text
+//   char text[text_size];                symbol names and digits of big numbers
+struct Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t object_count;
+    uint32_t binding_count;
+    uint32_t string_count;
+    uint64_t word_count;
+    uint64_t text_size;
+};
+
+enum class RecordKind : uint32_t {
+    INTEGER,      // b: the value
+    BIG_INTEGER,  // a: string of its decimal digits
+    SYMBOL,       // a: string of its name
+    BOOLEAN,      // a: the value
+    CELL,         // a, b: objects of the first and second element
+    VECTOR,       // a: size, b: first word; the words are objects
+    S64VECTOR,    // a: size, b: first word; the words are the values
+    BUILTIN,      // a: string of the name it is bound to in a new interpreter
+    BOX,          // a: object of its value
+
+    // Closures and the analyzed code of their lambdas. These records are nodes: a is the
+    // number of objects the node refers to and b the first of their words, which are
+    // followed by a count and that many numbers. Symbols stand for the names in the code.
+    CLOSURE,           // objects: the lambda, then the captures
+    CONSTANT,          // objects: the value
+    GLOBAL_REF,        // objects: the name
+    LOCAL_REF,         // numbers: slot, whether it is boxed
+    CAPTURED_REF,      // numbers: index, whether it is boxed
+    SELF_REF,          //
+    CALL,              // objects: head, bound function, args; numbers: whether in tail position
+    ASSIGNMENT,        // objects: name, value; numbers: whether it is a definition
+    LOCAL_ASSIGNMENT,  // objects: value; numbers: index, whether captured, whether boxed
+    IF,                // objects: condition, consequent, alternative
+    LAMBDA,            // objects: name, body nodes; numbers: parameter count, whether it has
+                       // a rest parameter, frame size, capture count, kind and index of each
+                       // capture, boxed slot count, boxed slots
+    LET                // objects: inits, body nodes; numbers: frame size, binding count, slot
+                       // of each binding, boxed slot count, boxed slots
+};
+
+bool IsNode(RecordKind kind) {
+    return kind >= RecordKind::CLOSURE && kind <= RecordKind::LET;
+}
+
+struct Record {
+    RecordKind kind;
+    uint32_t a;
+    uint64_t b;
+};
+
+struct Binding {
+    uint32_t name;
+    uint32_t value;
+};
+
+static_assert(sizeof(Header) % kAlignment == 0);
+static_assert(sizeof(Record) == 16);
+
+std::size_t Align(std::size_t size) {
+    return (size + kAlignment - 1) / kAlignment * kAlignment;
+}
+
+uint32_t CheckSize(std::size_t size) {
+    if (size >= kNil) {
+        throw RuntimeError("Too many objects for an image");
+    }
+    return size;
+}
+
+class ImageWriter {
+public:
+    ImageWriter() {
+        for (const auto& [id, builtin] : Interpreter::GetSharedBuiltins()) {
+            builtin_names_.emplace(builtin.get(), id);
+        }
+    }
+
+    void AddBinding(SymbolId id, const std::shared_ptr<Object>& value) {
+        bindings_.push_back({AddSymbol(id), AddValue(value)});
+    }
+
+    void Write(std::ostream* out) const {
+        Header header{};
+        std::memcpy(header.magic, kMagic, sizeof(kMagic));
+        header.version = kVersion;
+        header.object_count = records_.size();
+        header.binding_count = bindings_.size();
+        header.string_count = string_ends_.size();
+        header.word_count = words_.size();
+        header.text_size = text_.size();
+        WriteSection(&header, sizeof(header), out);
+        WriteSection(records_.data(), records_.size() * sizeof(Record), out);
+        WriteSection(bindings_.data(), bindings_.size() * sizeof(Binding), out);
+        WriteSection(words_.data(), words_.size() * sizeof(uint64_t), out);
+        WriteSection(string_ends_.data(), string_ends_.size() * sizeof(uint32_t), out);
+        WriteSection(text_.data(), text_.size(), out);
+    }
+
+private:
+    static void WriteSection(const void* data, std::size_t size, std::ostream* out) {
+        static constexpr char kPadding[kAlignment] = {};
+        out->write(static_cast<const char*>(data), size);
+        out->write(kPadding, Align(size) - size);
+    }
+
+    uint32_t AddString(std::string_view text) {
+        text_ += text;
+        string_ends_.push_back(text_.size());
+        return string_ends_.size() - 1;
+    }
+
+    uint32_t AddSymbol(SymbolId id) {
+        auto [it, inserted] = symbol_strings_.emplace(id, 0);
+        if (inserted) {
+            it->second = AddString(SymbolTable::Instance().GetName(id));
+        }
+        return it->second;
+    }
+
+    // Lists and vectors are followed with a work list rather than recursion, since they can
+    // be arbitrarily long or deep.
+    uint32_t AddValue(const std::shared_ptr<Object>& value) {
+        auto index = Reserve(value.get());
+        while (!pending_.empty()) {
+            auto [object, record] = pending_.back();
+            pending_.pop_back();
+            records_[record] = MakeRecord(object);
+        }
+        return index;
+    }
+
+    // Index of the object's record, which is filled in later if the object is new.
+    uint32_t Reserve(const Object* object) {
+        if (!object) {
+            return kNil;
+        }
+        auto [it, inserted] = indices_.emplace(object, records_.size());
+        if (inserted) {
+            CheckSize(records_.size());
+            records_.emplace_back();
+            pending_.emplace_back(object, it->second);
+        }
+        return it->second;
+    }
+
+    Record AddNode(RecordKind kind, const std::vector<const Object*>& objects,
+                   const std::vector<uint64_t>& numbers) {
+        auto first = words_.size();
+        for (auto object : objects) {
+            words_.push_back(Reserve(object));
+        }
+        words_.push_back(numbers.size());
+        words_.insert(words_.end(), numbers.begin(), numbers.end());
+        return {kind, CheckSize(objects.size()), first};
+    }
+
+    static void AddBody(const Body& body, std::vector<const Object*>* objects,
+                        std::vector<uint64_t>* numbers) {
+        for (const auto& node : body.nodes) {
+            objects->push_back(node.get());
+        }
+        numbers->push_back(body.boxed_slots.size());
+        numbers->insert(numbers->end(), body.boxed_slots.begin(), body.boxed_slots.end());
+    }
+
+    // The function a call is bound to is only kept if it can be stored; otherwise the call
+    // looks its head up when it runs.
+    const Object* GetStorableFunction(const Call& call) const {
+        auto function = call.GetFunction().get();
+        if (function &&
+            (GetType(function) == Type::CLOSURE || builtin_names_.contains(function))) {
+            return function;
+        }
+        return nullptr;
+    }
+
+    Record MakeRecord(const Object* object) {
+        switch (GetType(object)) {
+            case Type::NUMBER: {
+                NumberValue number(object);
+                if (number.IsBig()) {
+                    return {RecordKind::BIG_INTEGER, AddString(number.GetBig().ToString()), 0};
+                }
+                return {RecordKind::INTEGER, 0, std::bit_cast<uint64_t>(number.GetValue())};
+            }
+            case Type::SYMBOL:
+                return {RecordKind::SYMBOL, AddSymbol(static_cast<const Symbol*>(object)->GetId()),
+                        0};
+            case Type::BOOLEAN:
+                return {RecordKind::BOOLEAN, static_cast<const Boolean*>(object)->GetValue(), 0};
+            case Type::CELL: {
+                auto cell = static_cast<const Cell*>(object);
+                return {RecordKind::CELL, Reserve(cell->GetFirst().get()),
+                        Reserve(cell->GetSecond().get())};
+            }
+            case Type::VECTOR: {
+                const auto& elements = static_cast<const Vector*>(object)->GetElements();
+                auto first = words_.size();
+                words_.resize(first + elements.size());
+                for (std::size_t i = 0; i < elements.size(); ++i) {
+                    words_[first + i] = Reserve(elements[i].get());
+                }
+                return {RecordKind::VECTOR, CheckSize(elements.size()), first};
+            }
+            case Type::S64VECTOR: {
+                auto vector = static_cast<const S64Vector*>(object);
+                auto first = words_.size();
+                words_.resize(first + vector->GetSize());
+                std::memcpy(words_.data() + first, vector->GetData(),
+                            vector->GetSize() * sizeof(int64_t));
+                return {RecordKind::S64VECTOR, CheckSize(vector->GetSize()), first};
+            }
+            case Type::FUNCTION:
+                if (auto it = builtin_names_.find(object); it != builtin_names_.end()) {
+                    return {RecordKind::BUILTIN, AddSymbol(it->second), 0};
+                }
+                break;
+            case Type::BOX:
+                return {RecordKind::BOX, Reserve(static_cast<const Box*>(object)->Get().get()),
+                        0};
+            case Type::CLOSURE: {
+                auto closure = static_cast<const Closure*>(object);
+                std::vector<const Object*> objects = {&closure->GetLambda()};
+                for (const auto& capture : closure->GetCaptures()) {
+                    objects.push_back(capture.get());
+                }
+                return AddNode(RecordKind::CLOSURE, objects, {});
+            }
+            case Type::CONSTANT:
+                return AddNode(RecordKind::CONSTANT,
+                               {static_cast<const Constant*>(object)->GetValue().get()}, {});
+            case Type::GLOBAL_REF: {
+                auto id = static_cast<const GlobalRef*>(object)->GetId();
+                return AddNode(RecordKind::GLOBAL_REF, {Symbol::Get(id).get()}, {});
+            }
+            case Type::LOCAL_REF: {
+                auto ref = static_cast<const LocalRef*>(object);
+                return AddNode(RecordKind::LOCAL_REF, {}, {ref->GetSlot(), ref->IsBoxed()});
+            }
+            case Type::CAPTURED_REF: {
+                auto ref = static_cast<const CapturedRef*>(object);
+                return AddNode(RecordKind::CAPTURED_REF, {}, {ref->GetIndex(), ref->IsBoxed()});
+            }
+            case Type::SELF_REF:
+                return AddNode(RecordKind::SELF_REF, {}, {});
+            case Type::CALL: {
+                // Folded values are dropped along with the version they depend on.
+                auto call = static_cast<const Call*>(object);
+                return AddNode(RecordKind::CALL,
+                               {call->GetHead().get(), GetStorableFunction(*call),
+                                call->GetArgs().get()},
+                               {call->IsTail()});
+            }
+            case Type::ASSIGNMENT: {
+                auto assignment = static_cast<const Assignment*>(object);
+                return AddNode(RecordKind::ASSIGNMENT,
+                               {Symbol::Get(assignment->GetId()).get(),
+                                assignment->GetValue().get()},
+                               {assignment->IsDefinition()});
+            }
+            case Type::LOCAL_ASSIGNMENT: {
+                auto assignment = static_cast<const LocalAssignment*>(object);
+                return AddNode(RecordKind::LOCAL_ASSIGNMENT, {assignment->GetValue().get()},
+                               {assignment->GetIndex(), assignment->IsCaptured(),
+                                assignment->IsBoxed()});
+            }
+            case Type::IF: {
+                auto node = static_cast<const If*>(object);
+                return AddNode(RecordKind::IF,
+                               {node->GetCondition().get(), node->GetConsequent().get(),
+                                node->GetAlternative().get()},
+                               {});
+            }
+            case Type::LAMBDA: {
+                auto lambda = static_cast<const Lambda*>(object);
+                std::vector<const Object*> objects = {
+                    lambda->GetName() ? Symbol::Get(*lambda->GetName()).get() : nullptr};
+                std::vector<uint64_t> numbers = {lambda->GetParamCount(), lambda->HasRest(),
+                                                 lambda->GetFrameSize(),
+                                                 lambda->GetCaptures().size()};
+                for (const auto& source : lambda->GetCaptures()) {
+                    numbers.push_back(static_cast<uint64_t>(source.kind));
+                    numbers.push_back(source.index);
+                }
+                AddBody(lambda->GetBody(), &objects, &numbers);
+                return AddNode(RecordKind::LAMBDA, objects, numbers);
+            }
+            case Type::LET: {
+                auto let = static_cast<const Let*>(object);
+                std::vector<const Object*> objects;
+                std::vector<uint64_t> numbers = {let->GetFrameSize(), let->GetBindings().size()};
+                for (const auto& [slot, init] : let->GetBindings()) {
+                    objects.push_back(init.get());
+                    numbers.push_back(slot);
+                }
+                AddBody(let->GetBody(), &objects, &numbers);
+                return AddNode(RecordKind::LET, objects, numbers);
+            }
+            default:
+                break;
+        }
+        throw RuntimeError("Cannot store this value in an image");
+    }
+
+    std::unordered_map<const Object*, SymbolId> builtin_names_;
+    std::unordered_map<const Object*, uint32_t> indices_;
+    std::unordered_map<SymbolId, uint32_t> symbol_strings_;
+    std::vector<std::pair<const Object*, uint32_t>> pending_;
+
+    std::vector<Record> records_;
+    std::vector<Binding> bindings_;
+    std::vector<uint64_t> words_;
+    std::vector<uint32_t> string_ends_;
+    std::string text_;
+};
+
+[[noreturn]] void ThrowInvalidImage() {
+    throw RuntimeError("Invalid image");
+}
+
+// Checked views of the sections of an image.
+class ImageReader {
+public:
+    explicit ImageReader(std::string_view image) : image_(image) {
+        if (reinterpret_cast<uintptr_t>(image.data()) % kAlignment) {
+            throw RuntimeError("Image is not aligned");
+        }
+        auto header = Take<Header>(1);
+        if (std::memcmp(header->magic, kMagic, sizeof(kMagic)) || header->version != kVersion) {
+            ThrowInvalidImage();
+        }
+        records_ = {Take<Record>(header->object_count), header->object_count};
+        bindings_ = {Take<Binding>(header->binding_count), header->binding_count};
+        words_ = {Take<uint64_t>(header->word_count), header->word_count};
+        string_ends_ = {Take<uint32_t>(header->string_count), header->string_count};
+        text_ = {Take<char>(header->text_size), header->text_size};
+        uint32_t begin = 0;
+        for (auto end : string_ends_) {
+            if (end < begin || end > text_.size()) {
+                ThrowInvalidImage();
+            }
+            begin = end;
+        }
+    }
+
+    std::span<const Record> GetRecords() const {
+        return records_;
+    }
+
+    std::span<const Binding> GetBindings() const {
+        return bindings_;
+    }
+
+    std::span<const uint64_t> GetWords(uint64_t first, uint64_t size) const {
+        if (first > words_.size() || size > words_.size() - first) {
+            ThrowInvalidImage();
+        }
+        return words_.subspan(first, size);
+    }
+
+    std::string_view GetString(uint32_t index) const {
+        if (index >= string_ends_.size()) {
+            ThrowInvalidImage();
+        }
+        auto begin = index ? string_ends_[index - 1] : 0;
+        return text_.substr(begin, string_ends_[index] - begin);
+    }
+
+    uint32_t CheckObject(uint64_t index) const {
+        if (index != kNil && index >= records_.size()) {
+            ThrowInvalidImage();
+        }
+        return index;
+    }
+
+    struct NodeFields {
+        std::span<const uint64_t> objects, numbers;
+    };
+
+    NodeFields GetNodeFields(const Record& record) const {
+        auto objects = GetWords(record.b, record.a);
+        for (auto word : objects) {
+            CheckObject(word);
+        }
+        auto count = GetWords(record.b + record.a, 1)[0];
+        return {objects, GetWords(record.b + record.a + 1, count)};
+    }
+
+private:
+    template <class T>
+    const T* Take(uint64_t count) {
+        if (count > (image_.size() - offset_) / sizeof(T)) {
+            ThrowInvalidImage();
+        }
+        auto data = reinterpret_cast<const T*>(image_.data() + offset_);
+        offset_ = std::min(image_.size(), offset_ + Align(count * sizeof(T)));
+        return data;
+    }
+
+    std::string_view image_;
+    std::size_t offset_ = 0;
+
+    std::span<const Record> records_;
+    std::span<const Binding> bindings_;
+    std::span<const uint64_t> words_;
+    std::span<const uint32_t> string_ends_;
+    std::string_view text_;
+};
+
+// Reads the numbers of a node in order.
+class NumberReader {
+public:
+    explicit NumberReader(std::span<const uint64_t> numbers) : numbers_(numbers) {
+    }
+
+    uint64_t Next() {
+        if (position_ == numbers_.size()) {
+            ThrowInvalidImage();
+        }
+        return numbers_[position_++];
+    }
+
+    uint64_t NextAtMost(uint64_t max) {
+        auto number = Next();
+        if (number > max) {
+            ThrowInvalidImage();
+        }
+        return number;
+    }
+
+    bool NextBool() {
+        return NextAtMost(1);
+    }
+
+    std::size_t GetLeft() const {
+        return numbers_.size() - position_;
+    }
+
+    void Finish() const {
+        if (position_ != numbers_.size()) {
+            ThrowInvalidImage();
+        }
+    }
+
+private:
+    std::span<const uint64_t> numbers_;
+    std::size_t position_ = 0;
+};
+
+class ObjectTable {
+public:
+    explicit ObjectTable(std::size_t size) : objects_(size) {
+    }
+
+    std::shared_ptr<Object>& operator[](std::size_t index) {
+        return objects_[index];
+    }
+
+    std::shared_ptr<Object> Get(uint64_t index) const {
+        return index == kNil ? nullptr : objects_[index];
+    }
+
+    template <class T>
+    std::shared_ptr<T> GetAs(uint64_t index) const {
+        auto object = Get(index);
+        if (!Is<T>(object)) {
+            ThrowInvalidImage();
+        }
+        return std::static_pointer_cast<T>(std::move(object));
+    }
+
+    SymbolId GetName(uint64_t index) const {
+        return GetAs<Symbol>(index)->GetId();
+    }
+
+private:
+    std::vector<std::shared_ptr<Object>> objects_;
+};
+
+Body ReadBody(std::span<const uint64_t> nodes, NumberReader* numbers, const ObjectTable& objects) {
+    if (nodes.empty()) {
+        ThrowInvalidImage();
+    }
+    Body body;
+    body.boxed_slots.resize(numbers->NextAtMost(numbers->GetLeft()));
+    for (auto& slot : body.boxed_slots) {
+        slot = numbers->Next();
+    }
+    for (auto node : nodes) {
+        body.nodes.push_back(objects.Get(node));
+    }
+    return body;
+}
+
+// Makes a node once the objects it refers to are made.
+std::shared_ptr<Object> MakeNode(const Record& record, const ImageReader::NodeFields& fields,
+                                 const ObjectTable& objects, const std::shared_ptr<Scope>& scope) {
+    auto refs = fields.objects;
+    NumberReader numbers(fields.numbers);
+    auto expect_refs = [&refs](std::size_t count) {
+        if (refs.size() != count) {
+            ThrowInvalidImage();
+        }
+    };
+    std::shared_ptr<Object> node;
+    switch (record.kind) {
+        case RecordKind::CLOSURE: {
+            if (refs.empty()) {
+                ThrowInvalidImage();
+            }
+            auto lambda = objects.GetAs<Lambda>(refs[0]);
+            if (refs.size() - 1 != lambda->GetCaptures().size()) {
+                ThrowInvalidImage();
+            }
+            Closure::Captures captures;
+            for (auto capture : refs.subspan(1)) {
+                captures.push_back(objects.Get(capture));
+            }
+            node = Allocate<Closure>(std::move(lambda), scope->GetGlobal().shared_from_this(),
+                                     std::move(captures));
+            break;
+        }
+        case RecordKind::CONSTANT:
+            expect_refs(1);
+            node = Allocate<Constant>(objects.Get(refs[0]));
+            break;
+        case RecordKind::GLOBAL_REF:
+            expect_refs(1);
+            node = Allocate<GlobalRef>(objects.GetName(refs[0]));
+            break;
+        case RecordKind::LOCAL_REF: {
+            expect_refs(0);
+            auto ref = Allocate<LocalRef>(numbers.Next());
+            if (numbers.NextBool()) {
+                ref->SetBoxed();
+            }
+            node = std::move(ref);
+            break;
+        }
+        case RecordKind::CAPTURED_REF: {
+            expect_refs(0);
+            auto ref = Allocate<CapturedRef>(numbers.Next());
+            if (numbers.NextBool()) {
+                ref->SetBoxed();
+            }
+            node = std::move(ref);
+            break;
+        }
+        case RecordKind::SELF_REF:
+            expect_refs(0);
+            node = Allocate<SelfRef>();
+            break;
+        case RecordKind::CALL: {
+            expect_refs(3);
+            auto head = objects.Get(refs[0]);
+            auto function = objects.Get(refs[1]);
+            // Calls of a bound function look its name up to check the binding.
+            if (!head || (function && !Is<GlobalRef>(head))) {
+                ThrowInvalidImage();
+            }
+            // No scope has version 0, so the function is used only while the name is bound
+            // to it.
+            node = Allocate<Call>(std::move(head), std::move(function), 0, objects.Get(refs[2]),
+                                  numbers.NextBool());
+            break;
+        }
+        case RecordKind::ASSIGNMENT:
+            expect_refs(2);
+            node = Allocate<Assignment>(objects.GetName(refs[0]), objects.Get(refs[1]),
+                                        numbers.NextBool());
+            break;
+        case RecordKind::LOCAL_ASSIGNMENT: {
+            expect_refs(1);
+            auto index = numbers.Next();
+            auto is_captured = numbers.NextBool();
+            auto assignment = Allocate<LocalAssignment>(index, is_captured, objects.Get(refs[0]));
+            if (numbers.NextBool()) {
+                assignment->SetBoxed();
+            }
+            node = std::move(assignment);
+            break;
+        }
+        case RecordKind::IF:
+            expect_refs(3);
+            node = Allocate<If>(objects.Get(refs[0]), objects.Get(refs[1]),
+                                objects.Get(refs[2]));
+            break;
+        case RecordKind::LAMBDA: {
+            if (refs.empty()) {
+                ThrowInvalidImage();
+            }
+            auto param_count = numbers.Next();
+            auto has_rest = numbers.NextBool();
+            auto frame_size = numbers.NextAtMost(kMaxFrameSize);
+            std::vector<CaptureSource> captures(numbers.NextAtMost(numbers.GetLeft() / 2));
+            for (auto& source : captures) {
+                source.kind = static_cast<CaptureSource::Kind>(
+                    numbers.NextAtMost(static_cast<uint64_t>(CaptureSource::Kind::SELF)));
+                source.index = numbers.Next();
+            }
+            auto body = ReadBody(refs.subspan(1), &numbers, objects);
+            auto lambda = Allocate<Lambda>(param_count, has_rest, frame_size,
+                                           std::move(captures), std::move(body));
+            if (refs[0] != kNil) {
+                lambda->SetName(objects.GetName(refs[0]));
+            }
+            node = std::move(lambda);
+            break;
+        }
+        case RecordKind::LET: {
+            auto frame_size = numbers.NextAtMost(kMaxFrameSize);
+            auto binding_count = numbers.NextAtMost(refs.size());
+            Let::Bindings bindings;
+            for (std::size_t i = 0; i < binding_count; ++i) {
+                bindings.emplace_back(numbers.Next(), objects.Get(refs[i]));
+            }
+            auto body = ReadBody(refs.subspan(binding_count), &numbers, objects);
+            node = Allocate<Let>(frame_size, std::move(bindings), std::move(body));
+            break;
+        }
+        default:
+            ThrowInvalidImage();
+    }
+    numbers.Finish();
+    return node;
+}
+
+enum class VisitState : uint8_t { NEW, VISITING, DONE };
+
+// Calls visit(index) for every record in state NEW, each after the records in state NEW it
+// refers to, which for_each_reference(index, callback) passes to the callback. Records that
+// refer to each other in a cycle make the image invalid. Follows the references with a work
+// list, as they can nest arbitrarily deep.
+template <class ForEachReference, class Visit>
+void VisitInOrder(std::vector<VisitState>* states, ForEachReference for_each_reference,
+                  Visit visit) {
+    std::vector<uint32_t> stack;
+    auto push = [states, &stack](uint64_t index) {
+        if (index == kNil || (*states)[index] == VisitState::DONE) {
+            return;
+        }
+        // Only the records on the path to the one being visited are in this state.
+        if ((*states)[index] == VisitState::VISITING) {
+            ThrowInvalidImage();
+        }
+        stack.push_back(index);
+    };
+    for (std::size_t i = 0; i < states->size(); ++i) {
+        if ((*states)[i] != VisitState::NEW) {
+            continue;
+        }
+        stack.push_back(i);
+        while (!stack.empty()) {
+            auto index = stack.back();
+            auto& state = (*states)[index];
+            if (state == VisitState::NEW) {
+                state = VisitState::VISITING;
+                for_each_reference(index, push);
+            } else {
+                if (state == VisitState::VISITING) {
+                    visit(index);
+                    state = VisitState::DONE;
+                }
+                stack.pop_back();
+            }
+        }
+    }
+}
+
+// Checks that the code of closures only uses what the frames it runs in have: slots below the
+// frame size, captures the closure has, the running closure only inside a lambda, and boxes
+// only where the variable holds one. Walks the code with a work list from every closure, in
+// the order it runs, so it knows which slots of each frame are boxed at every node. The nodes
+// of analyzed code form a tree, except that the lambda of a closure made at run time is also
+// part of the code it was made in; other nodes met twice make the image invalid.
+class CodeChecker {
+public:
+    void CheckClosure(const Closure& closure) {
+        std::vector<bool> boxed_captures;
+        for (const auto& capture : closure.GetCaptures()) {
+            boxed_captures.push_back(Is<Box>(capture));
+        }
+        PushLambda(closure.GetLambda(), std::move(boxed_captures));
+        Run();
+    }
+
+private:
+    struct Frame {
+        std::size_t size;
+        std::vector<bool> boxed_captures;
+        bool has_closure;
+        // Slots put in a box by the bodies the walk is in.
+        std::vector<bool> boxed_slots;
+    };
+
+    // A node to check, or the start or end of a body, which boxes or unboxes its slots.
+    struct Task {
+        enum class Kind : uint8_t { NODE, BOX, UNBOX };
+
+        Kind kind;
+        const Object* node;
+        const Body* body;
+        std::size_t frame;
+    };
+
+    void Run() {
+        while (!tasks_.empty()) {
+            auto task = tasks_.back();
+            tasks_.pop_back();
+            auto& frame = frames_[task.frame];
+            if (task.kind == Task::Kind::NODE) {
+                CheckNode(task.node, task.frame);
+                continue;
+            }
+            auto is_boxing = task.kind == Task::Kind::BOX;
+            for (auto slot : task.body->boxed_slots) {
+                if (IsBoxedSlot(frame, slot) == is_boxing) {
+                    ThrowInvalidImage();
+                }
+                frame.boxed_slots[slot] = is_boxing;
+            }
+        }
+    }
+
+    void CheckNode(const Object* node, std::size_t index) {
+        if (!node) {
+            return;
+        }
+        if (HasChildren(GetType(node)) && !seen_.insert(node).second) {
+            ThrowInvalidImage();
+        }
+        const auto& frame = frames_[index];
+        switch (GetType(node)) {
+            case Type::LOCAL_REF: {
+                auto ref = static_cast<const LocalRef*>(node);
+                if (!IsBoxedSlot(frame, ref->GetSlot()) && ref->IsBoxed()) {
+                    ThrowInvalidImage();
+                }
+                break;
+            }
+            case Type::CAPTURED_REF: {
+                auto ref = static_cast<const CapturedRef*>(node);
+                CheckCapture(frame, ref->GetIndex(), ref->IsBoxed());
+                break;
+            }
+            case Type::SELF_REF:
+                if (!frame.has_closure) {
+                    ThrowInvalidImage();
+                }
+                break;
+            case Type::LOCAL_ASSIGNMENT: {
+                auto assignment = static_cast<const LocalAssignment*>(node);
+                if (assignment->IsCaptured()) {
+                    CheckCapture(frame, assignment->GetIndex(), true);
+                } else {
+                    // Storing into a boxed slot unboxed would replace the box its reads expect.
+                    if (IsBoxedSlot(frame, assignment->GetIndex()) != assignment->IsBoxed()) {
+                        ThrowInvalidImage();
+                    }
+                }
+                Push(assignment->GetValue(), index);
+                break;
+            }
+            case Type::ASSIGNMENT:
+                Push(static_cast<const Assignment*>(node)->GetValue(), index);
+                break;
+            case Type::IF: {
+                auto branch = static_cast<const If*>(node);
+                Push(branch->GetAlternative(), index);
+                Push(branch->GetConsequent(), index);
+                Push(branch->GetCondition(), index);
+                break;
+            }
+            case Type::CALL: {
+                auto call = static_cast<const Call*>(node);
+                Push(call->GetArgs(), index);
+                Push(call->GetHead(), index);
+                break;
+            }
+            // Forms the tree walker evaluates as written, such as the arguments of a call.
+            case Type::CELL: {
+                auto cell = static_cast<const Cell*>(node);
+                Push(cell->GetSecond(), index);
+                Push(cell->GetFirst(), index);
+                break;
+            }
+            case Type::LAMBDA:
+                CheckLambda(*static_cast<const Lambda*>(node), frame);
+                break;
+            case Type::LET:
+                CheckLet(*static_cast<const Let*>(node), index);
+                break;
+            default:
+                break;
+        }
+    }
+
+    // Nodes that other nodes may only refer to once.
+    static bool HasChildren(Type type) {
+        switch (type) {
+            case Type::LOCAL_ASSIGNMENT:
+            case Type::ASSIGNMENT:
+            case Type::IF:
+            case Type::CALL:
+            case Type::CELL:
+            case Type::LET:
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    // Whether a variable of the frame holds a box at this point of the code.
+    static bool IsBoxedSlot(const Frame& frame, std::size_t slot) {
+        if (slot >= frame.size) {
+            ThrowInvalidImage();
+        }
+        return frame.boxed_slots[slot];
+    }
+
+    static void CheckCapture(const Frame& frame, std::size_t index, bool is_boxed) {
+        if (index >= frame.boxed_captures.size() || (is_boxed && !frame.boxed_captures[index])) {
+            ThrowInvalidImage();
+        }
+    }
+
+    // A lambda in the code takes its captures from the frame it is made in.
+    void CheckLambda(const Lambda& lambda, const Frame& frame) {
+        std::vector<bool> boxed_captures;
+        for (const auto& source : lambda.GetCaptures()) {
+            switch (source.kind) {
+                case CaptureSource::Kind::SLOT:
+                    boxed_captures.push_back(IsBoxedSlot(frame, source.index));
+                    break;
+                case CaptureSource::Kind::CAPTURE:
+                    CheckCapture(frame, source.index, false);
+                    boxed_captures.push_back(frame.boxed_captures[source.index]);
+                    break;
+                case CaptureSource::Kind::SELF:
+                    if (!frame.has_closure) {
+                        ThrowInvalidImage();
+                    }
+                    boxed_captures.push_back(false);
+                    break;
+            }
+        }
+        PushLambda(lambda, std::move(boxed_captures));
+    }
+
+    // Lambdas are checked once for the captures they get, which are the same wherever their
+    // closures are made.
+    void PushLambda(const Lambda& lambda, std::vector<bool> boxed_captures) {
+        auto [it, is_new] = lambdas_.emplace(&lambda, boxed_captures);
+        if (!is_new) {
+            if (it->second != boxed_captures) {
+                ThrowInvalidImage();
+            }
+            return;
+        }
+        if (lambda.GetParamCount() + lambda.HasRest() > lambda.GetFrameSize()) {
+            ThrowInvalidImage();
+        }
+        frames_.push_back({lambda.GetFrameSize(), std::move(boxed_captures), true,
+                           std::vector<bool>(lambda.GetFrameSize())});
+        PushBody(lambda.GetBody(), frames_.size() - 1);
+    }
+
+    // A let in a function uses its frame; one outside of any makes a frame of its own.
+    void CheckLet(const Let& let, std::size_t index) {
+        if (let.GetFrameSize()) {
+            frames_.push_back(
+                {let.GetFrameSize(), {}, false, std::vector<bool>(let.GetFrameSize())});
+            index = frames_.size() - 1;
+        }
+        const auto& frame = frames_[index];
+        // The values are bound after they are all evaluated, and before the body boxes them.
+        PushBody(let.GetBody(), index);
+        for (auto it = let.GetBindings().rbegin(); it != let.GetBindings().rend(); ++it) {
+            if (IsBoxedSlot(frame, it->first)) {
+                ThrowInvalidImage();
+            }
+            Push(it->second, index);
+        }
+    }
+
+    void PushBody(const Body& body, std::size_t frame) {
+        tasks_.push_back({Task::Kind::UNBOX, nullptr, &body, frame});
+        for (auto it = body.nodes.rbegin(); it != body.nodes.rend(); ++it) {
+            Push(*it, frame);
+        }
+        tasks_.push_back({Task::Kind::BOX, nullptr, &body, frame});
+    }
+
+    void Push(const std::shared_ptr<Object>& node, std::size_t frame) {
+        tasks_.push_back({Task::Kind::NODE, node.get(), nullptr, frame});
+    }
+
+    // A stack: the task pushed last runs first, so nodes are pushed in reverse order.
+    std::vector<Task> tasks_;
+    // A deque does not move its elements as it grows, so frames can be used while others are
+    // added.
+    std::deque<Frame> frames_;
+    std::unordered_set<const Object*> seen_;
+    std::unordered_map<const Lambda*, std::vector<bool>> lambdas_;
+};
+
+}  // namespace
+
+void WriteImage(const Scope& scope, std::ostream* out) {
+    ImageWriter writer;
+    scope.ForEachGlobal([&writer](SymbolId id, const std::shared_ptr<Object>& value) {
+        auto builtin = Interpreter::FindSharedBuiltin(id);
+        if (!builtin || *builtin != value) {
+            writer.AddBinding(id, value);
+        }
+    });
+    writer.Write(out);
+}
+
+void LoadImage(std::string_view image, const std::shared_ptr<Scope>& scope) {
+    ImageReader reader(image);
+    auto& table = SymbolTable::Instance();
+    auto records = reader.GetRecords();
+
+    // Every data object is created before any is linked, as structures modified with
+    // vector-set! can contain themselves.
+    ObjectTable objects(records.size());
+    for (std::size_t i = 0; i < records.size(); ++i) {
+        const auto& record = records[i];
+        if (IsNode(record.kind)) {
+            continue;
+        }
+        switch (record.kind) {
+            case RecordKind::INTEGER:
+                objects[i] = Number::Make(std::bit_cast<int64_t>(record.b));
+                break;
+            case RecordKind::BIG_INTEGER:
+                objects[i] = Number::Make(BigInt::Parse(reader.GetString(record.a)));
+                break;
+            case RecordKind::SYMBOL:
+                objects[i] = Symbol::Get(table.Intern(reader.GetString(record.a)));
+                break;
+            case RecordKind::BOOLEAN:
+                objects[i] = Boolean::Make(record.a);
+                break;
+            case RecordKind::CELL:
+                reader.CheckObject(record.a);
+                reader.CheckObject(record.b);
+                objects[i] = Allocate<Cell>();
+                break;
+            case RecordKind::VECTOR:
+                for (auto word : reader.GetWords(record.b, record.a)) {
+                    reader.CheckObject(word);
+                }
+                objects[i] = Allocate<Vector>(Vector::Elements(record.a));
+                break;
+            case RecordKind::S64VECTOR: {
+                auto words = reader.GetWords(record.b, record.a);
+                objects[i] = Allocate<S64Vector>(S64Vector::Elements(words.begin(), words.end()));
+                break;
+            }
+            case RecordKind::BUILTIN: {
+                auto id = table.Intern(reader.GetString(record.a));
+                auto builtin = Interpreter::FindSharedBuiltin(id);
+                if (!builtin) {
+                    ThrowInvalidImage();
+                }
+                objects[i] = *builtin;
+                break;
+            }
+            case RecordKind::BOX:
+                reader.CheckObject(record.a);
+                objects[i] = Allocate<Box>();
+                break;
+            default:
+                ThrowInvalidImage();
+        }
+    }
+
+    // Cells cannot be changed, so lists only contain themselves through vectors. A cycle of
+    // cells would make printing and list? run forever.
+    std::vector<VisitState> states(records.size(), VisitState::DONE);
+    for (std::size_t i = 0; i < records.size(); ++i) {
+        if (records[i].kind == RecordKind::CELL) {
+            states[i] = VisitState::NEW;
+        }
+    }
+    VisitInOrder(
+        &states,
+        [&records](uint32_t index, const auto& callback) {
+            callback(records[index].a);
+            callback(records[index].b);
+        },
+        [](uint32_t) {});
+
+    // Nodes are only made once everything they refer to is. They can only form cycles
+    // through data, as the nodes of closures are made before the closures themselves.
+    for (std::size_t i = 0; i < records.size(); ++i) {
+        states[i] = IsNode(records[i].kind) ? VisitState::NEW : VisitState::DONE;
+    }
+    VisitInOrder(
+        &states,
+        [&reader, &records](uint32_t index, const auto& callback) {
+            for (auto word : reader.GetNodeFields(records[index]).objects) {
+                callback(word);
+            }
+        },
+        [&](uint32_t index) {
+            objects[index] =
+                MakeNode(records[index], reader.GetNodeFields(records[index]), objects, scope);
+        });
+
+    for (std::size_t i = 0; i < records.size(); ++i) {
+        const auto& record = records[i];
+        if (record.kind == RecordKind::CELL) {
+            auto cell = Cast<Cell>(objects[i]);
+            cell->SetFirst(objects.Get(record.a));
+            cell->SetSecond(objects.Get(record.b));
+        } else if (record.kind == RecordKind::VECTOR) {
+            auto vector = Cast<Vector>(objects[i]);
+            auto words = reader.GetWords(record.b, record.a);
+            for (std::size_t j = 0; j < words.size(); ++j) {
+                vector->Set(j, objects.Get(words[j]));
+            }
+        } else if (record.kind == RecordKind::BOX) {
+            Cast<Box>(objects[i])->Set(objects.Get(record.a));
+        }
+    }
+
+    CodeChecker checker;
+    for (std::size_t i = 0; i < records.size(); ++i) {
+        if (records[i].kind == RecordKind::CLOSURE) {
+            checker.CheckClosure(*Cast<Closure>(objects[i]));
+        }
+    }
+
+    std::vector<std::pair<SymbolId, std::shared_ptr<Object>>> bindings;
+    for (const auto& binding : reader.GetBindings()) {
+        bindings.emplace_back(table.Intern(reader.GetString(binding.name)),
+                              objects.Get(reader.CheckObject(binding.value)));
+    }
+    for (const auto& [id, value] : bindings) {
+        scope->Define(id, value);
+    }
+}
+
+void LoadImageFile(const std::string& path, const std::shared_ptr<Scope>& scope) {
+    MappedFile file(path);
+    LoadImage(file.GetData(), scope);
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <iosfwd>
+#include <memory>
+#include <string>
+#include <string_view>
+
+class Scope;
+
+// Images store the global bindings of an interpreter, so that a prepared environment can be
+// restored without tokenizing, parsing and running its sources again.
+//
+// An image is one block of fixed-size records that refer to each other by index, never by
+// address, so it can be used straight from a read-only mapping at any address. Loading it
+// interns the symbols, looks the builtins up by name and allocates one object per record.
+// Images are only valid for the build that wrote them: the byte order and the record
+// layout are those of the host.
+//
+// Closures are stored with the analyzed code of their lambdas and what they capture, and
+// run in the global scope they are loaded into. Calls in their code check that their names
+// are still bound to the functions they were bound to, and folded calls are evaluated again.
+
+// Writes the global bindings that differ from those of a new interpreter, along with
+// everything they refer to. Shared structure stays shared when loaded. Throws RuntimeError
+// for values that cannot be stored.
+void WriteImage(const Scope& scope, std::ostream* out);
+
+// Defines the bindings stored in the image in the global scope. The data must be aligned to
+// 8 bytes; mappings and allocations always are. Throws RuntimeError if it is not a valid
+// image, in which case no binding is changed. The code of closures is checked to use only
+// the slots and captures its frames have.
+void LoadImage(std::string_view image, const std::shared_ptr<Scope>& scope);
+
+// Maps the file and loads the image it holds.
+void LoadImageFile(const std::string& path, const std::shared_ptr<Scope>& scope);
@@ -0,0 +1,162 @@
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "image.h"
+#include "scheme.h"
+
+// Images written by WriteImage load back to the same values, and corrupted ones are rejected
+// without changing any binding. Exits with a non-zero status if any case fails.
+//
+//   scheme_image_test
+
+namespace {
+
+// Layout of the start of an image, as written by this build: a 40-byte header whose second
+// and third words are the version and the record count, then 16-byte records holding a kind,
+// a 32-bit and a 64-bit field.
+constexpr std::size_t kHeaderSize = 40;
+constexpr std::size_t kRecordSize = 16;
+constexpr uint32_t kCellKind = 4;
+constexpr uint32_t kLocalRefKind = 12;
+constexpr uint32_t kCapturedRefKind = 13;
+constexpr uint32_t kNil = UINT32_MAX;
+
+std::string MakeImage(const std::vector<std::string>& expressions) {
+    Interpreter interpreter;
+    for (const auto& expression : expressions) {
+        interpreter.Run(expression);
+    }
+    std::ostringstream out;
+    WriteImage(*interpreter.GetGlobalScope(), &out);
+    return out.str();
+}
+
+// Points the cell that ends a list back at the first record, which is the cell that starts
+// it when the image holds one list.
+void MakeCellCycle(std::string* image) {
+    uint32_t count;
+    std::memcpy(&count, image->data() + 12, sizeof(count));
+    for (uint32_t i = 0; i < count; ++i) {
+        auto record = image->data() + kHeaderSize + i * kRecordSize;
+        uint32_t kind;
+        uint64_t second;
+        std::memcpy(&kind, record, sizeof(kind));
+        std::memcpy(&second, record + 8, sizeof(second));
+        if (kind == kCellKind && second == kNil) {
+            second = 0;
+            std::memcpy(record + 8, &second, sizeof(second));
+            return;
+        }
+    }
+}
+
+// Sets a number of the first node of the kind. Nodes keep their fields in the words that
+// follow the records and the 8-byte bindings: the objects they refer to, a count, then the
+// numbers.
+void SetNodeNumber(std::string* image, uint32_t node_kind, std::size_t number, uint64_t value) {
+    uint32_t count, binding_count;
+    std::memcpy(&count, image->data() + 12, sizeof(count));
+    std::memcpy(&binding_count, image->data() + 16, sizeof(binding_count));
+    auto words = image->data() + kHeaderSize + count * kRecordSize + binding_count * 8;
+    for (uint32_t i = 0; i < count; ++i) {
+        auto record = image->data() + kHeaderSize + i * kRecordSize;
+        uint32_t kind, object_count;
+        uint64_t first;
+        std::memcpy(&kind, record, sizeof(kind));
+        std::memcpy(&object_count, record + 4, sizeof(object_count));
+        std::memcpy(&first, record + 8, sizeof(first));
+        if (kind == node_kind) {
+            auto position = words + (first + object_count + 1 + number) * sizeof(uint64_t);
+            std::memcpy(position, &value, sizeof(value));
+            return;
+        }
+    }
+}
+
+std::string MakeCorruptedClosure(uint32_t node_kind, std::size_t number, uint64_t value) {
+    auto image = MakeImage({"(define (add n) (lambda (x) (+ x n)))", "(define f (add 2))"});
+    SetNodeNumber(&image, node_kind, number, value);
+    return image;
+}
+
+struct Case {
+    std::string name;
+    std::function<std::string()> image;
+    // Run after loading the image into a new interpreter, or the error of loading it.
+    std::string expression;
+    std::string expected;
+};
+
+const std::vector<Case> kCases = {
+    {"list", [] { return MakeImage({"(define x '(1 2 3))"}); }, "x", "(1 2 3)"},
+    {"list in a vector that contains it",
+     [] {
+         return MakeImage({"(define v (make-vector 1 0))", "(vector-set! v 0 (list 1 v))"});
+     },
+     "v", "#0=#((1 #0#))"},
+    {"numbers on both sides of the immediate range",
+     [] {
+         return MakeImage({"(define x '(4611686018427387903 4611686018427387904 "
+                           "-4611686018427387904 -4611686018427387905 #t #f))"});
+     },
+     "(cons (+ (car x) 1) x)",
+     "(4611686018427387904 4611686018427387903 4611686018427387904 -4611686018427387904 "
+     "-4611686018427387905 #t #f)"},
+    {"closure",
+     [] { return MakeImage({"(define (add n) (lambda (x) (+ x n)))", "(define f (add 2))"}); },
+     "(f 40)", "42"},
+    {"cycle of cells",
+     [] {
+         auto image = MakeImage({"(define x '(1 2))"});
+         MakeCellCycle(&image);
+         return image;
+     },
+     "x", "error: Invalid image"},
+    {"closure reading a slot beyond its frame",
+     [] { return MakeCorruptedClosure(kLocalRefKind, 0, 1000); }, "(f 40)",
+     "error: Invalid image"},
+    {"closure reading an unboxed variable as a box",
+     [] { return MakeCorruptedClosure(kLocalRefKind, 1, 1); }, "(f 40)",
+     "error: Invalid image"},
+    {"closure reading a capture it does not have",
+     [] { return MakeCorruptedClosure(kCapturedRefKind, 0, 1); }, "(f 40)",
+     "error: Invalid image"},
+};
+
+std::string Run(const Case& test) {
+    try {
+        // Copied into an allocation, which is aligned as images need.
+        auto data = test.image();
+        std::vector<uint64_t> image((data.size() + 7) / 8);
+        std::memcpy(image.data(), data.data(), data.size());
+        Interpreter interpreter;
+        LoadImage({reinterpret_cast<const char*>(image.data()), data.size()},
+                  interpreter.GetGlobalScope());
+        return interpreter.Run(test.expression);
+    } catch (const std::exception& e) {
+        return std::string("error: ") + e.what();
+    }
+}
+
+}  // namespace
+
+int main() {
+    auto failures = 0;
+    for (const auto& test : kCases) {
+        auto result = Run(test);
+        if (result != test.expected) {
+            std::cerr << "FAIL " << test.name << ": got " << result << ", expected "
+                      << test.expected << std::endl;
+            ++failures;
+        } else {
+            std::cout << "ok   " << test.name << std::endl;
+        }
+    }
+    return failures ? 1 : 0;
+}
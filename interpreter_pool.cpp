@@ -0,0 +1,59 @@
+#include <algorithm>
+#include <sstream>
+#include <string_view>
+
+#include "interpreter_pool.h"
+#include "scheme.h"
+#include "tokenizer.h"
+
+InterpreterPool::InterpreterPool(std::size_t threads) {
+    // hardware_concurrency returns zero when it cannot tell.
+    threads = std::max<std::size_t>(threads, 1);
+    for (std::size_t i = 0; i < threads; ++i) {
+        workers_.emplace_back([this] { Work(); });
+    }
+}
+
+InterpreterPool::~InterpreterPool() {
+    {
+        std::lock_guard lock(mutex_);
+        stopping_ = true;
+    }
+    ready_.notify_all();
+    for (auto& worker : workers_) {
+        worker.join();
+    }
+}
+
+std::future<std::string> InterpreterPool::Submit(std::string source) {
+    std::packaged_task<std::string()> task([source = std::move(source)] {
+        Interpreter interpreter;
+        Tokenizer tokenizer{std::string_view(source)};
+        std::ostringstream out;
+        interpreter.RunBatch(&tokenizer, &out);
+        return out.str();
+    });
+    auto result = task.get_future();
+    {
+        std::lock_guard lock(mutex_);
+        tasks_.push_back(std::move(task));
+    }
+    ready_.notify_one();
+    return result;
+}
+
+void InterpreterPool::Work() {
+    while (true) {
+        std::packaged_task<std::string()> task;
+        {
+            std::unique_lock lock(mutex_);
+            ready_.wait(lock, [this] { return stopping_ || !tasks_.empty(); });
+            if (tasks_.empty()) {
+                return;
+            }
+            task = std::move(tasks_.front());
+            tasks_.pop_front();
+        }
+        task();
+    }
+}
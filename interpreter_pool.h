@@ -0,0 +1,41 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <future>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Evaluates independent programs on a fixed set of worker threads. Every submitted source
+// runs in a fresh interpreter of its own, so programs never see each other's definitions;
+// all of them share the builtin table and the symbol table.
+class InterpreterPool {
+public:
+    explicit InterpreterPool(std::size_t threads = std::thread::hardware_concurrency());
+
+    InterpreterPool(const InterpreterPool&) = delete;
+    InterpreterPool& operator=(const InterpreterPool&) = delete;
+
+    // Finishes the submitted programs before stopping the workers.
+    ~InterpreterPool();
+
+    // Evaluates the top-level forms of the source in order. The future holds their values
+    // as printed by Interpreter::RunBatch, or the first error.
+    std::future<std::string> Submit(std::string source);
+
+    std::size_t GetThreadCount() const {
+        return workers_.size();
+    }
+
+private:
+    void Work();
+
+    std::mutex mutex_;
+    std::condition_variable ready_;
+    std::deque<std::packaged_task<std::string()>> tasks_;
+    bool stopping_ = false;
+    std::vector<std::thread> workers_;
+};
@@ -0,0 +1,93 @@
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+
+#include "image.h"
+#include "mapped_file.h"
+#include "profiler.h"
+#include "scheme.h"
+#include "tokenizer.h"
+
+namespace {
+
+void PrintProfiles(const Profiler& profiler, std::ostream* out) {
+    *out << "function\tcalls\tinclusive_ms\texclusive_ms\tallocations\n";
+    for (const auto& profile : profiler.GetFunctionProfiles()) {
+        *out << profile.name << '\t' << profile.calls << '\t' << profile.inclusive.count() / 1e6
+             << '\t' << profile.exclusive.count() / 1e6 << '\t' << profile.allocations << '\n';
+    }
+}
+
+}  // namespace
+
+// Evaluates every top-level form of the given files, or of the standard input when no
+// file is given, and prints one value per line.
+//
+//   scheme_cli [--bytecode] [--image path] [--profile] [--flamegraph path] [file...]
+//
+// --image starts from the bindings stored in an image written by scheme_image.
+// --profile prints the calls of every function to the standard error, and --flamegraph
+// writes sampled call stacks in the collapsed format; both need SCHEME_PROFILING.
+int main(int argc, char** argv) {
+    Interpreter interpreter;
+    std::ios::sync_with_stdio(false);
+    std::vector<const char*> files;
+    bool profile = false;
+    const char* flamegraph = nullptr;
+    const char* image = nullptr;
+    for (int i = 1; i < argc; ++i) {
+        if (!std::strcmp(argv[i], "--bytecode")) {
+            interpreter.SetEngine(Engine::BYTECODE);
+        } else if (!std::strcmp(argv[i], "--image") && i + 1 < argc) {
+            image = argv[++i];
+        } else if (!std::strcmp(argv[i], "--profile")) {
+            profile = true;
+        } else if (!std::strcmp(argv[i], "--flamegraph") && i + 1 < argc) {
+            flamegraph = argv[++i];
+        } else {
+            files.push_back(argv[i]);
+        }
+    }
+
+    std::unique_ptr<Profiler> profiler;
+    if (profile || flamegraph) {
+        if (!Profiler::kAvailable) {
+            std::cerr << "error: profiling needs a build with SCHEME_PROFILING" << std::endl;
+            return 1;
+        }
+        using std::chrono::microseconds;
+        profiler = std::make_unique<Profiler>(flamegraph ? microseconds(100) : microseconds(0));
+        interpreter.SetProfiler(profiler.get());
+    }
+
+    int status = 0;
+    try {
+        if (image) {
+            LoadImageFile(image, interpreter.GetGlobalScope());
+        }
+        if (files.empty()) {
+            interpreter.RunBatch(&std::cin, &std::cout);
+        }
+        for (const auto& path : files) {
+            MappedFile file(path);
+            Tokenizer tokenizer(file.GetData());
+            interpreter.RunBatch(&tokenizer, &std::cout);
+        }
+    } catch (const std::exception& e) {
+        std::cout.flush();
+        std::cerr << "error: " << e.what() << std::endl;
+        status = 1;
+    }
+
+    // Written even after an error, as the profile may show what led to it.
+    if (profile) {
+        PrintProfiles(*profiler, &std::cerr);
+    }
+    if (flamegraph) {
+        std::ofstream out(flamegraph);
+        profiler->WriteCollapsedStacks(&out);
+    }
+    return status;
+}
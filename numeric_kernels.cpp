@@ -0,0 +1,350 @@
+#include <algorithm>
+
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif
+
+#include "numeric_kernels.h"
+
+namespace {
+
+// x = high 2^32 + low with high = x >> 32 (rounded down) and low = the lower 32 bits, so
+// summing both parts in 64 bits cannot overflow before 2^32 elements.
+__int128 Combine(int64_t high, uint64_t low) {
+    return (static_cast<__int128>(high) << 32) + low;
+}
+
+__int128 SumScalar(const int64_t* data, std::size_t size) {
+    int64_t high = 0;
+    uint64_t low = 0;
+    for (std::size_t i = 0; i < size; ++i) {
+        high += data[i] >> 32;
+        low += static_cast<uint32_t>(data[i]);
+    }
+    return Combine(high, low);
+}
+
+int64_t MinScalar(const int64_t* data, std::size_t size) {
+    return *std::min_element(data, data + size);
+}
+
+int64_t MaxScalar(const int64_t* data, std::size_t size) {
+    return *std::max_element(data, data + size);
+}
+
+bool AddScalar(const int64_t* lhs, const int64_t* rhs, int64_t* out, std::size_t size) {
+    bool overflow = false;
+    for (std::size_t i = 0; i < size; ++i) {
+        overflow |= __builtin_add_overflow(lhs[i], rhs[i], &out[i]);
+    }
+    return !overflow;
+}
+
+void LessScalar(const int64_t* lhs, const int64_t* rhs, int64_t* out, std::size_t size) {
+    for (std::size_t i = 0; i < size; ++i) {
+        out[i] = lhs[i] < rhs[i];
+    }
+}
+
+void EqualScalar(const int64_t* lhs, const int64_t* rhs, int64_t* out, std::size_t size) {
+    for (std::size_t i = 0; i < size; ++i) {
+        out[i] = lhs[i] == rhs[i];
+    }
+}
+
+constexpr S64Kernels kScalar{"scalar",  SumScalar, MinScalar,  MaxScalar,
+                             AddScalar, LessScalar, EqualScalar};
+
+#ifdef __x86_64__
+
+// SSE2 is part of x86-64, so this table needs no runtime check. It has no 64-bit
+// comparisons; min, max and the masks stay scalar.
+
+// The upper halves of both lanes, sign-extended.
+__m128i HighHalves(__m128i x) {
+    auto signs = _mm_and_si128(_mm_srai_epi32(x, 31), _mm_set_epi32(-1, 0, -1, 0));
+    return _mm_or_si128(_mm_srli_epi64(x, 32), signs);
+}
+
+__int128 SumSse2(const int64_t* data, std::size_t size) {
+    auto high = _mm_setzero_si128(), low = _mm_setzero_si128();
+    auto low_mask = _mm_set1_epi64x(0xffffffff);
+    std::size_t i = 0;
+    for (; i + 2 <= size; i += 2) {
+        auto x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        high = _mm_add_epi64(high, HighHalves(x));
+        low = _mm_add_epi64(low, _mm_and_si128(x, low_mask));
+    }
+    alignas(16) int64_t highs[2];
+    alignas(16) uint64_t lows[2];
+    _mm_store_si128(reinterpret_cast<__m128i*>(highs), high);
+    _mm_store_si128(reinterpret_cast<__m128i*>(lows), low);
+    return Combine(highs[0] + highs[1], lows[0] + lows[1]) + SumScalar(data + i, size - i);
+}
+
+bool AddSse2(const int64_t* lhs, const int64_t* rhs, int64_t* out, std::size_t size) {
+    auto overflow = _mm_setzero_si128();
+    std::size_t i = 0;
+    for (; i + 2 <= size; i += 2) {
+        auto a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(lhs + i));
+        auto b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rhs + i));
+        auto sum = _mm_add_epi64(a, b);
+        // The sign of the sum differs from the signs of both operands.
+        auto flipped = _mm_and_si128(_mm_xor_si128(a, sum), _mm_xor_si128(b, sum));
+        overflow = _mm_or_si128(overflow, flipped);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), sum);
+    }
+    bool ok = !_mm_movemask_pd(_mm_castsi128_pd(overflow));
+    return AddScalar(lhs + i, rhs + i, out + i, size - i) && ok;
+}
+
+constexpr S64Kernels kSse2{"sse2",  SumSse2,    MinScalar,  MaxScalar,
+                           AddSse2, LessScalar, EqualScalar};
+
+#define SCHEME_AVX2 __attribute__((target("avx2")))
+
+SCHEME_AVX2 __m256i HighHalves(__m256i x) {
+    return _mm256_blend_epi32(_mm256_srli_epi64(x, 32), _mm256_srai_epi32(x, 31), 0b10101010);
+}
+
+SCHEME_AVX2 __m256i Load(const int64_t* data) {
+    return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data));
+}
+
+SCHEME_AVX2 void Store(int64_t* data, __m256i value) {
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(data), value);
+}
+
+SCHEME_AVX2 __int128 SumAvx2(const int64_t* data, std::size_t size) {
+    auto high = _mm256_setzero_si256(), low = _mm256_setzero_si256();
+    auto low_mask = _mm256_set1_epi64x(0xffffffff);
+    std::size_t i = 0;
+    for (; i + 4 <= size; i += 4) {
+        auto x = Load(data + i);
+        high = _mm256_add_epi64(high, HighHalves(x));
+        low = _mm256_add_epi64(low, _mm256_and_si256(x, low_mask));
+    }
+    alignas(32) int64_t highs[4];
+    alignas(32) uint64_t lows[4];
+    _mm256_store_si256(reinterpret_cast<__m256i*>(highs), high);
+    _mm256_store_si256(reinterpret_cast<__m256i*>(lows), low);
+    auto vector_sum = Combine(highs[0] + highs[1] + highs[2] + highs[3],
+                              lows[0] + lows[1] + lows[2] + lows[3]);
+    return vector_sum + SumScalar(data + i, size - i);
+}
+
+template <bool kMin>
+SCHEME_AVX2 int64_t ExtremumAvx2(const int64_t* data, std::size_t size) {
+    if (size < 4) {
+        return kMin ? MinScalar(data, size) : MaxScalar(data, size);
+    }
+    auto best = Load(data);
+    std::size_t i = 4;
+    for (; i + 4 <= size; i += 4) {
+        auto x = Load(data + i);
+        auto replace = kMin ? _mm256_cmpgt_epi64(best, x) : _mm256_cmpgt_epi64(x, best);
+        best = _mm256_blendv_epi8(best, x, replace);
+    }
+    alignas(32) int64_t lanes[4];
+    _mm256_store_si256(reinterpret_cast<__m256i*>(lanes), best);
+    for (; i < size; ++i) {
+        lanes[0] = kMin ? std::min(lanes[0], data[i]) : std::max(lanes[0], data[i]);
+    }
+    return kMin ? MinScalar(lanes, 4) : MaxScalar(lanes, 4);
+}
+
+SCHEME_AVX2 int64_t MinAvx2(const int64_t* data, std::size_t size) {
+    return ExtremumAvx2<true>(data, size);
+}
+
+SCHEME_AVX2 int64_t MaxAvx2(const int64_t* data, std::size_t size) {
+    return ExtremumAvx2<false>(data, size);
+}
+
+SCHEME_AVX2 bool AddAvx2(const int64_t* lhs, const int64_t* rhs, int64_t* out, std::size_t size) {
+    auto overflow = _mm256_setzero_si256();
+    std::size_t i = 0;
+    for (; i + 4 <= size; i += 4) {
+        auto a = Load(lhs + i), b = Load(rhs + i);
+        auto sum = _mm256_add_epi64(a, b);
+        auto flipped = _mm256_and_si256(_mm256_xor_si256(a, sum), _mm256_xor_si256(b, sum));
+        overflow = _mm256_or_si256(overflow, flipped);
+        Store(out + i, sum);
+    }
+    bool ok = !_mm256_movemask_pd(_mm256_castsi256_pd(overflow));
+    return AddScalar(lhs + i, rhs + i, out + i, size - i) && ok;
+}
+
+SCHEME_AVX2 void LessAvx2(const int64_t* lhs, const int64_t* rhs, int64_t* out,
+                          std::size_t size) {
+    auto ones = _mm256_set1_epi64x(1);
+    std::size_t i = 0;
+    for (; i + 4 <= size; i += 4) {
+        Store(out + i, _mm256_and_si256(_mm256_cmpgt_epi64(Load(rhs + i), Load(lhs + i)), ones));
+    }
+    LessScalar(lhs + i, rhs + i, out + i, size - i);
+}
+
+SCHEME_AVX2 void EqualAvx2(const int64_t* lhs, const int64_t* rhs, int64_t* out,
+                           std::size_t size) {
+    auto ones = _mm256_set1_epi64x(1);
+    std::size_t i = 0;
+    for (; i + 4 <= size; i += 4) {
+        Store(out + i, _mm256_and_si256(_mm256_cmpeq_epi64(Load(lhs + i), Load(rhs + i)), ones));
+    }
+    EqualScalar(lhs + i, rhs + i, out + i, size - i);
+}
+
+constexpr S64Kernels kAvx2{"avx2", SumAvx2, MinAvx2, MaxAvx2, AddAvx2, LessAvx2, EqualAvx2};
+
+#define SCHEME_AVX512 __attribute__((target("avx512f")))
+
+// The kernels below use the zero-masking forms of the intrinsics, with every lane selected:
+// the unmasked forms and _mm512_reduce_* in GCC 12 pass an undefined vector through, which
+// -Wall reports as uninitialized.
+constexpr __mmask8 kAllLanes = 0xff;
+
+// Combines the eight lanes with op by folding the upper half onto the lower one three times.
+template <typename Op>
+SCHEME_AVX512 int64_t Reduce(__m512i x, Op op) {
+    x = op(x, _mm512_maskz_shuffle_i64x2(kAllLanes, x, x, _MM_SHUFFLE(1, 0, 3, 2)));
+    x = op(x, _mm512_maskz_shuffle_i64x2(kAllLanes, x, x, _MM_SHUFFLE(2, 3, 0, 1)));
+    x = op(x, _mm512_maskz_unpackhi_epi64(kAllLanes, x, x));
+    return x[0];
+}
+
+SCHEME_AVX512 __m512i Add512(__m512i a, __m512i b) {
+    return _mm512_add_epi64(a, b);
+}
+
+SCHEME_AVX512 __m512i Min512(__m512i a, __m512i b) {
+    return _mm512_maskz_min_epi64(kAllLanes, a, b);
+}
+
+SCHEME_AVX512 __m512i Max512(__m512i a, __m512i b) {
+    return _mm512_maskz_max_epi64(kAllLanes, a, b);
+}
+
+SCHEME_AVX512 __int128 SumAvx512(const int64_t* data, std::size_t size) {
+    auto high = _mm512_setzero_si512(), low = _mm512_setzero_si512();
+    auto low_mask = _mm512_set1_epi64(0xffffffff);
+    std::size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        auto x = _mm512_loadu_si512(data + i);
+        high = _mm512_add_epi64(high, _mm512_maskz_srai_epi64(kAllLanes, x, 32));
+        low = _mm512_add_epi64(low, _mm512_and_si512(x, low_mask));
+    }
+    auto vector_sum =
+        Combine(Reduce(high, Add512), static_cast<uint64_t>(Reduce(low, Add512)));
+    return vector_sum + SumScalar(data + i, size - i);
+}
+
+SCHEME_AVX512 int64_t MinAvx512(const int64_t* data, std::size_t size) {
+    if (size < 8) {
+        return MinScalar(data, size);
+    }
+    auto best = _mm512_loadu_si512(data);
+    std::size_t i = 8;
+    for (; i + 8 <= size; i += 8) {
+        best = Min512(best, _mm512_loadu_si512(data + i));
+    }
+    int64_t result = Reduce(best, Min512);
+    return i == size ? result : std::min(result, MinScalar(data + i, size - i));
+}
+
+SCHEME_AVX512 int64_t MaxAvx512(const int64_t* data, std::size_t size) {
+    if (size < 8) {
+        return MaxScalar(data, size);
+    }
+    auto best = _mm512_loadu_si512(data);
+    std::size_t i = 8;
+    for (; i + 8 <= size; i += 8) {
+        best = Max512(best, _mm512_loadu_si512(data + i));
+    }
+    int64_t result = Reduce(best, Max512);
+    return i == size ? result : std::max(result, MaxScalar(data + i, size - i));
+}
+
+SCHEME_AVX512 bool AddAvx512(const int64_t* lhs, const int64_t* rhs, int64_t* out,
+                             std::size_t size) {
+    auto overflow = _mm512_setzero_si512();
+    std::size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        auto a = _mm512_loadu_si512(lhs + i), b = _mm512_loadu_si512(rhs + i);
+        auto sum = _mm512_add_epi64(a, b);
+        auto flipped = _mm512_and_si512(_mm512_xor_si512(a, sum), _mm512_xor_si512(b, sum));
+        overflow = _mm512_or_si512(overflow, flipped);
+        _mm512_storeu_si512(out + i, sum);
+    }
+    bool ok = !_mm512_cmplt_epi64_mask(overflow, _mm512_setzero_si512());
+    return AddScalar(lhs + i, rhs + i, out + i, size - i) && ok;
+}
+
+SCHEME_AVX512 void LessAvx512(const int64_t* lhs, const int64_t* rhs, int64_t* out,
+                              std::size_t size) {
+    auto ones = _mm512_set1_epi64(1);
+    std::size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        auto mask =
+            _mm512_cmplt_epi64_mask(_mm512_loadu_si512(lhs + i), _mm512_loadu_si512(rhs + i));
+        _mm512_storeu_si512(out + i, _mm512_maskz_mov_epi64(mask, ones));
+    }
+    LessScalar(lhs + i, rhs + i, out + i, size - i);
+}
+
+SCHEME_AVX512 void EqualAvx512(const int64_t* lhs, const int64_t* rhs, int64_t* out,
+                               std::size_t size) {
+    auto ones = _mm512_set1_epi64(1);
+    std::size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        auto mask =
+            _mm512_cmpeq_epi64_mask(_mm512_loadu_si512(lhs + i), _mm512_loadu_si512(rhs + i));
+        _mm512_storeu_si512(out + i, _mm512_maskz_mov_epi64(mask, ones));
+    }
+    EqualScalar(lhs + i, rhs + i, out + i, size - i);
+}
+
+constexpr S64Kernels kAvx512{"avx512",  SumAvx512,  MinAvx512,  MaxAvx512,
+                             AddAvx512, LessAvx512, EqualAvx512};
+
+#endif
+
+}  // namespace
+
+std::vector<const S64Kernels*> GetSupportedS64Kernels() {
+    std::vector<const S64Kernels*> kernels{&kScalar};
+#ifdef __x86_64__
+    kernels.push_back(&kSse2);
+    if (__builtin_cpu_supports("avx2")) {
+        kernels.push_back(&kAvx2);
+    }
+    if (__builtin_cpu_supports("avx512f")) {
+        kernels.push_back(&kAvx512);
+    }
+#endif
+    return kernels;
+}
+
+const S64Kernels& GetS64Kernels() {
+    static const S64Kernels& kernels = *GetSupportedS64Kernels().back();
+    return kernels;
+}
+
+bool MultiplyS64(const int64_t* lhs, const int64_t* rhs, int64_t* out, std::size_t size) {
+    bool overflow = false;
+    for (std::size_t i = 0; i < size; ++i) {
+        overflow |= __builtin_mul_overflow(lhs[i], rhs[i], &out[i]);
+    }
+    return !overflow;
+}
+
+bool DotS64(const int64_t* lhs, const int64_t* rhs, std::size_t size, __int128* result) {
+    __int128 sum = 0;
+    for (std::size_t i = 0; i < size; ++i) {
+        if (__builtin_add_overflow(sum, static_cast<__int128>(lhs[i]) * rhs[i], &sum)) {
+            return false;
+        }
+    }
+    *result = sum;
+    return true;
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Bulk operations on packed int64_t arrays, behind the s64vector builtins. Every table
+// implements the same results; they differ in the instruction set used.
+struct S64Kernels {
+    const char* name;
+
+    // Exact for fewer than 2^32 elements: the high and low halves of the elements are
+    // summed separately.
+    __int128 (*sum)(const int64_t* data, std::size_t size);
+
+    // The size must not be zero.
+    int64_t (*min)(const int64_t* data, std::size_t size);
+
+    int64_t (*max)(const int64_t* data, std::size_t size);
+
+    // out = lhs + rhs elementwise. Returns false if any sum overflows.
+    bool (*add)(const int64_t* lhs, const int64_t* rhs, int64_t* out, std::size_t size);
+
+    // out[i] = 1 if lhs[i] < rhs[i] (respectively ==), 0 otherwise.
+    void (*less)(const int64_t* lhs, const int64_t* rhs, int64_t* out, std::size_t size);
+
+    void (*equal)(const int64_t* lhs, const int64_t* rhs, int64_t* out, std::size_t size);
+};
+
+// The fastest table the CPU supports, chosen on first use.
+const S64Kernels& GetS64Kernels();
+
+// All tables the CPU supports, slowest first.
+std::vector<const S64Kernels*> GetSupportedS64Kernels();
+
+// Neither SSE2 nor AVX2 multiplies 64-bit lanes, and overflow has to be detected anyway, so
+// the products stay scalar.
+
+// out = lhs * rhs elementwise. Returns false if any product overflows.
+bool MultiplyS64(const int64_t* lhs, const int64_t* rhs, int64_t* out, std::size_t size);
+
+// Sum of the products. Returns false if the sum overflows 128 bits.
+bool DotS64(const int64_t* lhs, const int64_t* rhs, std::size_t size, __int128* result);
@@ -1,16 +1,274 @@
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "budget.h"
 #include "object.h"
+#include "profiler.h"
 #include "scheme.h"
 
+std::shared_ptr<Object> Number::Make(BigInt value) {
+    if (value.FitsInt64()) {
+        return Make(value.ToInt64());
+    }
+    return Allocate<Number>(std::move(value));
+}
+
+std::shared_ptr<Symbol> Symbol::Get(SymbolId id) {
+    static std::mutex mutex;
+    static std::vector<std::shared_ptr<Symbol>> symbols;
+    // The parser runs on any thread. Each one keeps the instances it has used, so only the
+    // first occurrence of a name on a thread takes the lock.
+    thread_local std::vector<std::shared_ptr<Symbol>> seen;
+    if (id < seen.size() && seen[id]) {
+        return seen[id];
+    }
+    std::lock_guard lock(mutex);
+    if (id >= symbols.size()) {
+        symbols.resize(id + 1);
+    }
+    auto& symbol = symbols[id];
+    if (!symbol) {
+        symbol = Allocate<Symbol>(id);
+    }
+    if (id >= seen.size()) {
+        seen.resize(id + 1);
+    }
+    seen[id] = symbol;
+    return symbol;
+}
+
+namespace {
+
+struct DestroyList {
+    std::vector<std::shared_ptr<Object>> pending;
+    bool releasing = false;
+};
+
+DestroyList& GetDestroyList() {
+    thread_local DestroyList list;
+    return list;
+}
+
+}  // namespace
+
+void DestroyChildren(Object* object) {
+    auto& [pending, releasing] = GetDestroyList();
+    object->MoveChildren(&pending);
+    // An outer call is already draining the list and will release these children too.
+    if (releasing) {
+        return;
+    }
+    releasing = true;
+    while (!pending.empty()) {
+        auto child = std::move(pending.back());
+        pending.pop_back();
+    }
+    releasing = false;
+}
+
+void PrepareDestroyChildren() {
+    GetDestroyList();
+}
+
+void Print(const std::shared_ptr<Object>& value, std::ostream* out) {
+    if (!value) {
+        *out << "()";
+    } else if (IsImmediate(value.get())) {
+        *out << NumberValue(value).GetValue();
+    } else {
+        ToObject(value)->Print(out);
+    }
+}
+
+Cell::operator std::string() const {
+    std::ostringstream out;
+    Print(&out);
+    return out.str();
+}
+
+namespace {
+
+// Vectors that the vector at the root reaches again from inside themselves, which only a
+// vector can: pairs cannot be changed once made. Walks the elements in the order they are
+// printed in.
+std::unordered_set<const Object*> FindCycles(const Vector* root) {
+    struct Item {
+        const Object* object;
+        std::size_t index;
+    };
+    std::unordered_set<const Object*> open{root}, cycles;
+    std::vector<Item> stack{{root, 0}};
+    while (!stack.empty()) {
+        auto item = stack.back();
+        const Object* child;
+        if (item.object->GetType() == Type::VECTOR) {
+            auto vector = static_cast<const Vector*>(item.object);
+            if (item.index == vector->GetSize()) {
+                open.erase(vector);
+                stack.pop_back();
+                continue;
+            }
+            ++stack.back().index;
+            child = vector->Get(item.index).get();
+        } else if (!item.index) {
+            ++stack.back().index;
+            child = static_cast<const Cell*>(item.object)->GetFirst().get();
+        } else {
+            stack.pop_back();
+            child = static_cast<const Cell*>(item.object)->GetSecond().get();
+        }
+        if (!child) {
+            continue;
+        }
+        if (GetType(child) == Type::VECTOR) {
+            if (!open.insert(child).second) {
+                cycles.insert(child);
+                continue;
+            }
+            stack.push_back({child, 0});
+        } else if (GetType(child) == Type::CELL) {
+            stack.push_back({child, 0});
+        }
+    }
+    return cycles;
+}
+
+// Prints lists and vectors, nested to any depth. Pending output is kept on an explicit
+// stack, innermost last. A list or vector is continued from its current position, so the
+// stack holds one entry per open list rather than one per element. A vector that contains
+// itself is written with a datum label, #n=, and referred to inside as #n#.
+void PrintNested(const Object* root, std::ostream* out) {
+    struct Item {
+        enum { VALUE, REST, ELEMENTS, TEXT } kind;
+        const Object* object;
+        const char* text;
+        std::size_t index;
+    };
+    std::vector<Item> stack{{Item::VALUE, root, nullptr, 0}};
+    // Vectors being printed, and the labels of those that are part of a cycle. Cycles are
+    // looked for from each outermost vector, so lists without any cost nothing.
+    std::size_t open_vectors = 0;
+    std::unordered_set<const Object*> cycles;
+    std::unordered_map<const Object*, std::size_t> labels;
+    std::size_t next_label = 0;
+    while (!stack.empty()) {
+        auto item = stack.back();
+        stack.pop_back();
+        if (item.kind == Item::TEXT) {
+            *out << item.text;
+        } else if (item.kind == Item::VALUE) {
+            if (!item.object) {
+                *out << "()";
+            } else if (IsImmediate(item.object)) {
+                *out << NumberValue(item.object).GetValue();
+            } else if (ToObject(item.object)->GetType() == Type::CELL) {
+                auto cell = static_cast<const Cell*>(item.object);
+                *out << '(';
+                stack.push_back({Item::REST, cell, nullptr, 0});
+                stack.push_back({Item::VALUE, cell->GetFirst().get(), nullptr, 0});
+            } else if (ToObject(item.object)->GetType() == Type::VECTOR) {
+                if (auto label = labels.find(item.object); label != labels.end()) {
+                    *out << '#' << label->second << '#';
+                    continue;
+                }
+                if (!open_vectors) {
+                    cycles = FindCycles(static_cast<const Vector*>(item.object));
+                }
+                ++open_vectors;
+                if (cycles.contains(item.object)) {
+                    labels.emplace(item.object, next_label);
+                    *out << '#' << next_label++ << '=';
+                }
+                *out << "#(";
+                stack.push_back({Item::ELEMENTS, item.object, nullptr, 0});
+            } else {
+                ToObject(item.object)->Print(out);
+            }
+        } else if (item.kind == Item::ELEMENTS) {
+            auto vector = static_cast<const Vector*>(item.object);
+            if (item.index == vector->GetSize()) {
+                *out << ')';
+                --open_vectors;
+                labels.erase(vector);
+                continue;
+            }
+            if (item.index) {
+                *out << ' ';
+            }
+            stack.push_back({Item::ELEMENTS, vector, nullptr, item.index + 1});
+            stack.push_back({Item::VALUE, vector->Get(item.index).get(), nullptr, 0});
+        } else {
+            const auto& rest = static_cast<const Cell*>(item.object)->GetSecond();
+            if (!rest) {
+                *out << ')';
+            } else if (Is<Cell>(rest)) {
+                *out << ' ';
+                stack.push_back({Item::REST, rest.get(), nullptr, 0});
+                stack.push_back({Item::VALUE, Cast<Cell>(rest)->GetFirst().get(), nullptr, 0});
+            } else {
+                *out << " . ";
+                stack.push_back({Item::TEXT, nullptr, ")", 0});
+                stack.push_back({Item::VALUE, rest.get(), nullptr, 0});
+            }
+        }
+    }
+}
+
+}  // namespace
+
+void Cell::Print(std::ostream* out) const {
+    PrintNested(this, out);
+}
+
+Vector::operator std::string() const {
+    std::ostringstream out;
+    Print(&out);
+    return out.str();
+}
+
+void Vector::Print(std::ostream* out) const {
+    PrintNested(this, out);
+}
+
+S64Vector::operator std::string() const {
+    std::ostringstream out;
+    Print(&out);
+    return out.str();
+}
+
+void S64Vector::Print(std::ostream* out) const {
+    *out << "#s64(";
+    for (std::size_t i = 0; i < elements_.size(); ++i) {
+        if (i) {
+            *out << ' ';
+        }
+        *out << elements_[i];
+    }
+    *out << ')';
+}
+
+std::shared_ptr<Object> Symbol::Eval(std::shared_ptr<Scope> scope) {
+    return scope->LookUp(id_);
+}
+
 std::shared_ptr<Object> Cell::Eval(std::shared_ptr<Scope> scope) {
+    BudgetFrame frame;
     if (!first_) {
         throw RuntimeError("Cannot call ()");
     }
-    if (!Is<Symbol>(first_)) {
+    std::shared_ptr<Object> function;
+    if (Is<Cell>(first_)) {
+        function = first_->Eval(scope);
+    } else if (Is<Symbol>(first_)) {
+        function = scope->LookUp(Cast<Symbol>(first_)->GetId());
+    } else {
         throw RuntimeError("First element of cell is not a function");
     }
-    auto function = scope->LookUp(As<Symbol>(first_)->GetName());
     if (function) {
-        return function->Apply(scope, second_);
+        SCHEME_PROFILE_CALL(function.get());
+        return ApplyValue(function, scope, second_);
     } else {
         throw RuntimeError("Bad function");
     }
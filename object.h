@@ -1,12 +1,20 @@
 #pragma once
 
+#include <cassert>
+#include <cstdint>
 #include <memory>
+#include <span>
 #include <stdexcept>
 #include <string>
 #include <sstream>
-#include <unordered_set>
+#include <type_traits>
+#include <vector>
 
+#include "bigint.h"
 #include "error.h"
+#include "heap.h"
+#include "parallel_task.h"
+#include "symbol_table.h"
 
 class Object;
 
@@ -20,72 +28,301 @@ class Cell;
 
 class Scope;
 
+// Concrete kind of an object, fixed at construction. Type checks in builtins compare tags
+// instead of going through RTTI.
+enum class Type : uint8_t {
+    NUMBER,
+    SYMBOL,
+    BOOLEAN,
+    CELL,
+    VECTOR,
+    S64VECTOR,
+    FUNCTION,
+    CLOSURE,
+    BOX,
+    CONSTANT,
+    GLOBAL_REF,
+    LOCAL_REF,
+    CAPTURED_REF,
+    SELF_REF,
+    CALL,
+    ASSIGNMENT,
+    LOCAL_ASSIGNMENT,
+    IF,
+    LAMBDA,
+    LET
+};
+
 class Object {
 public:
+    explicit Object(Type type) : type_(type) {
+    }
+
+    Type GetType() const {
+        return type_;
+    }
+
     virtual std::shared_ptr<Object> Eval(std::shared_ptr<Scope> scope) = 0;
 
     virtual operator std::string() const {
         throw RuntimeError("Cannot print abstract object");
     }
 
-    virtual std::shared_ptr<Object> Apply(std::shared_ptr<Scope> scope,
-                                          std::shared_ptr<Object> args) {
+    // Writes the external representation without building intermediate strings.
+    virtual void Print(std::ostream* out) const {
+        *out << static_cast<std::string>(*this);
+    }
+
+    virtual std::shared_ptr<Object> Apply(const std::shared_ptr<Scope>& scope,
+                                          const std::shared_ptr<Object>& args) {
         throw RuntimeError("Cannot call apply from the abstract object");
     }
 
+    // Moves out the objects this one owns; see DestroyChildren.
+    virtual void MoveChildren(std::vector<std::shared_ptr<Object>>* children) {
+    }
+
+    // Appends the references this object holds, for the cycle collector. Objects that
+    // cannot lead back to themselves report none.
+    virtual void GetChildren(std::vector<const std::shared_ptr<Object>*>* children) const {
+    }
+
     virtual ~Object() = default;
 
 private:
-    std::unordered_set<std::shared_ptr<Object>> ptrs_;
+    const Type type_;
 };
 
+// Integers in [Number::kMinImmediate, Number::kMaxImmediate] are immediate: the pointer of
+// the value is not the address of an object but the integer shifted left by one, with the
+// lowest bit set, and it owns nothing. Making one takes no allocation, and copying one
+// touches no reference count. Objects are aligned, so their addresses never have that bit
+// set. The empty list is the null pointer, and every other value is an object.
+//
+// Converting between integers and pointers is implementation-defined; GCC and Clang map
+// them to the address bits unchanged, which is all the encoding relies on.
+static_assert(sizeof(std::uintptr_t) == sizeof(int64_t));
+static_assert(alignof(Object) >= 2);
+
+inline bool IsImmediate(const Object* value) {
+    return reinterpret_cast<std::uintptr_t>(value) & 1;
+}
+
+// The object behind a value that may be a number, once it is known not to be immediate.
+// Code that can see numbers reaches the members of a value only through this, or through
+// the functions below, which check first.
+inline Object* ToObject(const std::shared_ptr<Object>& value) {
+    assert(!IsImmediate(value.get()));
+    return value.get();
+}
+
+inline const Object* ToObject(const Object* value) {
+    assert(!IsImmediate(value));
+    return value;
+}
+
+// Type of any value but the empty list.
+inline Type GetType(const Object* value) {
+    return IsImmediate(value) ? Type::NUMBER : ToObject(value)->GetType();
+}
+
+// Evaluates any expression but the empty list. Immediates evaluate to themselves.
+inline std::shared_ptr<Object> EvalExpression(const std::shared_ptr<Object>& expression,
+                                              const std::shared_ptr<Scope>& scope) {
+    if (IsImmediate(expression.get())) {
+        return expression;
+    }
+    return ToObject(expression)->Eval(scope);
+}
+
+// Applies any value but the empty list to unevaluated arguments. Immediates are not
+// functions, any more than other numbers are.
+inline std::shared_ptr<Object> ApplyValue(const std::shared_ptr<Object>& function,
+                                          const std::shared_ptr<Scope>& scope,
+                                          const std::shared_ptr<Object>& args) {
+    if (IsImmediate(function.get())) {
+        throw RuntimeError("Cannot call apply from the abstract object");
+    }
+    return ToObject(function)->Apply(scope, args);
+}
+
+// Writes any value, including the empty list.
+void Print(const std::shared_ptr<Object>& value, std::ostream* out);
+
+// Called from destructors of objects that own other objects. Releases the whole
+// structure with an explicit work list instead of nested destructor calls, so that long
+// lists and deep trees cannot overflow the stack.
+void DestroyChildren(Object* object);
+
+// Sets up the work list of DestroyChildren on this thread. Thread-local objects that release
+// objects when the thread exits call it before they are constructed, as thread-local objects
+// are destroyed in the reverse order.
+void PrepareDestroyChildren();
+
 class Number : public Object, public std::enable_shared_from_this<Number> {
 public:
-    Number() = default;
+    static constexpr Type kType = Type::NUMBER;
 
-    Number(int64_t value) : value_(value) {
+    Number() : Object(kType) {
     }
 
-    int GetValue() const {
+    Number(int64_t value) : Object(kType), value_(value) {
+    }
+
+    // For values outside the int64_t range; use Make to get the normalized representation.
+    explicit Number(BigInt value)
+        : Object(kType),
+          value_(value.IsNegative() ? INT64_MIN : INT64_MAX),
+          big_(std::make_unique<BigInt>(std::move(value))) {
+    }
+
+    // Integers in this range are immediate, see IsImmediate. Only the others are Number
+    // objects, which take one block of the heap of the thread.
+    static constexpr int64_t kMinImmediate = -(int64_t{1} << 62);
+    static constexpr int64_t kMaxImmediate = (int64_t{1} << 62) - 1;
+
+    // Numbers are read with NumberValue, which also reads immediates.
+    static std::shared_ptr<Object> Make(int64_t value) {
+        if (value < kMinImmediate || value > kMaxImmediate) [[unlikely]] {
+            return Allocate<Number>(value);
+        }
+        auto bits = (static_cast<std::uintptr_t>(value) << 1) | 1;
+        return std::shared_ptr<Object>(std::shared_ptr<Object>(), reinterpret_cast<Object*>(bits));
+    }
+
+    // Numbers that fit in int64_t are always stored as such.
+    static std::shared_ptr<Object> Make(BigInt value);
+
+    bool IsBig() const {
+        return big_ != nullptr;
+    }
+
+    // Big numbers saturate to the int64_t range, which keeps them out of range as indices
+    // and sizes.
+    int64_t GetValue() const {
         return value_;
     }
 
+    // Only valid if IsBig().
+    const BigInt& GetBig() const {
+        return *big_;
+    }
+
+    BigInt ToBigInt() const {
+        return big_ ? *big_ : BigInt(value_);
+    }
+
     std::shared_ptr<Object> Eval(std::shared_ptr<Scope> scope) override {
-        return std::make_shared<Number>(value_);
+        return shared_from_this();
     }
 
     operator std::string() const override {
-        return std::to_string(value_);
+        return big_ ? big_->ToString() : std::to_string(value_);
+    }
+
+    void Print(std::ostream* out) const override {
+        if (big_) {
+            *out << big_->ToString();
+        } else {
+            *out << value_;
+        }
     }
 
 private:
     int64_t value_ = 0;
+    std::unique_ptr<const BigInt> big_;
+};
+
+// The value of any number, immediate or not. Big values stay in the number they are read
+// from, which has to outlive this.
+class NumberValue {
+public:
+    explicit NumberValue(const Object* number) {
+        if (IsImmediate(number)) {
+            value_ = static_cast<int64_t>(reinterpret_cast<std::uintptr_t>(number)) >> 1;
+        } else {
+            auto object = static_cast<const Number*>(ToObject(number));
+            value_ = object->GetValue();
+            big_ = object->IsBig() ? &object->GetBig() : nullptr;
+        }
+    }
+
+    explicit NumberValue(const std::shared_ptr<Object>& number) : NumberValue(number.get()) {
+    }
+
+    bool IsBig() const {
+        return big_ != nullptr;
+    }
+
+    // Saturated like Number::GetValue.
+    int64_t GetValue() const {
+        return value_;
+    }
+
+    // Only valid if IsBig().
+    const BigInt& GetBig() const {
+        return *big_;
+    }
+
+    BigInt ToBigInt() const {
+        return big_ ? *big_ : BigInt(value_);
+    }
+
+private:
+    int64_t value_;
+    const BigInt* big_ = nullptr;
 };
 
 class Symbol : public Object, public std::enable_shared_from_this<Symbol> {
 public:
-    Symbol(const std::string& name) : name_(name) {
+    static constexpr Type kType = Type::SYMBOL;
+
+    explicit Symbol(SymbolId id) : Object(kType), id_(id) {
     }
 
-    const std::string& GetName() const {
-        return name_;
+    Symbol(const std::string& name)
+        : Object(kType), id_(SymbolTable::Instance().Intern(name)) {
     }
 
-    std::shared_ptr<Object> Eval(std::shared_ptr<Scope> scope) override {
-        return std::make_shared<Symbol>(name_);
+    // Returns the shared instance for the symbol, so every occurrence of a name in the
+    // parsed input points to the same object.
+    static std::shared_ptr<Symbol> Get(SymbolId id);
+
+    SymbolId GetId() const {
+        return id_;
+    }
+
+    const std::string& GetName() const {
+        return SymbolTable::Instance().GetName(id_);
     }
 
+    std::shared_ptr<Object> Eval(std::shared_ptr<Scope> scope) override;
+
     operator std::string() const override {
-        return name_;
+        return GetName();
+    }
+
+    void Print(std::ostream* out) const override {
+        *out << GetName();
     }
 
 private:
-    std::string name_;
+    SymbolId id_;
 };
 
-class Boolean : public Object, public std::enable_shared_from_this<Boolean> {
+class Boolean : public Object {
 public:
-    Boolean(const bool& value) : value_(value) {
+    static constexpr Type kType = Type::BOOLEAN;
+
+    Boolean(const bool& value) : Object(kType), value_(value) {
+    }
+
+    // Returns one of two static instances. Like immediates, the pointers own nothing, so
+    // copying them touches no reference count.
+    static std::shared_ptr<Boolean> Make(bool value) {
+        static Boolean true_value(true), false_value(false);
+        return std::shared_ptr<Boolean>(std::shared_ptr<Boolean>(),
+                                        value ? &true_value : &false_value);
     }
 
     bool GetValue() const {
@@ -93,13 +330,17 @@ public:
     }
 
     std::shared_ptr<Object> Eval(std::shared_ptr<Scope> scope) override {
-        return std::make_shared<Boolean>(value_);
+        return Make(value_);
     }
 
     operator std::string() const override {
         return value_ ? "#t" : "#f";
     }
 
+    void Print(std::ostream* out) const override {
+        *out << (value_ ? "#t" : "#f");
+    }
+
 private:
     bool value_;
 };
@@ -110,11 +351,31 @@ std::shared_ptr<T> As(const std::shared_ptr<Object>& obj);
 template <class T>
 bool Is(const std::shared_ptr<Object>& obj);
 
-class Cell : public Object, public std::enable_shared_from_this<Cell> {
+class Function;
+
+// Closures are functions with a tag of their own, so that call sites can tell them from
+// builtins without RTTI.
+template <>
+inline bool Is<Function>(const std::shared_ptr<Object>& obj) {
+    if (!obj || IsImmediate(obj.get())) {
+        return false;
+    }
+    auto type = ToObject(obj)->GetType();
+    return type == Type::FUNCTION || type == Type::CLOSURE;
+}
+
+class Cell : public Object {
 public:
-    Cell() = default;
+    static constexpr Type kType = Type::CELL;
 
-    Cell(std::shared_ptr<Object> ptr) : first_(std::move(ptr)), second_(nullptr) {
+    Cell() : Object(kType) {
+    }
+
+    Cell(std::shared_ptr<Object> ptr) : Object(kType), first_(std::move(ptr)), second_(nullptr) {
+    }
+
+    ~Cell() override {
+        DestroyChildren(this);
     }
 
     void SetFirst(std::shared_ptr<Object> first) {
@@ -125,60 +386,199 @@ public:
         second_ = std::move(second);
     }
 
-    void SetIsHead(bool is_head) {
-        is_head_ = is_head;
-    }
-
-    std::shared_ptr<Object> GetFirst() const {
+    const std::shared_ptr<Object>& GetFirst() const {
         return first_;
     }
 
-    std::shared_ptr<Object> GetSecond() const {
+    const std::shared_ptr<Object>& GetSecond() const {
         return second_;
     }
 
-    bool GetIsHead() const {
-        return is_head_;
-    }
-
+    // Evaluates the cell as a call form that was not analyzed. Nothing is cached in the cell,
+    // so parsed trees can be evaluated by any number of threads at once; analyzed Call nodes
+    // are what keep the resolved function.
     std::shared_ptr<Object> Eval(std::shared_ptr<Scope> scope) override;
 
-    operator std::string() const override {
-        std::stringstream ss;
+    operator std::string() const override;
+
+    void Print(std::ostream* out) const override;
 
-        if (is_head_) {
-            ss << "(";
+    void MoveChildren(std::vector<std::shared_ptr<Object>>* children) override {
+        if (first_) {
+            children->push_back(std::move(first_));
+        }
+        if (second_) {
+            children->push_back(std::move(second_));
         }
+    }
 
-        if (!first_) {
-            ss << "()";
-        } else {
-            ss << static_cast<std::string>(*first_);
+    void GetChildren(std::vector<const std::shared_ptr<Object>*>* children) const override {
+        if (first_) {
+            children->push_back(&first_);
         }
+        if (second_) {
+            children->push_back(&second_);
+        }
+    }
+
+private:
+    std::shared_ptr<Object> first_ = nullptr, second_ = nullptr;
+};
+
+// Fixed-size sequence with constant-time access to any element.
+class Vector : public Object, public std::enable_shared_from_this<Vector> {
+public:
+    static constexpr Type kType = Type::VECTOR;
+
+    // vector-set! can store a vector in itself.
+    static constexpr bool kMayFormCycles = true;
+
+    using Elements = std::vector<std::shared_ptr<Object>, HeapAllocator<std::shared_ptr<Object>>>;
+
+    explicit Vector(Elements elements) : Object(kType), elements_(std::move(elements)) {
+    }
+
+    ~Vector() override {
+        DestroyChildren(this);
+    }
+
+    std::size_t GetSize() const {
+        return elements_.size();
+    }
+
+    const std::shared_ptr<Object>& Get(std::size_t index) const {
+        return elements_[index];
+    }
+
+    void Set(std::size_t index, std::shared_ptr<Object> value) {
+        ParallelTask::CheckChange(owner_);
+        elements_[index] = std::move(value);
+    }
+
+    const Elements& GetElements() const {
+        return elements_;
+    }
+
+    std::shared_ptr<Object> Eval(std::shared_ptr<Scope> scope) override {
+        return shared_from_this();
+    }
+
+    operator std::string() const override;
 
-        if (!second_) {
-            ss << ")";
-            return ss.str();
+    void Print(std::ostream* out) const override;
+
+    void MoveChildren(std::vector<std::shared_ptr<Object>>* children) override {
+        for (auto& element : elements_) {
+            if (element) {
+                children->push_back(std::move(element));
+            }
         }
+    }
 
-        if (!Is<Cell>(second_)) {
-            ss << " . " << static_cast<std::string>(*second_) << ")";
-        } else {
-            ss << " " << static_cast<std::string>(*second_);
+    void GetChildren(std::vector<const std::shared_ptr<Object>*>* children) const override {
+        for (const auto& element : elements_) {
+            if (element) {
+                children->push_back(&element);
+            }
         }
+    }
 
-        return ss.str();
+private:
+    Elements elements_;
+    uint64_t owner_ = ParallelTask::Current();
+};
+
+// Vector of int64_t stored contiguously rather than as boxed numbers, so that bulk
+// arithmetic can run the kernels from numeric_kernels.h over it.
+class S64Vector : public Object, public std::enable_shared_from_this<S64Vector> {
+public:
+    static constexpr Type kType = Type::S64VECTOR;
+
+    using Elements = std::vector<int64_t, HeapAllocator<int64_t>>;
+
+    explicit S64Vector(Elements elements) : Object(kType), elements_(std::move(elements)) {
+    }
+
+    std::size_t GetSize() const {
+        return elements_.size();
+    }
+
+    int64_t Get(std::size_t index) const {
+        return elements_[index];
+    }
+
+    void Set(std::size_t index, int64_t value) {
+        ParallelTask::CheckChange(owner_);
+        elements_[index] = value;
+    }
+
+    const int64_t* GetData() const {
+        return elements_.data();
+    }
+
+    std::shared_ptr<Object> Eval(std::shared_ptr<Scope> scope) override {
+        return shared_from_this();
     }
 
+    operator std::string() const override;
+
+    void Print(std::ostream* out) const override;
+
 private:
-    std::shared_ptr<Object> first_ = nullptr, second_ = nullptr;
-    bool is_head_ = false;
+    Elements elements_;
+    uint64_t owner_ = ParallelTask::Current();
+};
+
+// Forms that do not simply evaluate all their arguments: the analyzer and the compiler
+// have to treat them specially.
+enum class FormKind { CALL, QUOTE, DEFINE, SET, AND, OR, IF, LAMBDA, LET };
+
+// Builtins that the bytecode VM executes with a dedicated opcode.
+enum class Operation {
+    NONE,
+    ADD,
+    SUBTRACT,
+    MULTIPLY,
+    DIVIDE,
+    EQUAL,
+    LESS,
+    GREATER,
+    LESS_EQUAL,
+    GREATER_EQUAL,
+    MIN,
+    MAX,
+    ABS
 };
 
 class Function : public Object {
 public:
+    static constexpr Type kType = Type::FUNCTION;
+
+    explicit Function(Type type = kType) : Object(type) {
+    }
+
     virtual ~Function() = default;
 
+    virtual FormKind GetFormKind() const {
+        return FormKind::CALL;
+    }
+
+    virtual Operation GetOperation() const {
+        return Operation::NONE;
+    }
+
+    // Pure functions depend only on their arguments and have no side effects, so calls
+    // with constant arguments can be computed once, during analysis.
+    virtual bool IsPure() const {
+        return false;
+    }
+
+    // Runs the function on arguments that are already evaluated. Only functions of
+    // FormKind::CALL support it; special forms need their arguments unevaluated.
+    virtual std::shared_ptr<Object> Invoke(std::span<const std::shared_ptr<Object>> args) {
+        throw RuntimeError("Cannot invoke a special form");
+    }
+
     std::shared_ptr<Object> Eval(std::shared_ptr<Scope> scope) override {
         throw RuntimeError("Cannot eval function");
     }
@@ -188,12 +588,22 @@ public:
     }
 };
 
+template <class T>
+bool Is(const std::shared_ptr<Object>& obj) {
+    return obj && GetType(obj.get()) == T::kType;
+}
+
+// Numbers may be immediates, which are not Number objects; NumberValue reads them.
 template <class T>
 std::shared_ptr<T> As(const std::shared_ptr<Object>& obj) {
-    return std::dynamic_pointer_cast<T>(obj);
+    static_assert(!std::is_same_v<T, Number>);
+    return Is<T>(obj) ? std::static_pointer_cast<T>(obj) : nullptr;
 }
 
+// Unchecked access for code that has already checked the type; does not touch the
+// reference count.
 template <class T>
-bool Is(const std::shared_ptr<Object>& obj) {
-    return obj && typeid(*obj) == typeid(T);
+T* Cast(const std::shared_ptr<Object>& obj) {
+    static_assert(!std::is_same_v<T, Number>);
+    return static_cast<T*>(ToObject(obj));
 }
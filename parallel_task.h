@@ -0,0 +1,59 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+#include "error.h"
+
+// Marks the thread as running one task of a parallel builtin for the lifetime of the object.
+// Tasks run at the same time as each other, so a task may only change what it made itself:
+// the global bindings, and the boxes and vectors made before it started, are shared with the
+// other tasks. Changing them throws RuntimeError instead of racing.
+class ParallelTask {
+public:
+    ParallelTask() : previous_(current) {
+        current = next_id.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    ParallelTask(const ParallelTask&) = delete;
+    ParallelTask& operator=(const ParallelTask&) = delete;
+
+    ~ParallelTask() {
+        current = previous_;
+    }
+
+    // Task running on this thread, or zero outside of tasks. Objects that can be changed
+    // keep the one they were made in.
+    static uint64_t Current() {
+        return current;
+    }
+
+    // Checks a change of an object made in the given task. Tasks are numbered in the order
+    // they start, and a task only gets hold of objects made before it or by itself and the
+    // tasks it started, so the objects it may change are those with a number no lower than
+    // its own.
+    static void CheckChange(uint64_t owner) {
+        if (owner < current) {
+            ThrowSharedChange();
+        }
+    }
+
+    // Checks a change of a global binding.
+    static void CheckGlobalChange() {
+        if (current) {
+            ThrowSharedChange();
+        }
+    }
+
+private:
+    [[noreturn]] static void ThrowSharedChange() {
+        throw RuntimeError("Cannot change shared state in a parallel task");
+    }
+
+    // Id of the task running on this thread, or zero. Constant-initialized for the same
+    // reason as Budget::current.
+    static inline thread_local constinit uint64_t current = 0;
+    static inline std::atomic<uint64_t> next_id = 1;
+
+    uint64_t previous_;
+};
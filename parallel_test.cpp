@@ -0,0 +1,91 @@
+#include <exception>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "scheme.h"
+
+// Calls of par-map and par-reduce may change what they made themselves, and nothing shared
+// with the other calls. Every case runs on both engines. Exits with a non-zero status if any
+// case fails.
+//
+//   scheme_parallel_test
+
+namespace {
+
+// Enough elements for several chunks, so that the calls run as several tasks.
+const std::vector<std::string> kSetup = {
+    "(define xs (vector->list (make-vector 2000 1)))",
+    "(define c 0)",
+    "(define v (make-vector 1 0))",
+    "(define (make-counter) (let ((n 0)) (lambda () (set! n (+ n 1)) n)))",
+    "(define counter (make-counter))",
+};
+
+constexpr const char* kSharedChange = "error: Cannot change shared state in a parallel task";
+
+struct Case {
+    std::string name;
+    // Run in order after the setup; only the value or error of the last is checked.
+    std::vector<std::string> expressions;
+    std::string expected;
+};
+
+const std::vector<Case> kCases = {
+    {"set! of a global", {"(par-map (lambda (x) (set! c (+ c x))) xs)"}, kSharedChange},
+    {"set! of a global on a short list", {"(par-map (lambda (x) (set! c x)) '(1 2))"},
+     kSharedChange},
+    {"set! of a global in par-reduce", {"(par-reduce (lambda (a b) (set! c b) a) 0 xs)"},
+     kSharedChange},
+    {"vector-set! of a shared vector", {"(par-map (lambda (x) (vector-set! v 0 x)) xs)"},
+     kSharedChange},
+    {"set! of a shared captured variable", {"(par-map (lambda (x) (counter)) xs)"},
+     kSharedChange},
+    {"globals are unchanged after an error", {"(par-map (lambda (x) (set! c x)) xs)", "c"},
+     "0"},
+    {"changes of objects made by the call",
+     {"(list-tail (par-map (lambda (x) (let ((w (make-vector 1 x)) (g (make-counter)))"
+      " (vector-set! w 0 (+ x 1)) (g) (+ (g) (vector-ref w 0)))) xs) 1999)"},
+     "(4)"},
+    {"changes of objects made by a nested call",
+     {"(par-map (lambda (x) (let ((w (par-map (lambda (y) (make-vector 1 y)) xs)))"
+      " (vector-set! (car w) 0 x) (vector-ref (car w) 0))) '(5 6))"},
+     "(5 6)"},
+    {"changes after the call", {"(par-map (lambda (x) x) xs)", "(set! c 3)", "c"}, "3"},
+};
+
+std::string Run(Interpreter* interpreter, const std::string& expression) {
+    try {
+        return interpreter->Run(expression);
+    } catch (const std::exception& e) {
+        return std::string("error: ") + e.what();
+    }
+}
+
+}  // namespace
+
+int main() {
+    auto failures = 0;
+    for (const auto& test : kCases) {
+        for (auto engine : {Engine::TREE, Engine::BYTECODE}) {
+            Interpreter interpreter;
+            interpreter.SetEngine(engine);
+            for (const auto& expression : kSetup) {
+                Run(&interpreter, expression);
+            }
+            std::string result;
+            for (const auto& expression : test.expressions) {
+                result = Run(&interpreter, expression);
+            }
+            auto name = test.name + (engine == Engine::TREE ? " (tree)" : " (bytecode)");
+            if (result != test.expected) {
+                std::cerr << "FAIL " << name << ": got " << result << ", expected "
+                          << test.expected << std::endl;
+                ++failures;
+            } else {
+                std::cout << "ok   " << name << std::endl;
+            }
+        }
+    }
+    return failures ? 1 : 0;
+}
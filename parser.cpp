@@ -1,88 +1,127 @@
-#include "parser.h"
+#include <optional>
+#include <vector>
 
-std::shared_ptr<Object> Read(Tokenizer* tokenizer) {
-    if (tokenizer->IsEnd()) {
-        throw SyntaxError("It is empty");
-    }
+#include "parser.h"
 
-    Token token = tokenizer->GetToken();
-    tokenizer->Next();
+namespace {
 
-    if (auto bracket = std::get_if<BracketToken>(&token)) {
-        if (*bracket == BracketToken::OPEN) {
-            return ReadList(tokenizer);
-        } else {
-            throw SyntaxError("Wrong token");
-        }
-    } else if (auto symbol = std::get_if<SymbolToken>(&token)) {
-        return std::shared_ptr<Object>(new Symbol(symbol->name));
-    } else if (auto constant = std::get_if<ConstantToken>(&token)) {
-        return std::shared_ptr<Object>(new Number(constant->value));
-    } else if (auto boolean = std::get_if<BooleanToken>(&token)) {
-        return std::shared_ptr<Object>(new Boolean(boolean->value));
-    } else if (auto quote = std::get_if<QuoteToken>(&token)) {
-        auto first_cell = std::shared_ptr<Object>(new Symbol("quote"));
-        auto cell = std::shared_ptr<Object>(new Cell(first_cell));
+// Nesting is tracked on an explicit stack, so the depth of the input does not affect the
+// depth of the C++ stack.
+struct Frame {
+    bool is_quote = false;
+    std::shared_ptr<Object> root;
+    std::shared_ptr<Cell> cell;
+    bool dotted = false, need_close_bracket = false;
+};
 
-        auto first_subcell = Read(tokenizer);
-        auto subcell = std::shared_ptr<Object>(new Cell(first_subcell));
+std::shared_ptr<Object> MakeQuote(std::shared_ptr<Object> datum) {
+    static const SymbolId kQuote = SymbolTable::Instance().Intern("quote");
+    auto cell = Allocate<Cell>(Symbol::Get(kQuote));
+    cell->SetSecond(Allocate<Cell>(std::move(datum)));
+    return cell;
+}
 
-        As<Cell>(cell)->SetSecond(subcell);
-        return cell;
+void Append(Frame* frame, std::shared_ptr<Object> head) {
+    if (!frame->root) {
+        frame->cell = Allocate<Cell>(std::move(head));
+        frame->root = frame->cell;
+    } else if (frame->dotted) {
+        frame->dotted = false, frame->need_close_bracket = true;
+        frame->cell->SetSecond(std::move(head));
     } else {
-        throw SyntaxError("Wrong token");
+        auto tmp_cell = Allocate<Cell>(std::move(head));
+        frame->cell->SetSecond(tmp_cell);
+        frame->cell = std::move(tmp_cell);
     }
 }
 
-std::shared_ptr<Object> ReadList(Tokenizer* tokenizer) {
-    std::shared_ptr<Object> root{};
-    std::shared_ptr<Cell> cell{};
-
-    bool dotted = false, need_close_bracket = false;
-
-    while (!tokenizer->IsEnd()) {
-        Token token = tokenizer->GetToken();
+// Hands a complete datum to the enclosing frame. Returns it once nothing encloses it.
+std::optional<std::shared_ptr<Object>> Deliver(std::vector<Frame>* stack,
+                                               std::shared_ptr<Object> datum) {
+    while (!stack->empty() && stack->back().is_quote) {
+        datum = MakeQuote(std::move(datum));
+        stack->pop_back();
+    }
+    if (stack->empty()) {
+        return datum;
+    }
+    Append(&stack->back(), std::move(datum));
+    return std::nullopt;
+}
 
-        if (auto bracket = std::get_if<BracketToken>(&token);
-            bracket && *bracket == BracketToken::CLOSE) {
-            if (dotted) {
-                throw SyntaxError("Need one more object");
-            }
-            tokenizer->Next();
-            return root;
-        } else if (auto dot = std::get_if<DotToken>(&token)) {
-            if (need_close_bracket) {
-                throw SyntaxError("Need close bracket");
+std::shared_ptr<Object> ReadImpl(Tokenizer* tokenizer, std::vector<Frame> stack) {
+    while (true) {
+        if (!stack.empty() && !stack.back().is_quote) {
+            auto& frame = stack.back();
+            if (tokenizer->IsEnd()) {
+                throw SyntaxError("Unexpected end of expression");
             }
-            if (!root) {
-                throw SyntaxError("Dot as the first element of the list");
-            }
-            tokenizer->Next();
-            dotted = true;
-        } else {
-            if (need_close_bracket) {
+            Token token = tokenizer->GetToken();
+            if (auto bracket = std::get_if<BracketToken>(&token);
+                bracket && *bracket == BracketToken::CLOSE) {
+                if (frame.dotted) {
+                    throw SyntaxError("Need one more object");
+                }
+                tokenizer->Next();
+                auto list = std::move(frame.root);
+                stack.pop_back();
+                if (auto result = Deliver(&stack, std::move(list))) {
+                    return *result;
+                }
+                continue;
+            } else if (std::get_if<DotToken>(&token)) {
+                if (frame.need_close_bracket) {
+                    throw SyntaxError("Need close bracket");
+                }
+                if (!frame.root) {
+                    throw SyntaxError("Dot as the first element of the list");
+                }
+                tokenizer->Next();
+                frame.dotted = true;
+                continue;
+            } else if (frame.need_close_bracket) {
                 throw SyntaxError("Need close bracket because it was dotted");
             }
-            std::shared_ptr<Object> head = Read(tokenizer);
-            if (!root) {
-                root = std::shared_ptr<Object>(new Cell(head));
-                As<Cell>(root)->SetIsHead(true);
-                cell = As<Cell>(root);
+        }
+
+        if (tokenizer->IsEnd()) {
+            throw SyntaxError("It is empty");
+        }
+        Token token = tokenizer->GetToken();
+        tokenizer->Next();
+
+        std::shared_ptr<Object> datum;
+        if (auto bracket = std::get_if<BracketToken>(&token)) {
+            if (*bracket == BracketToken::OPEN) {
+                stack.emplace_back();
+                continue;
             } else {
-                if (dotted) {
-                    dotted = false, need_close_bracket = true;
-                    const auto& second = head;
-                    if (second && Is<Cell>(second)) {
-                        As<Cell>(second)->SetIsHead(false);
-                    }
-                    cell->SetSecond(second);
-                } else {
-                    auto tmp_cell = std::shared_ptr<Object>(new Cell(head));
-                    cell->SetSecond(tmp_cell);
-                    cell = As<Cell>(tmp_cell);
-                }
+                throw SyntaxError("Wrong token");
             }
+        } else if (auto symbol = std::get_if<SymbolToken>(&token)) {
+            datum = Symbol::Get(symbol->id);
+        } else if (auto constant = std::get_if<ConstantToken>(&token)) {
+            datum = constant->big ? Number::Make(*constant->big) : Number::Make(constant->value);
+        } else if (auto boolean = std::get_if<BooleanToken>(&token)) {
+            datum = Boolean::Make(boolean->value);
+        } else if (std::get_if<QuoteToken>(&token)) {
+            stack.emplace_back().is_quote = true;
+            continue;
+        } else {
+            throw SyntaxError("Wrong token");
+        }
+        if (auto result = Deliver(&stack, std::move(datum))) {
+            return *result;
         }
     }
-    throw SyntaxError("Unexpected end of expression");
+}
+
+}  // namespace
+
+std::shared_ptr<Object> Read(Tokenizer* tokenizer) {
+    return ReadImpl(tokenizer, {});
+}
+
+std::shared_ptr<Object> ReadList(Tokenizer* tokenizer) {
+    return ReadImpl(tokenizer, {Frame{}});
 }
@@ -0,0 +1,97 @@
+#include <algorithm>
+
+#include "analyzer.h"
+#include "closure.h"
+#include "heap.h"
+#include "profiler.h"
+#include "scheme.h"
+
+thread_local Profiler* ProfiledRun::current = nullptr;
+
+Profiler::Profiler(std::chrono::nanoseconds sample_interval)
+    : sample_interval_(sample_interval), next_sample_(Clock::now() + sample_interval) {
+    auto& table = SymbolTable::Instance();
+    for (const auto& [id, builtin] : Interpreter::GetSharedBuiltins()) {
+        builtin_names_.emplace(builtin.get(), table.GetName(id));
+    }
+}
+
+std::vector<FunctionProfile> Profiler::GetFunctionProfiles() const {
+    std::vector<FunctionProfile> profiles;
+    for (const auto& [function, stats] : stats_) {
+        profiles.push_back({stats.name, stats.calls, stats.inclusive, stats.exclusive,
+                            stats.allocations});
+    }
+    std::sort(profiles.begin(), profiles.end(), [](const auto& lhs, const auto& rhs) {
+        return lhs.exclusive > rhs.exclusive;
+    });
+    return profiles;
+}
+
+void Profiler::WriteCollapsedStacks(std::ostream* out) const {
+    for (const auto& [stack, count] : samples_) {
+        *out << stack << ' ' << count << '\n';
+    }
+}
+
+void Profiler::Enter(const Object* function) {
+    auto now = Clock::now();
+    MaybeSample(now);
+    const Object* key = function;
+    const Lambda* lambda = nullptr;
+    if (GetType(function) == Type::CLOSURE) {
+        lambda = &static_cast<const Closure*>(function)->GetLambda();
+        key = lambda;
+    }
+    auto [it, inserted] = stats_.try_emplace(key);
+    auto& stats = it->second;
+    if (inserted) {
+        if (lambda) {
+            const auto& name = lambda->GetName();
+            stats.name = name ? SymbolTable::Instance().GetName(*name) : "lambda";
+            stats.lambda = lambda->shared_from_this();
+        } else if (auto name = builtin_names_.find(function); name != builtin_names_.end()) {
+            stats.name = name->second;
+        } else {
+            stats.name = "lambda";
+        }
+    }
+    ++stats.calls;
+    ++stats.active;
+    frames_.push_back({&stats, now, Heap::Local().GetStats().allocations});
+}
+
+void Profiler::Exit() {
+    auto now = Clock::now();
+    MaybeSample(now);
+    auto frame = frames_.back();
+    frames_.pop_back();
+
+    auto elapsed = now - frame.start;
+    auto allocations = Heap::Local().GetStats().allocations - frame.allocations;
+    auto& stats = *frame.stats;
+    if (!--stats.active) {
+        stats.inclusive += elapsed;
+    }
+    stats.exclusive += elapsed - frame.child_time;
+    stats.allocations += allocations - frame.child_allocations;
+    if (!frames_.empty()) {
+        frames_.back().child_time += elapsed;
+        frames_.back().child_allocations += allocations;
+    }
+}
+
+void Profiler::MaybeSample(Clock::time_point now) {
+    if (sample_interval_ == Clock::duration::zero() || now < next_sample_ || frames_.empty()) {
+        return;
+    }
+    next_sample_ = now + sample_interval_;
+    std::string stack;
+    for (const auto& frame : frames_) {
+        if (!stack.empty()) {
+            stack += ';';
+        }
+        stack += frame.stats->name;
+    }
+    ++samples_[stack];
+}
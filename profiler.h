@@ -0,0 +1,143 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class Object;
+
+struct FunctionProfile {
+    std::string name;
+    std::size_t calls = 0;
+    // Time until the calls returned, counted once for recursive calls.
+    std::chrono::nanoseconds inclusive{0};
+    // The same without the time spent in calls made from them.
+    std::chrono::nanoseconds exclusive{0};
+    // Heap allocations made by the calls themselves, not by calls made from them.
+    std::size_t allocations = 0;
+};
+
+// Records the calls of functions made while an interpreter runs with the profiler set.
+// The hooks exist only in builds with SCHEME_PROFILING defined, and cost nothing otherwise.
+//
+// With a sample interval the profiler also takes the stack of active calls whenever that
+// much time has passed. Samples are taken when a call starts or returns rather than by a
+// timer, so time spent between calls is attributed to the next one.
+class Profiler {
+public:
+    static constexpr bool kAvailable =
+#ifdef SCHEME_PROFILING
+        true;
+#else
+        false;
+#endif
+
+    explicit Profiler(std::chrono::nanoseconds sample_interval = {});
+
+    // Functions by decreasing exclusive time.
+    std::vector<FunctionProfile> GetFunctionProfiles() const;
+
+    // One line per distinct stack, outermost call first, with the frames separated by ';'
+    // and followed by the number of samples: the collapsed format of flamegraph.pl.
+    void WriteCollapsedStacks(std::ostream* out) const;
+
+    // Profiler recording the calls made on this thread, if any.
+    static Profiler* Current();
+
+    void Enter(const Object* function);
+
+    void Exit();
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Stats {
+        std::string name;
+        // Kept alive, so that its address is not taken by another lambda.
+        std::shared_ptr<const Object> lambda;
+        std::size_t calls = 0;
+        std::size_t active = 0;
+        Clock::duration inclusive{0}, exclusive{0};
+        std::size_t allocations = 0;
+    };
+
+    struct Frame {
+        Stats* stats;
+        Clock::time_point start;
+        std::size_t allocations;
+        Clock::duration child_time{0};
+        std::size_t child_allocations = 0;
+    };
+
+    void MaybeSample(Clock::time_point now);
+
+    Clock::duration sample_interval_;
+    Clock::time_point next_sample_;
+    std::vector<Frame> frames_;
+    // Builtins by object, and closures by the lambda they were made by, so that all the
+    // closures made by one lambda share a row.
+    std::unordered_map<const Object*, Stats> stats_;
+    std::unordered_map<std::string, std::size_t> samples_;
+    std::unordered_map<const Object*, std::string> builtin_names_;
+};
+
+// Makes the profiler current on this thread for the lifetime of the object.
+class ProfiledRun {
+public:
+    explicit ProfiledRun(Profiler* profiler) : previous_(current) {
+        current = profiler;
+    }
+
+    ProfiledRun(const ProfiledRun&) = delete;
+    ProfiledRun& operator=(const ProfiledRun&) = delete;
+
+    ~ProfiledRun() {
+        current = previous_;
+    }
+
+private:
+    static thread_local Profiler* current;
+
+    Profiler* previous_;
+
+    friend class Profiler;
+};
+
+inline Profiler* Profiler::Current() {
+    return ProfiledRun::current;
+}
+
+// Records one call into the current profiler, if there is one.
+class ProfiledCall {
+public:
+    explicit ProfiledCall(const Object* function) : profiler_(Profiler::Current()) {
+        if (profiler_) {
+            profiler_->Enter(function);
+        }
+    }
+
+    ProfiledCall(const ProfiledCall&) = delete;
+    ProfiledCall& operator=(const ProfiledCall&) = delete;
+
+    ~ProfiledCall() {
+        if (profiler_) {
+            profiler_->Exit();
+        }
+    }
+
+private:
+    Profiler* profiler_;
+};
+
+#ifdef SCHEME_PROFILING
+#define SCHEME_PROFILE_CALL(function) ProfiledCall profiled_call(function)
+#define SCHEME_PROFILE_RUN(profiler) ProfiledRun profiled_run(profiler)
+#else
+#define SCHEME_PROFILE_CALL(function)
+#define SCHEME_PROFILE_RUN(profiler)
+#endif
@@ -1,18 +1,48 @@
+#include <algorithm>
+
 #include "scheme.h"
+#include "analyzer.h"
 #include "tokenizer.h"
 #include "parser.h"
 #include "error.h"
 
+const BuiltinTable& Interpreter::GetSharedBuiltins() {
+    static const auto kBuiltins = [] {
+        BuiltinTable builtins;
+        auto& table = SymbolTable::Instance();
+        for (auto& [name, obj] : GetBuiltInFunctions()) {
+            builtins.emplace_back(table.Intern(name), std::move(obj));
+        }
+        // With the largest id first, a new global scope is sized in one step.
+        std::sort(builtins.begin(), builtins.end(),
+                  [](const auto& lhs, const auto& rhs) { return lhs.first > rhs.first; });
+        return builtins;
+    }();
+    return kBuiltins;
+}
+
+const std::shared_ptr<Object>* Interpreter::FindSharedBuiltin(SymbolId id) {
+    const auto& builtins = GetSharedBuiltins();
+    auto it = std::lower_bound(builtins.begin(), builtins.end(), id,
+                               [](const auto& builtin, SymbolId id) { return builtin.first > id; });
+    return it != builtins.end() && it->first == id ? &it->second : nullptr;
+}
+
 std::shared_ptr<Object> Interpreter::Eval(std::shared_ptr<Object> expression) {
+    Budget budget(limits_);
+    return EvalTree(std::move(expression));
+}
+
+std::shared_ptr<Object> Interpreter::EvalTree(std::shared_ptr<Object> expression) {
+    SCHEME_PROFILE_RUN(profiler_);
     if (!expression) {
         throw RuntimeError("() cannot be evaluated");
     }
-    return expression->Eval(std::make_shared<Scope>(global_scope_));
+    return EvalExpression(expression, global_scope_);
 }
 
 std::shared_ptr<Object> Interpreter::Parse(const std::string& expression) {
-    std::stringstream ss(expression);
-    Tokenizer tokenizer(&ss);
+    Tokenizer tokenizer{std::string_view(expression)};
     auto expr = Read(&tokenizer);
     if (!tokenizer.IsEnd()) {
         throw SyntaxError("Unexpected token at the end");
@@ -20,10 +50,106 @@ std::shared_ptr<Object> Interpreter::Parse(const std::string& expression) {
     return expr;
 }
 
+std::shared_ptr<Object> Interpreter::Analyze(std::shared_ptr<Object> expression) {
+    return ::Analyze(expression, global_scope_);
+}
+
+namespace {
+
+// Deeper expressions always run on the VM, which does not recurse on nesting. So do the
+// bodies of the lambdas and lets in them, as the VM compiles those as well.
+constexpr std::size_t kMaxTreeDepth = 1000;
+
+}  // namespace
+
 std::string Interpreter::Run(const std::string& expression) {
-    std::ostringstream ss;
-    auto source = Parse(expression);
-    std::shared_ptr<Object> evaluated = Eval(source);
-    auto output = evaluated ? std::string(*evaluated) : "()";
-    return output;
+    std::ostringstream out;
+    Run(expression, &out);
+    return out.str();
+}
+
+void Interpreter::Run(const std::string& expression, std::ostream* out) {
+    Budget budget(limits_);
+    if (cache_.GetCapacity()) {
+        Print(ExecuteCached(expression), out);
+    } else {
+        Print(Execute(Parse(expression)), out);
+    }
+}
+
+std::size_t Interpreter::RunBatch(Tokenizer* tokenizer, std::ostream* out) {
+    std::size_t count = 0;
+    while (!tokenizer->IsEnd()) {
+        Budget budget(limits_);
+        Print(Execute(Read(tokenizer)), out);
+        *out << '\n';
+        ++count;
+    }
+    return count;
+}
+
+std::size_t Interpreter::RunBatch(std::istream* in, std::ostream* out) {
+    Tokenizer tokenizer(in);
+    return RunBatch(&tokenizer, out);
+}
+
+void Interpreter::CheckDepth(std::size_t depth) const {
+    if (auto budget = Budget::Current()) {
+        budget->CheckDepth(depth);
+    }
+}
+
+bool Interpreter::UsesVm(const std::shared_ptr<Object>& source, std::size_t depth) const {
+    return (engine_ == Engine::BYTECODE || depth > kMaxTreeDepth) && source;
+}
+
+std::shared_ptr<Object> Interpreter::Execute(std::shared_ptr<Object> expression) {
+    SCHEME_PROFILE_RUN(profiler_);
+    AnalysisInfo info;
+    auto source = ::Analyze(expression, global_scope_, &info);
+    expression.reset();
+    folded_count_ += info.folded;
+    CheckDepth(info.depth);
+    if (UsesVm(source, info.depth)) {
+        return ::Execute(Compile(source, global_scope_), global_scope_);
+    }
+    return EvalTree(std::move(source));
+}
+
+std::shared_ptr<Object> Interpreter::ExecuteCached(const std::string& expression) {
+    SCHEME_PROFILE_RUN(profiler_);
+    auto entry = cache_.Find(expression);
+    if (!entry) {
+        // Texts that fail to parse are not cached.
+        entry = cache_.Insert(expression, Parse(expression));
+    }
+    // Only a change of the names the tree was built from makes it differ from a new analysis.
+    // Its calls and folded values check their own heads, so they stay in use whatever other
+    // globals change.
+    auto version = global_scope_->GetVersion();
+    if (entry->analyzed && entry->version != version &&
+        IsBoundAsAnalyzed(entry->globals, *global_scope_)) {
+        entry->version = version;
+    }
+    if (!entry->analyzed || entry->version != version) {
+        entry->analyzed.reset();
+        entry->compiled.reset();
+        AnalysisInfo info;
+        auto analyzed = ::Analyze(entry->parsed, global_scope_, &info);
+        entry->analyzed = std::move(analyzed);
+        entry->depth = info.depth;
+        entry->globals = std::move(info.globals);
+        entry->version = version;
+        folded_count_ += info.folded;
+    }
+    CheckDepth(entry->depth);
+    auto source = *entry->analyzed;
+    if (UsesVm(source, entry->depth)) {
+        if (!entry->compiled) {
+            entry->compiled = Compile(source, global_scope_);
+        }
+        // Nothing the VM runs can reach the cache, so the entry outlives the execution.
+        return ::Execute(*entry->compiled, global_scope_);
+    }
+    return EvalTree(std::move(source));
 }
\ No newline at end of file
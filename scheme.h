@@ -1,59 +1,264 @@
 #pragma once
 
+#include <atomic>
+#include <optional>
 #include <string>
 #include <unordered_map>
 #include <type_traits>
+#include <utility>
+#include <vector>
 
+#include "budget.h"
+#include "bytecode.h"
 #include "error.h"
+#include "expression_cache.h"
 #include "functions.h"
 #include "object.h"
+#include "parallel_task.h"
+#include "profiler.h"
+#include "symbol_table.h"
 
 class Object;
 
-class Scope {
+class Tokenizer;
+
+// Builtin functions keyed by the interned ids of their names.
+using BuiltinTable = std::vector<std::pair<SymbolId, std::shared_ptr<Object>>>;
+
+class Closure;
+
+class Scope : public std::enable_shared_from_this<Scope> {
 public:
-    Scope(const std::unordered_map<std::string, std::shared_ptr<Object>>& symbols)
-        : symbols_(symbols) {
+    using Binding = std::optional<std::shared_ptr<Object>>;
+
+    // Global scope starting out with the builtins.
+    explicit Scope(const BuiltinTable& builtins) : global_(this), version_(NextVersion()) {
+        for (const auto& [id, obj] : builtins) {
+            if (id >= globals_.size()) {
+                globals_.resize(id + 1);
+            }
+            globals_[id] = obj;
+        }
+    }
+
+    // Activation frame of a closure call, or of a let outside of any function. The analyzer
+    // gives every parameter and local a slot, so a frame is a fixed array of them and has no
+    // named bindings: the names it does not resolve to slots or captures are globals.
+    Scope(Scope* global, std::shared_ptr<Object>* slots, Closure* closure,
+          const std::shared_ptr<Object>* captures)
+        : global_(global), slots_(slots), closure_(closure), captures_(captures) {
+    }
+
+    Scope& GetGlobal() const {
+        return *global_;
+    }
+
+    // Changes on every change of a global binding, so that resolved call sites can tell
+    // whether the function they point to is still current. Versions are unique across all
+    // global scopes, so a call site evaluated by several interpreters cannot mistake the
+    // bindings of one for those of another.
+    std::size_t GetVersion() const {
+        return global_->version_;
+    }
+
+    // Calls callback(id, value) for every bound global name, in order of id.
+    template <class Callback>
+    void ForEachGlobal(Callback callback) const {
+        const auto& globals = global_->globals_;
+        for (SymbolId id = 0; id < globals.size(); ++id) {
+            if (globals[id]) {
+                callback(id, *globals[id]);
+            }
+        }
+    }
+
+    bool IsBound(SymbolId id) const {
+        return id < global_->globals_.size() && global_->globals_[id];
     }
 
-    void Define(const std::string& name, const std::shared_ptr<Object>& obj) {
-        symbols_[name] = obj;
+    // Whether the name is bound to exactly that object, for call sites that resolved it before
+    // some other global changed.
+    bool IsBoundTo(SymbolId id, const Object* obj) const {
+        const auto& globals = global_->globals_;
+        return id < globals.size() && globals[id] && globals[id]->get() == obj;
     }
 
-    void Reset(const std::string& name, const std::shared_ptr<Object>& obj) {
-        symbols_[name] = obj;
+    std::shared_ptr<Object>& GetSlot(std::size_t slot) const {
+        return slots_[slot];
     }
 
-    std::shared_ptr<Object> LookUp(const std::string& name) {
-        auto it = symbols_.find(name);
-        if (it != symbols_.end()) {
-            return it->second;
+    // Value captured by the closure running in this frame.
+    const std::shared_ptr<Object>& GetCapture(std::size_t index) const {
+        return captures_[index];
+    }
+
+    Closure* GetClosure() const {
+        return closure_;
+    }
+
+    Binding& GetGlobalSlot(SymbolId id) {
+        if (!IsBound(id)) {
+            throw NameError("Unknown symbol");
         }
-        if (parent_) {
-            return parent_->LookUp(name);
+        return global_->globals_[id];
+    }
+
+    void Define(SymbolId id, const std::shared_ptr<Object>& obj) {
+        ParallelTask::CheckGlobalChange();
+        auto& globals = global_->globals_;
+        if (id >= globals.size()) {
+            globals.resize(id + 1);
         }
-        throw NameError("Unknown symbol");
+        globals[id] = obj;
+        global_->version_ = NextVersion();
+    }
+
+    // Rebinds an existing binding, as set! does.
+    void Reset(SymbolId id, const std::shared_ptr<Object>& obj) {
+        ParallelTask::CheckGlobalChange();
+        GetGlobalSlot(id) = obj;
+        global_->version_ = NextVersion();
+    }
+
+    std::shared_ptr<Object> LookUp(SymbolId id) {
+        return *GetGlobalSlot(id);
+    }
+
+    // Drops every global binding. Closures keep their global scope alive, so the closures
+    // bound in it form cycles that only this breaks.
+    void Clear() {
+        global_->globals_.clear();
+        global_->version_ = NextVersion();
     }
 
 private:
-    std::unordered_map<std::string, std::shared_ptr<Object>> symbols_;
+    static std::size_t NextVersion() {
+        static std::atomic<std::size_t> next_version = 1;
+        return next_version.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // Indexed directly by symbol id. An empty optional marks an unbound name, since '() is
+    // represented by nullptr.
+    std::vector<Binding> globals_;
+    Scope* global_;
+    std::size_t version_ = 0;
 
-    std::shared_ptr<Scope> parent_;
+    std::shared_ptr<Object>* slots_ = nullptr;
+    Closure* closure_ = nullptr;
+    const std::shared_ptr<Object>* captures_ = nullptr;
 };
 
+enum class Engine { TREE, BYTECODE };
+
 class Interpreter {
 public:
-    Interpreter() : global_scope_(GetBuiltInFunctions()) {
+    Interpreter() : global_scope_(std::make_shared<Scope>(GetSharedBuiltins())) {
+    }
+
+    Interpreter(const Interpreter&) = delete;
+    Interpreter& operator=(const Interpreter&) = delete;
+
+    ~Interpreter() {
+        global_scope_->Clear();
     }
 
     std::shared_ptr<Object> Eval(std::shared_ptr<Object> expression);
 
     std::shared_ptr<Object> Parse(const std::string& expression);
 
+    // Resolves variable references of a parsed expression against the session environment.
+    std::shared_ptr<Object> Analyze(std::shared_ptr<Object> expression);
+
     std::string Run(const std::string& expression);
 
-    std::unordered_map<std::string, std::shared_ptr<Object>> GetBuiltInFunctions();
+    // Evaluates the expression and writes its value straight into out.
+    void Run(const std::string& expression, std::ostream* out);
+
+    // Reads, evaluates and prints top-level forms one at a time until the input ends, each
+    // value on its own line. A form is released before the next one is read, so memory
+    // use is bounded by the largest form rather than by the input. Returns the number of
+    // forms evaluated; errors propagate with the forms before them already printed.
+    std::size_t RunBatch(Tokenizer* tokenizer, std::ostream* out);
+
+    std::size_t RunBatch(std::istream* in, std::ostream* out);
+
+    static std::unordered_map<std::string, std::shared_ptr<Object>> GetBuiltInFunctions();
+
+    // The builtins hold no state, so one table is built on first use and shared by every
+    // interpreter on every thread; constructing an interpreter only copies the bindings.
+    static const BuiltinTable& GetSharedBuiltins();
+
+    // The shared builtin bound to the name in a new interpreter, or null.
+    static const std::shared_ptr<Object>* FindSharedBuiltin(SymbolId id);
+
+    const std::shared_ptr<Scope>& GetGlobalScope() const {
+        return global_scope_;
+    }
+
+    // Selects how Run executes expressions, and the bodies of the closures they make. Both
+    // engines give the same results.
+    void SetEngine(Engine engine) {
+        engine_ = engine;
+    }
+
+    Engine GetEngine() const {
+        return engine_;
+    }
+
+    // Number of calls folded to constants while analyzing the expressions run so far.
+    std::size_t GetFoldedCount() const {
+        return folded_count_;
+    }
+
+    // Lets Run keep the trees of up to capacity distinct source texts, so that a text seen
+    // before skips tokenizing, parsing and analysis. Zero, the default, turns it off.
+    void SetCacheCapacity(std::size_t capacity) {
+        cache_.SetCapacity(capacity);
+    }
+
+    const ExpressionCache& GetCache() const {
+        return cache_;
+    }
+
+    // Records the calls made by the expressions this interpreter runs from now on; null
+    // stops recording. Needs a build with SCHEME_PROFILING, see Profiler.
+    void SetProfiler(Profiler* profiler) {
+        profiler_ = profiler;
+    }
+
+    // Bounds every Eval and Run from now on, and every form of RunBatch on its own. A run
+    // over a limit throws ResourceLimitError; definitions it made before stay in place.
+    // Default limits bound nothing.
+    void SetLimits(const Limits& limits) {
+        limits_ = limits;
+    }
+
+    const Limits& GetLimits() const {
+        return limits_;
+    }
 
 private:
-    Scope global_scope_;
+    std::shared_ptr<Object> Execute(std::shared_ptr<Object> expression);
+
+    std::shared_ptr<Object> ExecuteCached(const std::string& expression);
+
+    // Eval without a budget of its own, for the callers that set one up.
+    std::shared_ptr<Object> EvalTree(std::shared_ptr<Object> expression);
+
+    // Rejects an analyzed tree nested deeper than the current budget allows, before any of
+    // it runs.
+    void CheckDepth(std::size_t depth) const;
+
+    // Whether an analyzed tree of the given depth runs on the VM.
+    bool UsesVm(const std::shared_ptr<Object>& source, std::size_t depth) const;
+
+    // Session environment: lives as long as the interpreter, so definitions made by one
+    // Run are visible to the next one.
+    std::shared_ptr<Scope> global_scope_;
+
+    Engine engine_ = Engine::TREE;
+    std::size_t folded_count_ = 0;
+    ExpressionCache cache_;
+    Profiler* profiler_ = nullptr;
+    Limits limits_;
 };
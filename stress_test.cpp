@@ -0,0 +1,152 @@
+#include <chrono>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "scheme.h"
+
+// Inputs far longer and deeper than the stack could hold if reading, analysis, evaluation,
+// printing or destruction recursed on them. Every case runs on both engines. Exits with a
+// non-zero status if any case fails.
+//
+//   scheme_stress_test
+
+namespace {
+
+constexpr std::size_t kLongList = 10'000'000;
+constexpr std::size_t kManyArgs = 1'000'000;
+constexpr std::size_t kDeepNesting = 100'000;
+
+std::string Repeat(std::string_view text, std::size_t count) {
+    std::string result;
+    result.reserve(text.size() * count);
+    for (std::size_t i = 0; i < count; ++i) {
+        result += text;
+    }
+    return result;
+}
+
+struct Case {
+    std::string name;
+    // Expressions run in order on one interpreter; only the value of the last is checked.
+    std::function<std::vector<std::string>()> expressions;
+    std::function<std::string()> expected;
+};
+
+std::vector<Case> MakeCases() {
+    auto n = std::to_string(kLongList);
+    return {
+        {"read and print a long list",
+         [] { return std::vector<std::string>{"'(" + Repeat("1 ", kLongList) + ")"}; },
+         [] { return "(" + Repeat("1 ", kLongList - 1) + "1)"; }},
+        {"build and walk a long list",
+         [n] {
+             return std::vector<std::string>{"(list-tail (vector->list (make-vector " + n +
+                                             " 7)) " + std::to_string(kLongList - 1) + ")"};
+         },
+         [] { return std::string("(7)"); }},
+        {"define and drop a long list",
+         [n] {
+             return std::vector<std::string>{"(define big (vector->list (make-vector " + n +
+                                                 " 0)))",
+                                             "(set! big 0)", "big"};
+         },
+         [] { return std::string("0"); }},
+        {"call with many arguments",
+         [] { return std::vector<std::string>{"(+ " + Repeat("1 ", kManyArgs) + ")"}; },
+         [] { return std::to_string(kManyArgs); }},
+        {"nested +",
+         [] {
+             return std::vector<std::string>{Repeat("(+ 1 ", kDeepNesting) + "0" +
+                                             Repeat(")", kDeepNesting)};
+         },
+         [] { return std::to_string(kDeepNesting); }},
+        {"nested and",
+         [] {
+             return std::vector<std::string>{Repeat("(and ", kDeepNesting) + "#t" +
+                                             Repeat(")", kDeepNesting)};
+         },
+         [] { return std::string("#t"); }},
+        {"nested list",
+         [] {
+             return std::vector<std::string>{Repeat("(list ", kDeepNesting) +
+                                             Repeat(")", kDeepNesting)};
+         },
+         [] { return Repeat("(", kDeepNesting - 1) + "()" + Repeat(")", kDeepNesting - 1); }},
+        {"nested quote",
+         [] { return std::vector<std::string>{Repeat("'", kDeepNesting) + "x"}; },
+         [] {
+             return Repeat("(quote ", kDeepNesting - 1) + "x" + Repeat(")", kDeepNesting - 1);
+         }},
+        {"nested let body",
+         [] {
+             return std::vector<std::string>{"(let ((x 1)) " + Repeat("(+ 1 ", kDeepNesting) +
+                                             "x" + Repeat(")", kDeepNesting) + ")"};
+         },
+         [] { return std::to_string(kDeepNesting + 1); }},
+        {"nested lambda body",
+         [] {
+             return std::vector<std::string>{"(define (f x) " + Repeat("(+ 1 ", kDeepNesting) +
+                                                 "x" + Repeat(")", kDeepNesting) + ")",
+                                             "(f 2)"};
+         },
+         [] { return std::to_string(kDeepNesting + 2); }},
+        // The calls compiled for + no longer hold, and the new function takes their place.
+        {"nested lambda body after its builtin is redefined",
+         [] {
+             return std::vector<std::string>{"(define (f x) " + Repeat("(+ 1 ", kDeepNesting) +
+                                                 "x" + Repeat(")", kDeepNesting) + ")",
+                                             "(define + max)", "(f 2)"};
+         },
+         [] { return std::string("2"); }},
+        // Larger than the address space, so the allocation fails whatever the overcommit policy.
+        {"vector larger than memory",
+         [] { return std::vector<std::string>{"(make-vector 100000000000000)"}; },
+         [] { return std::string("error: Out of memory"); }},
+    };
+}
+
+// Prints the start of a value that may be megabytes long.
+std::string Abbreviate(const std::string& text) {
+    constexpr std::size_t kMaxSize = 60;
+    return text.size() <= kMaxSize ? text : text.substr(0, kMaxSize) + "...";
+}
+
+bool RunCase(const Case& test, Engine engine) {
+    auto start = std::chrono::steady_clock::now();
+    std::string result;
+    try {
+        Interpreter interpreter;
+        interpreter.SetEngine(engine);
+        for (const auto& expression : test.expressions()) {
+            result = interpreter.Run(expression);
+        }
+    } catch (const std::exception& e) {
+        result = std::string("error: ") + e.what();
+    }
+    auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start);
+    auto expected = test.expected();
+    auto name = test.name + (engine == Engine::TREE ? " (tree)" : " (bytecode)");
+    if (result != expected) {
+        std::cerr << "FAIL " << name << ": got " << Abbreviate(result) << ", expected "
+                  << Abbreviate(expected) << std::endl;
+        return false;
+    }
+    std::cout << "ok   " << name << " in " << seconds.count() << " s" << std::endl;
+    return true;
+}
+
+}  // namespace
+
+int main() {
+    auto failures = 0;
+    for (const auto& test : MakeCases()) {
+        for (auto engine : {Engine::TREE, Engine::BYTECODE}) {
+            failures += !RunCase(test, engine);
+        }
+    }
+    return failures ? 1 : 0;
+}
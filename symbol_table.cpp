@@ -0,0 +1,38 @@
+#include "symbol_table.h"
+
+SymbolTable& SymbolTable::Instance() {
+    static SymbolTable table;
+    return table;
+}
+
+SymbolTable::~SymbolTable() {
+    for (auto& block : blocks_) {
+        delete[] block.load();
+    }
+}
+
+SymbolId SymbolTable::Intern(std::string_view name) {
+    // Ids never change once assigned, so every thread remembers the names it has interned
+    // and only goes to the shared map for new ones.
+    thread_local std::unordered_map<std::string_view, SymbolId> seen;
+    if (auto it = seen.find(name); it != seen.end()) {
+        return it->second;
+    }
+
+    std::lock_guard lock(mutex_);
+    auto it = ids_.find(name);
+    if (it == ids_.end()) {
+        SymbolId id = size_.load(std::memory_order_relaxed);
+        auto [block, index] = Locate(id);
+        auto names = blocks_[block].load(std::memory_order_relaxed);
+        if (!names) {
+            names = new std::string[kFirstBlockSize << block];
+            blocks_[block].store(names, std::memory_order_release);
+        }
+        names[index] = name;
+        it = ids_.emplace(names[index], id).first;
+        size_.store(id + 1, std::memory_order_release);
+    }
+    seen.emplace(it->first, it->second);
+    return it->second;
+}
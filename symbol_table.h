@@ -0,0 +1,54 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+
+using SymbolId = std::size_t;
+
+// Process-wide table interning symbol names to dense integer ids. Safe to use from any
+// thread: names are only ever added, lookups of names are lock-free and interning takes a
+// lock only for names the calling thread has not seen before.
+class SymbolTable {
+public:
+    static SymbolTable& Instance();
+
+    SymbolId Intern(std::string_view name);
+
+    const std::string& GetName(SymbolId id) const {
+        auto [block, index] = Locate(id);
+        return blocks_[block].load(std::memory_order_acquire)[index];
+    }
+
+    std::size_t Size() const {
+        return size_.load(std::memory_order_acquire);
+    }
+
+private:
+    static constexpr std::size_t kFirstBlockSize = 64;
+    static constexpr std::size_t kBlockCount = 40;
+
+    SymbolTable() = default;
+
+    ~SymbolTable();
+
+    // Block k holds kFirstBlockSize << k names, so the blocks never have to move and
+    // readers need no lock.
+    static std::pair<std::size_t, std::size_t> Locate(SymbolId id) {
+        std::size_t block = std::bit_width(id / kFirstBlockSize + 1) - 1;
+        return {block, id - kFirstBlockSize * ((std::size_t{1} << block) - 1)};
+    }
+
+    std::array<std::atomic<std::string*>, kBlockCount> blocks_{};
+    std::atomic<std::size_t> size_ = 0;
+
+    // Keys are views of the stored names.
+    std::unordered_map<std::string_view, SymbolId> ids_;
+    std::mutex mutex_;
+};
@@ -0,0 +1,134 @@
+#include <algorithm>
+#include <exception>
+#include <optional>
+
+#include "task_scheduler.h"
+
+namespace {
+
+constexpr std::size_t kNoWorker = -1;
+
+// Index of the worker running on this thread, if any.
+thread_local std::size_t current_worker = kNoWorker;
+
+}  // namespace
+
+struct TaskScheduler::Job {
+    const std::function<void(std::size_t)>* body;
+    std::atomic<std::size_t> remaining;
+    // Smallest index that has failed so far; tasks after it are skipped.
+    std::atomic<std::size_t> first_failure;
+    // errors[i] is written only by task i.
+    std::vector<std::exception_ptr> errors;
+};
+
+TaskScheduler& TaskScheduler::Instance() {
+    static TaskScheduler scheduler(std::max(1u, std::thread::hardware_concurrency()) - 1);
+    return scheduler;
+}
+
+TaskScheduler::TaskScheduler(std::size_t workers) {
+    for (std::size_t i = 0; i < workers; ++i) {
+        workers_.push_back(std::make_unique<Worker>());
+    }
+    // Started only when all deques exist, as workers steal from each other.
+    for (std::size_t i = 0; i < workers; ++i) {
+        workers_[i]->thread = std::thread([this, i] { Work(i); });
+    }
+}
+
+TaskScheduler::~TaskScheduler() {
+    {
+        std::lock_guard lock(sleep_mutex_);
+        stopping_ = true;
+    }
+    wake_.notify_all();
+    for (auto& worker : workers_) {
+        worker->thread.join();
+    }
+}
+
+void TaskScheduler::ParallelFor(std::size_t count,
+                                const std::function<void(std::size_t)>& body) {
+    if (workers_.empty() || count < 2) {
+        for (std::size_t i = 0; i < count; ++i) {
+            body(i);
+        }
+        return;
+    }
+
+    Job job{&body, count, count, std::vector<std::exception_ptr>(count)};
+    // A worker keeps its own tasks to itself until others come to steal them.
+    for (std::size_t i = 0; i < count; ++i) {
+        auto target = current_worker != kNoWorker ? current_worker : i % workers_.size();
+        std::lock_guard lock(workers_[target]->mutex);
+        workers_[target]->tasks.push_back({&job, i});
+    }
+    {
+        std::lock_guard lock(sleep_mutex_);
+        pending_ += count;
+    }
+    wake_.notify_all();
+
+    while (job.remaining.load(std::memory_order_acquire)) {
+        if (!TryRunTask(current_worker)) {
+            std::this_thread::yield();
+        }
+    }
+    auto failure = job.first_failure.load();
+    if (failure < count) {
+        std::rethrow_exception(job.errors[failure]);
+    }
+}
+
+bool TaskScheduler::TryRunTask(std::size_t self) {
+    std::optional<Task> task;
+    if (self != kNoWorker) {
+        std::lock_guard lock(workers_[self]->mutex);
+        if (!workers_[self]->tasks.empty()) {
+            task = workers_[self]->tasks.back();
+            workers_[self]->tasks.pop_back();
+        }
+    }
+    for (std::size_t i = 0; !task && i < workers_.size(); ++i) {
+        auto& victim = *workers_[(self == kNoWorker ? i : self + 1 + i) % workers_.size()];
+        std::lock_guard lock(victim.mutex);
+        if (!victim.tasks.empty()) {
+            task = victim.tasks.front();
+            victim.tasks.pop_front();
+        }
+    }
+    if (!task) {
+        return false;
+    }
+    --pending_;
+
+    auto job = task->job;
+    if (task->index < job->first_failure.load()) {
+        try {
+            (*job->body)(task->index);
+        } catch (...) {
+            job->errors[task->index] = std::current_exception();
+            auto failure = job->first_failure.load();
+            while (task->index < failure &&
+                   !job->first_failure.compare_exchange_weak(failure, task->index)) {
+            }
+        }
+    }
+    job->remaining.fetch_sub(1, std::memory_order_release);
+    return true;
+}
+
+void TaskScheduler::Work(std::size_t self) {
+    current_worker = self;
+    while (true) {
+        if (TryRunTask(self)) {
+            continue;
+        }
+        std::unique_lock lock(sleep_mutex_);
+        wake_.wait(lock, [this] { return stopping_ || pending_ > 0; });
+        if (stopping_) {
+            return;
+        }
+    }
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fork-join scheduler behind the parallel builtins. Every worker owns a deque of tasks: it
+// takes the newest task from its own deque and, once that is empty, steals the oldest one
+// from another worker. A thread waiting for its job runs tasks too, so jobs can nest.
+class TaskScheduler {
+public:
+    // The shared scheduler, started on first use with one worker less than there are cores,
+    // as the thread waiting for a job takes part in it.
+    static TaskScheduler& Instance();
+
+    explicit TaskScheduler(std::size_t workers);
+
+    TaskScheduler(const TaskScheduler&) = delete;
+    TaskScheduler& operator=(const TaskScheduler&) = delete;
+
+    ~TaskScheduler();
+
+    std::size_t GetWorkerCount() const {
+        return workers_.size();
+    }
+
+    // Runs body(i) for every i < count and returns once all of them are done. If some of the
+    // calls throw, rethrows the exception of the smallest such i, whatever the timing; calls
+    // after it may be skipped. Without workers everything runs on the calling thread.
+    void ParallelFor(std::size_t count, const std::function<void(std::size_t)>& body);
+
+private:
+    struct Job;
+
+    struct Task {
+        Job* job;
+        std::size_t index;
+    };
+
+    struct Worker {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+        std::thread thread;
+    };
+
+    // Runs one task from the deque of worker self, if it is one, or stolen from another.
+    bool TryRunTask(std::size_t self);
+
+    void Work(std::size_t self);
+
+    std::vector<std::unique_ptr<Worker>> workers_;
+    // Tasks pushed but not yet taken; idle workers sleep while it is zero.
+    std::atomic<std::size_t> pending_ = 0;
+    std::mutex sleep_mutex_;
+    std::condition_variable wake_;
+    bool stopping_ = false;
+};
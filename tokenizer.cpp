@@ -1,3 +1,9 @@
+#include <charconv>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #include "tokenizer.h"
 
 bool IsFirstSymbolToken(char symbol) {
@@ -26,7 +32,26 @@ bool IsMiddleConstantToken(char symbol) {
     return std::isdigit(symbol);
 }
 
+// Literal of an optional sign and decimal digits.
+ConstantToken MakeConstant(const std::string& text) {
+    auto digits = text.data() + (text[0] == '+');
+    int64_t value;
+    auto [end, error] = std::from_chars(digits, text.data() + text.size(), value);
+    if (error == std::errc()) {
+        return ConstantToken(value);
+    }
+    return ConstantToken(BigInt::Parse(text));
+}
+
 void Tokenizer::Next() {
+    if (in_) {
+        ReadFromStream();
+    } else {
+        ReadFromBuffer();
+    }
+}
+
+void Tokenizer::ReadFromStream() {
     char symbol = in_->get();
 
     while (symbol != EOF && std::isspace(symbol)) {
@@ -68,7 +93,152 @@ void Tokenizer::Next() {
             cur += static_cast<char>(in_->get());
             symbol = in_->peek();
         }
-        token_ = ConstantToken(std::stoll(cur));
+        token_ = MakeConstant(cur);
+    } else {
+        throw SyntaxError("Syntax error");
+    }
+}
+
+namespace {
+
+bool IsSpace(char symbol) {
+    return symbol == ' ' || (symbol >= '\t' && symbol <= '\r');
+}
+
+bool IsDigit(char symbol) {
+    return symbol >= '0' && symbol <= '9';
+}
+
+bool IsAlpha(char symbol) {
+    return (symbol | 0x20) >= 'a' && (symbol | 0x20) <= 'z';
+}
+
+bool IsMiddleSymbol(char symbol) {
+    return IsAlpha(symbol) || IsDigit(symbol) || (symbol >= '<' && symbol <= '?') ||
+           symbol == '*' || symbol == '/' || symbol == '#' || symbol == '!' || symbol == '-';
+}
+
+enum class CharClass { SPACE, DIGIT, MIDDLE_SYMBOL };
+
+template <CharClass kClass>
+bool IsInClass(char symbol) {
+    if constexpr (kClass == CharClass::SPACE) {
+        return IsSpace(symbol);
+    } else if constexpr (kClass == CharClass::DIGIT) {
+        return IsDigit(symbol);
+    } else {
+        return IsMiddleSymbol(symbol);
+    }
+}
+
+#ifdef __SSE2__
+
+// Bytes of the block in [low, high], as a comparison mask.
+__m128i InRange(__m128i block, char low, char high) {
+    auto shifted = _mm_sub_epi8(block, _mm_set1_epi8(low));
+    auto above = _mm_subs_epu8(shifted, _mm_set1_epi8(high - low));
+    return _mm_cmpeq_epi8(above, _mm_setzero_si128());
+}
+
+__m128i Equal(__m128i block, char symbol) {
+    return _mm_cmpeq_epi8(block, _mm_set1_epi8(symbol));
+}
+
+template <CharClass kClass>
+__m128i ClassMask(__m128i block) {
+    if constexpr (kClass == CharClass::SPACE) {
+        return _mm_or_si128(Equal(block, ' '), InRange(block, '\t', '\r'));
+    } else if constexpr (kClass == CharClass::DIGIT) {
+        return InRange(block, '0', '9');
+    } else {
+        auto mask = InRange(_mm_or_si128(block, _mm_set1_epi8(0x20)), 'a', 'z');
+        mask = _mm_or_si128(mask, InRange(block, '0', '9'));
+        mask = _mm_or_si128(mask, InRange(block, '<', '?'));
+        mask = _mm_or_si128(mask, _mm_or_si128(Equal(block, '*'), Equal(block, '/')));
+        mask = _mm_or_si128(mask, _mm_or_si128(Equal(block, '#'), Equal(block, '!')));
+        return _mm_or_si128(mask, Equal(block, '-'));
+    }
+}
+
+#endif
+
+// Returns the first position in [pos, end) whose byte is not in the class. Full 16-byte
+// blocks are classified with SSE2, the tail one byte at a time.
+template <CharClass kClass>
+const char* Scan(const char* pos, const char* end) {
+#ifdef __SSE2__
+    while (end - pos >= 16) {
+        auto block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pos));
+        auto outside = ~_mm_movemask_epi8(ClassMask<kClass>(block)) & 0xffff;
+        if (outside) {
+            return pos + __builtin_ctz(outside);
+        }
+        pos += 16;
+    }
+#endif
+    while (pos != end && IsInClass<kClass>(*pos)) {
+        ++pos;
+    }
+    return pos;
+}
+
+const char* SkipSpaces(const char* pos, const char* end) {
+    // Tokens are usually separated by a single space; avoid the vector setup for it.
+    if (pos != end && *pos == ' ') {
+        ++pos;
+    }
+    if (pos == end || !IsSpace(*pos)) {
+        return pos;
+    }
+    return Scan<CharClass::SPACE>(pos, end);
+}
+
+}  // namespace
+
+void Tokenizer::ReadFromBuffer() {
+    pos_ = SkipSpaces(pos_, end_);
+    if (pos_ == end_) {
+        token_.reset();
+        return;
+    }
+
+    char symbol = *pos_++;
+    bool has_next = pos_ != end_;
+    if (symbol == '\'') {
+        token_ = QuoteToken();
+    } else if (IsDotToken(symbol)) {
+        token_ = DotToken();
+    } else if (IsBracketToken(symbol)) {
+        token_ = symbol == '(' ? BracketToken::OPEN : BracketToken::CLOSE;
+    } else if (symbol == '#' && has_next && (*pos_ == 't' || *pos_ == 'f')) {
+        token_ = BooleanToken{*pos_++ == 't'};
+    } else if ((symbol == '+' || symbol == '-') && !(has_next && IsDigit(*pos_))) {
+        token_ = SymbolToken(std::string_view(pos_ - 1, 1));
+    } else if (IsAlpha(symbol) || symbol == '<' || symbol == '=' || symbol == '>' ||
+               symbol == '*' || symbol == '/' || symbol == '#') {
+        auto begin = pos_ - 1;
+        pos_ = Scan<CharClass::MIDDLE_SYMBOL>(pos_, end_);
+        token_ = SymbolToken(std::string_view(begin, pos_ - begin));
+    } else if (IsDigit(symbol) || symbol == '+' || symbol == '-') {
+        auto begin = IsDigit(symbol) ? pos_ - 1 : pos_;
+        pos_ = Scan<CharClass::DIGIT>(pos_, end_);
+        // Accumulated as a negative number so that the minimum value fits as well.
+        int64_t value = 0;
+        bool overflow = false;
+        for (auto it = begin; it != pos_ && !overflow; ++it) {
+            overflow = __builtin_mul_overflow(value, 10, &value) ||
+                       __builtin_sub_overflow(value, *it - '0', &value);
+        }
+        if (!overflow && symbol != '-') {
+            overflow = __builtin_mul_overflow(value, -1, &value);
+        }
+        if (overflow) {
+            // A minus sign is right before the digits, so the text is parsed in place.
+            auto text = symbol == '-' ? begin - 1 : begin;
+            token_ = ConstantToken(BigInt::Parse(std::string_view(text, pos_ - text)));
+        } else {
+            token_ = ConstantToken(value);
+        }
     } else {
         throw SyntaxError("Syntax error");
     }
@@ -1,21 +1,29 @@
 #pragma once
 
 #include <variant>
+#include <memory>
 #include <optional>
 #include <istream>
 #include <regex>
+#include <string_view>
+#include "bigint.h"
 #include "error.h"
+#include "symbol_table.h"
 
 struct SymbolToken {
-    std::string name;
+    SymbolId id = 0;
 
     SymbolToken() = default;
 
-    SymbolToken(const std::string& n) : name(n) {
+    SymbolToken(std::string_view n) : id(SymbolTable::Instance().Intern(n)) {
+    }
+
+    const std::string& GetName() const {
+        return SymbolTable::Instance().GetName(id);
     }
 
     bool operator==(const SymbolToken& other) const {
-        return name == other.name;
+        return id == other.id;
     }
 };
 
@@ -35,13 +43,21 @@ enum class BracketToken { OPEN, CLOSE };
 
 struct ConstantToken {
     int64_t value = 0;
+    // Set instead of value for literals outside the int64_t range.
+    std::shared_ptr<const BigInt> big;
 
     ConstantToken() = default;
 
     ConstantToken(const int64_t& v) : value(v) {
     }
 
+    explicit ConstantToken(BigInt v) : big(std::make_shared<const BigInt>(std::move(v))) {
+    }
+
     bool operator==(const ConstantToken& other) const {
+        if (big || other.big) {
+            return big && other.big && *big == *other.big;
+        }
         return value == other.value;
     }
 };
@@ -68,6 +84,13 @@ public:
         Next();
     }
 
+    // Tokenizes a contiguous buffer (a string or a mapped file) in place. The buffer must
+    // outlive the tokenizer.
+    explicit Tokenizer(std::string_view buffer)
+        : in_(nullptr), pos_(buffer.data()), end_(buffer.data() + buffer.size()) {
+        Next();
+    }
+
     bool IsEnd() {
         return !token_;
     }
@@ -79,6 +102,12 @@ public:
     }
 
 private:
+    void ReadFromStream();
+
+    void ReadFromBuffer();
+
     std::optional<Token> token_;
     std::istream* const in_;
+    const char* pos_ = nullptr;
+    const char* end_ = nullptr;
 };
\ No newline at end of file